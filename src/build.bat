@@ -4,7 +4,8 @@ if not exist ..\build mkdir ..\build
 pushd ..\build
 del *.pdb
 cl %CompilerFlags% ../src/chess_asset_packer.cpp /link -incremental:no -opt:ref
-cl %CompilerFlags% ../src/chess.cpp -LD /link -incremental:no -opt:ref -PDB:dll%random%.pdb -EXPORT:GameUpdate
-cl %CompilerFlags% ../src/win32_chess.cpp /link -incremental:no -opt:ref user32.lib gdi32.lib winmm.lib opengl32.lib
+cl %CompilerFlags% ../src/chess_book_builder.cpp /link -incremental:no -opt:ref
+cl %CompilerFlags% ../src/chess.cpp -LD /link -incremental:no -opt:ref -PDB:dll%random%.pdb -EXPORT:GameUpdate -EXPORT:GameServeSearchJob
+cl %CompilerFlags% ../src/win32_chess.cpp /link -incremental:no -opt:ref user32.lib gdi32.lib winmm.lib opengl32.lib advapi32.lib
 REM cl %CompilerFlags% ../src/png.cpp /link -incremental:no -opt:ref
 popd
\ No newline at end of file
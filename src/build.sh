@@ -1,9 +1,10 @@
 #!/bin/bash
-COMPILER_FLAGS="-g -DDEBUG=0 -DINTERNAL=1 -DCOMPILER_GCC -O2 -Wall -Wno-pedantic -Wextra -Werror -fno-rtti -Wno-switch -Wno-logical-not-parentheses -Wno-unused-parameter -Wno-write-strings -Wno-unused-function -Wno-unused-variable -Wno-maybe-uninitialized -fno-exceptions -std=gnu++11"
+COMPILER_FLAGS="-g -DDEBUG=0 -DINTERNAL=1 -DCOMPILER_GCC -O2 -Wall -Wno-pedantic -Wextra -Werror -fno-rtti -Wno-switch -Wno-logical-not-parentheses -Wno-unused-parameter -Wno-write-strings -Wno-unused-function -Wno-unused-variable -Wno-maybe-uninitialized -fno-exceptions -std=gnu++14 -mpopcnt"
 
 mkdir -p ../build
 g++ chess_asset_packer.cpp -o ../build/chess_asset_packer $COMPILER_FLAGS -DCOMPILER_GCC
+g++ chess_book_builder.cpp -o ../build/chess_book_builder $COMPILER_FLAGS
 
 g++ -shared -o ../build/chess.willbeso -fPIC chess.cpp $COMPILER_FLAGS
 mv ../build/chess.willbeso ../build/chess.so
-g++ linux_chess.cpp -o ../build/linux_chess  $COMPILER_FLAGS -ldl -lpthread -lxcb -lX11-xcb -lGL -lX11
\ No newline at end of file
+g++ linux_chess.cpp -o ../build/linux_chess  $COMPILER_FLAGS -ldl -lpthread -lrt -lxcb -lX11-xcb -lGL -lX11
\ No newline at end of file
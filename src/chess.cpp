@@ -166,11 +166,30 @@ struct decision
 struct good_decision_result
 {
     decision Decision;
+    decision ExpectedReply;  // the opponent's best answer to Decision, if the search saw one
     s32 Value;
 };
 
 struct chess_game_state;
 
+struct minimax_search;
+
+struct transposition_table;
+struct pawn_table;
+
+struct search_cluster;
+
+struct endgame_tables;
+struct bitbase_generator;
+
+// NOTE(vincent): A move named by squares rather than by piece, so that it means the same
+// thing in another copy of the game (or in another process).
+struct root_move
+{
+    u8 FromSquare;  // Row*8 + Column
+    u8 DestCode;
+};
+
 struct get_good_decision_params
 {
     chess_game_state *Game;
@@ -178,9 +197,25 @@ struct get_good_decision_params
     random_series *Series;
     u32 MaxDepth;
     
-    b32 ShouldContinue;
+    platform_cancel_token CancelToken;
     good_decision_result Result;
     b32 Finished;
+    
+    transposition_table *Table;  // can be 0
+    transposition_table *Learning;  // results of earlier sessions, can be 0
+    pawn_table *PawnTable;          // can be 0
+    endgame_tables *Endgame;        // can be 0
+    search_cluster *Cluster;     // worker processes to split the root moves between, can be 0
+    
+    // NOTE(vincent): Window of the root, and the root moves to consider (all of them when
+    // RootMoveCount is 0). Searches over a subset of the root moves are how the work gets
+    // split between search worker processes.
+    f32 RootAlpha;
+    f32 RootBeta;
+    root_move *RootMoves;
+    u32 RootMoveCount;
+    
+    minimax_search *Search;  // state of the search in progress, lives in Arena
 };
 
 struct ai_state
@@ -191,6 +226,11 @@ struct ai_state
     f32 t;
     
     get_good_decision_params WorkParams;
+    platform_work_handle SearchHandle;
+    b32 SearchIsTimeSliced;  // the search runs in slices on the main thread, not in the queue
+    b32 SearchIsInFlight;    // submitted, and we haven't seen it finish yet
+    b32 SearchIsPipelined;   // submitted during the previous move's animation, on a snapshot
+    b32 SearchIsPondering;   // submitted on a snapshot, a guess of the human's next move
 };
 
 struct chess_game_state
@@ -229,6 +269,19 @@ struct chess_game_state
     // 8 for kings and knights. 6 * 8 = 48.  Total: 646, actual answer is probably much less.
     u32 DestinationsCount;
     destination Destinations[646];
+    
+    // NOTE(vincent): Only the side to move gets its destinations, and only once someone
+    // asks for them (UpdateDestinations()). The pieces of the other side have none.
+    // Destinations still keeps the lists each side had at its last generation
+    // (DestinationsKeptCounts), along with the board they were computed for, so that
+    // RecomputeDestinations() only regenerates the pieces the moves since then may have
+    // affected.
+    b32 DestinationsAreCurrent;
+    u8 DestinationsKeptCounts[32];       // Blacks then Whites
+    b32 DestinationsBoardIsValid[2];     // black, white
+    u8 DestinationsBoardSquares[2][32];  // Row*8 + Column, Blacks then Whites
+    u8 DestinationsBoardTypes[2][32];
+    b32 DestinationsBoardChecks[2];
 };
 
 enum game_mode
@@ -255,13 +308,97 @@ struct repeat_clocks
     repeat_clock Back;
 };
 
+struct zobrist_keys
+{
+    u64 Pieces[2][7][64];  // [IsWhite][chess_piece_type][Row*8 + Column]
+    u64 BlackToMove;
+    u64 Castling[4];       // black queen side, black king side, white queen side, white king side
+    u64 EnPassant[8];      // column of the pawn that just moved two squares
+};
+
+enum transposition_bound
+{
+    TranspositionBound_Exact,
+    TranspositionBound_Lower,  // the position is worth at least Value
+    TranspositionBound_Upper,  // the position is worth at most Value
+};
+
+// NOTE(vincent): Entries are written and read by several searches at once without locks.
+// KeyXorData holds Key ^ Data, so an entry torn by two concurrent writes doesn't verify
+// against any key, and reads as a miss.
+struct transposition_entry
+{
+    u64 volatile KeyXorData;
+    u64 volatile Data;
+};
+
+struct transposition_table
+{
+    transposition_entry *Entries;
+    u64 EntryCount;  // power of two
+    u32 volatile Generation;  // bumped by every search, so older entries get replaced first
+    platform_page_kind PageKind;
+    zobrist_keys Keys;
+};
+
+// NOTE(vincent): Cache of the pawn structure terms of the evaluation, keyed by the pawn
+// pieces only (see GetPawnKey()). Pawns move rarely, so most leaves of a search find their
+// structure here. It's shared between concurrent searches like the transposition table,
+// and verified the same way: KeyXorData holds the key xor all the other fields.
+struct pawn_entry
+{
+    u64 volatile KeyXorData;
+    u64 volatile Value;      // s32, from white's point of view
+    u64 volatile Passed[2];  // passed pawns, black then white, one bit per Row*8 + Column
+};
+
+struct pawn_table
+{
+    pawn_entry *Entries;
+    u64 EntryCount;  // power of two
+    zobrist_keys Keys;  // only the pawn keys are used
+};
+
+// NOTE(vincent): Opening book file in the Polyglot format: 16-byte big-endian entries (key,
+// move, weight, learn), sorted by key. See ComputeBookKey().
+struct opening_book
+{
+    u8 *Entries;
+    u64 EntryCount;
+};
+
+struct search_cluster
+{
+    platform_channel *Workers[MAX_SEARCH_WORKER_COUNT];
+    u32 WorkerCount;
+    u32 volatile Busy;  // the workers serve one search at a time
+    u32 SearchID;       // tags messages, so that late ones from an older search get ignored
+};
+
+// NOTE(vincent): What a game's AI needs to search on its own, concurrently with the
+// other games. There is one per game, at the same index.
+struct ai_slot
+{
+    memory_arena Arena;
+    random_series Series;
+    transposition_table *Table;     // shared by all slots
+    transposition_table *Learning;  // shared by all slots
+    pawn_table *PawnTable;          // shared by all slots
+    opening_book *Book;             // shared by all slots
+    endgame_tables *Endgame;        // shared by all slots
+    search_cluster *Cluster;        // shared by all slots
+    
+    // NOTE(vincent): Position searched by the AI while the real game is still busy
+    // (animating the previous move, or waiting for a human; see AdvanceAIAction()).
+    chess_game_state *Snapshot;
+};
+
 struct game_state
 {
     b32 IsInitialized;
     b32 ShouldSave;
     
     memory_arena GlobalArena;
-    memory_arena AIArena;
     
     random_series Series;
     
@@ -284,6 +421,25 @@ struct game_state
     chess_game_state Games[MAX_GAMES_COUNT];
     
     asset_header *Assets;       // TODO(vincent): 
+    
+    ai_slot AISlots[MAX_GAMES_COUNT];
+    
+    // NOTE(vincent): When set, AI vs AI games keep playing (without animations) while
+    // they are not the one on screen.
+    b32 SimulateBackgroundGames;
+    b32 BackgroundGamesMoved;
+    f32 BackgroundSaveT;
+    
+    game_state *SaveBuffer;  // what gets written to the save file, by a worker thread
+    platform_work_handle SaveHandle;
+    
+    transposition_table TranspositionTable;
+    transposition_table LearningTable;
+    pawn_table PawnTable;
+    opening_book Book;
+    endgame_tables *EndgameTables;  // in GlobalArena, so that it stays out of the save file
+    bitbase_generator *BitbaseGenerator;  // 0 unless the bitbases are being generated
+    search_cluster SearchCluster;
 };
 
 internal v2
@@ -336,6 +492,10 @@ InitChessPieces(chess_game_state *Game)
     InitChessPiece(Game->Blacks + 13, ChessPieceType_Bishop, 7, 5, 13);
     InitChessPiece(Game->Blacks + 14, ChessPieceType_Knight, 7, 6, 14);
     InitChessPiece(Game->Blacks + 15, ChessPieceType_Rook,   7, 7, 15);
+    
+    Game->DestinationsAreCurrent = false;
+    Game->DestinationsBoardIsValid[0] = false;
+    Game->DestinationsBoardIsValid[1] = false;
 }
 
 internal chess_piece *
@@ -399,184 +559,154 @@ HasPiece(chess_piece *Blacks, chess_piece *Whites, u32 Row, u32 Column)
     return Result;
 }
 
-internal b32
-IsCheck_(chess_piece *Blacks, chess_piece *Whites, b32 White)
+global_variable constexpr s32 KingSteps[8][2] =
 {
-    b32 Result = false;
-    Assert(Whites[12].Type == ChessPieceType_King);
-    Assert(Blacks[12].Type == ChessPieceType_King);
-    Assert(Blacks + 16 == Whites);
-    
-    s32 KR, KC;
-    chess_piece *Capturers;
-    if (White)
-    {
-        KR = Whites[12].Row;
-        KC = Whites[12].Column;
-        Capturers = Blacks;
-    }
-    else
-    {
-        KR = Blacks[12].Row;
-        KC = Blacks[12].Column;
-        Capturers = Whites;
-    }
-    
-    for (u32 Index = 0; Index < 16 && !Result; ++Index)
+    {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1},
+};
+global_variable constexpr s32 KnightJumps[8][2] =
+{
+    {2, 1}, {1, 2}, {-1, 2}, {-2, 1}, {-2, -1}, {-1, -2}, {1, -2}, {2, -1},
+};
+
+// NOTE(vincent): Tables by square (Row*8 + Column), with bit N of a u64 standing for
+// square N. The compiler fills them, there is nothing to initialize at startup.
+struct attack_tables
+{
+    u64 KnightAttacks[64];
+    u64 KingAttacks[64];
+    u64 PawnAttacks[2][64];  // black, white
+    u64 RookRays[64];        // squares a rook reaches from there on an empty board
+    u64 BishopRays[64];
+    u64 Between[64][64];     // squares strictly between two squares on a common line
+    u64 Lines[64][64];       // the whole line through two squares, 0 if there is none
+};
+
+internal constexpr attack_tables
+ComputeAttackTables()
+{
+    attack_tables Tables = {};
+    for (s32 From = 0; From < 64; ++From)
     {
-        chess_piece *Piece = Capturers + Index;
-        s32 R = Piece->Row;
-        s32 C = Piece->Column;
-        s32 dR = KR - R;
-        s32 dC = KC - C;
-        switch (Piece->Type)
+        s32 Row = From / 8;
+        s32 Column = From % 8;
+        u64 Rays[8] = {};
+        for (u32 StepIndex = 0; StepIndex < 8; ++StepIndex)
         {
-            case ChessPieceType_Pawn:
-            {
-                Result = (dR == (White ? -1 : 1) && AbsoluteValue(dC) == 1);
-            } break;
-            
-            case ChessPieceType_Rook:
-            {
-                if (dR == 0)
-                {
-                    s32 MinC = Minimum(C, KC);
-                    s32 MaxC = Maximum(C, KC);
-                    Result = true;
-                    for (s32 CIndex = MinC+1; CIndex < MaxC; ++CIndex)
-                    {
-                        if (HasPiece(Blacks, Whites, R, CIndex))
-                        {
-                            Result = false;
-                            break;
-                        }
-                    }
-                }
-                else if (dC == 0)
-                {
-                    s32 MinR = Minimum(R, KR);
-                    s32 MaxR = Maximum(R, KR);
-                    Result = true;
-                    for (s32 RIndex = MinR+1; RIndex < MaxR; ++RIndex)
-                    {
-                        if (HasPiece(Blacks, Whites, RIndex, C))
-                        {
-                            Result = false;
-                            break;
-                        }
-                    }
-                }
-            } break;
-            
-            case ChessPieceType_Knight:
-            {
-                Result = ((AbsoluteValue(dR) == 1 && AbsoluteValue(dC) == 2) ||
-                          (AbsoluteValue(dR) == 2 && AbsoluteValue(dC) == 1));
-            } break;
-            
-            case ChessPieceType_Bishop:
-            {
-                if (AbsoluteValue(dR) == AbsoluteValue(dC))
-                {
-                    Result = true;
-                    
-                    s32 RIncrement = (dR > 0 ? 1 : -1);
-                    s32 CIncrement = (dC > 0 ? 1 : -1);
-                    
-                    s32 CurrentR = R + RIncrement;
-                    s32 CurrentC = C + CIncrement;
-                    while (CurrentR != KR)
-                    {
-                        if (HasPiece(Blacks, Whites, CurrentR, CurrentC))
-                        {
-                            Result = false;
-                            break;
-                        }
-                        CurrentR += RIncrement;
-                        CurrentC += CIncrement;
-                    }
-                }
-            } break;
+            s32 JumpRow = Row + KnightJumps[StepIndex][0];
+            s32 JumpColumn = Column + KnightJumps[StepIndex][1];
+            if (0 <= JumpRow && JumpRow < 8 && 0 <= JumpColumn && JumpColumn < 8)
+                Tables.KnightAttacks[From] |= (u64)1 << (JumpRow*8 + JumpColumn);
             
-            case ChessPieceType_Queen:
+            s32 ToRow = Row + KingSteps[StepIndex][0];
+            s32 ToColumn = Column + KingSteps[StepIndex][1];
+            while (0 <= ToRow && ToRow < 8 && 0 <= ToColumn && ToColumn < 8)
             {
-                // NOTE(vincent): bishop test and then rook test
-                if (AbsoluteValue(dR) == AbsoluteValue(dC))
-                {
-                    Result = true;
-                    
-                    s32 RIncrement = (dR > 0 ? 1 : -1);
-                    s32 CIncrement = (dC > 0 ? 1 : -1);
-                    
-                    s32 CurrentR = R + RIncrement;
-                    s32 CurrentC = C + CIncrement;
-                    while (CurrentR != KR)
-                    {
-                        if (HasPiece(Blacks, Whites, CurrentR, CurrentC))
-                        {
-                            Result = false;
-                            break;
-                        }
-                        CurrentR += RIncrement;
-                        CurrentC += CIncrement;
-                    }
-                }
-                
-                if (!Result)
-                {
-                    if (dR == 0)
-                    {
-                        s32 MinC = Minimum(C, KC);
-                        s32 MaxC = Maximum(C, KC);
-                        Result = true;
-                        for (s32 CIndex = MinC+1; CIndex < MaxC; ++CIndex)
-                        {
-                            if (HasPiece(Blacks, Whites, R, CIndex))
-                            {
-                                Result = false;
-                                break;
-                            }
-                        }
-                    }
-                    else if (dC == 0)
-                    {
-                        s32 MinR = Minimum(R, KR);
-                        s32 MaxR = Maximum(R, KR);
-                        Result = true;
-                        for (s32 RIndex = MinR+1; RIndex < MaxR; ++RIndex)
-                        {
-                            if (HasPiece(Blacks, Whites, RIndex, C))
-                            {
-                                Result = false;
-                                break;
-                            }
-                        }
-                    }
-                }
-            } break;
-            
-            case ChessPieceType_King:
+                s32 To = ToRow*8 + ToColumn;
+                if (!Rays[StepIndex])
+                    Tables.KingAttacks[From] |= (u64)1 << To;
+                Tables.Between[From][To] = Rays[StepIndex];
+                Rays[StepIndex] |= (u64)1 << To;
+                ToRow += KingSteps[StepIndex][0];
+                ToColumn += KingSteps[StepIndex][1];
+            }
+            if (StepIndex & 1)
+                Tables.BishopRays[From] |= Rays[StepIndex];
+            else
+                Tables.RookRays[From] |= Rays[StepIndex];
+        }
+        
+        for (u32 StepIndex = 0; StepIndex < 8; ++StepIndex)
+        {
+            u64 Line = Rays[StepIndex] | Rays[(StepIndex + 4) & 7] | ((u64)1 << From);
+            for (s32 To = 0; To < 64; ++To)
             {
-                Result = (AbsoluteValue(dR) <= 1 && AbsoluteValue(dC) <= 1);
-            } break;
-            case ChessPieceType_Empty: break;
-            InvalidDefaultCase;
+                if (Rays[StepIndex] & ((u64)1 << To))
+                    Tables.Lines[From][To] = Line;
+            }
         }
+        
+        for (u32 IsWhite = 0; IsWhite < 2; ++IsWhite)
+        {
+            s32 ToRow = IsWhite ? Row + 1 : Row - 1;
+            if (0 <= ToRow && ToRow < 8 && Column > 0)
+                Tables.PawnAttacks[IsWhite][From] |= (u64)1 << (ToRow*8 + Column - 1);
+            if (0 <= ToRow && ToRow < 8 && Column < 7)
+                Tables.PawnAttacks[IsWhite][From] |= (u64)1 << (ToRow*8 + Column + 1);
+        }
+    }
+    return Tables;
+}
+
+global_variable constexpr attack_tables AttackTables = ComputeAttackTables();
+
+internal b32
+PieceAttacksSquare(chess_piece_type Type, b32 IsWhite, u32 From, u32 Target, u64 Occupied)
+{
+    // NOTE(vincent): Whether a piece on From attacks Target, the pieces on the Occupied
+    // squares blocking sliders.
+    u64 Reach = 0;
+    switch (Type)
+    {
+        case ChessPieceType_Pawn: Reach = AttackTables.PawnAttacks[IsWhite][From]; break;
+        case ChessPieceType_Knight: Reach = AttackTables.KnightAttacks[From]; break;
+        case ChessPieceType_King: Reach = AttackTables.KingAttacks[From]; break;
+        case ChessPieceType_Rook: Reach = AttackTables.RookRays[From]; break;
+        case ChessPieceType_Bishop: Reach = AttackTables.BishopRays[From]; break;
+        case ChessPieceType_Queen: 
+        {
+            Reach = AttackTables.RookRays[From] | AttackTables.BishopRays[From];
+        } break;
+        default: break;
+    }
+    b32 Result = ((Reach & ((u64)1 << Target)) && 
+                  !(AttackTables.Between[From][Target] & Occupied));
+    return Result;
+}
+
+internal u64
+GetOccupiedSquares(chess_piece *Blacks, chess_piece *Whites)
+{
+    u64 Result = 0;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        if (Blacks[Index].Type != ChessPieceType_Empty)
+            Result |= (u64)1 << (Blacks[Index].Row*8 + Blacks[Index].Column);
+        if (Whites[Index].Type != ChessPieceType_Empty)
+            Result |= (u64)1 << (Whites[Index].Row*8 + Whites[Index].Column);
     }
     return Result;
 }
 
+// NOTE(vincent): The rules code is specialized on the side to move, so that the pawn
+// direction, the en passant row and the castling row are compile-time constants and
+// each side gets its own branch-free copy. Callers with a runtime side go through the
+// b32 versions, IsCheck_() and PushDestinationsForPiece().
+template <b32 White>
 internal b32
-WhiteIsCheck(chess_piece *Blacks, chess_piece *Whites)
+IsCheck(chess_piece *Blacks, chess_piece *Whites)
 {
-    b32 Result = IsCheck_(Blacks, Whites, true);
+    b32 Result = false;
+    Assert(Whites[12].Type == ChessPieceType_King);
+    Assert(Blacks[12].Type == ChessPieceType_King);
+    Assert(Blacks + 16 == Whites);
+    
+    chess_piece *King = White ? Whites + 12 : Blacks + 12;
+    chess_piece *Capturers = White ? Blacks : Whites;
+    u32 KingSquare = King->Row*8 + King->Column;
+    u64 Occupied = GetOccupiedSquares(Blacks, Whites);
+    for (u32 Index = 0; Index < 16 && !Result; ++Index)
+    {
+        chess_piece *Piece = Capturers + Index;
+        Result = PieceAttacksSquare(Piece->Type, !White, Piece->Row*8 + Piece->Column, 
+                                    KingSquare, Occupied);
+    }
     return Result;
 }
 
 internal b32
-BlackIsCheck(chess_piece *Blacks, chess_piece *Whites)
+IsCheck_(chess_piece *Blacks, chess_piece *Whites, b32 White)
 {
-    b32 Result = IsCheck_(Blacks, Whites, false);
+    b32 Result = White ? IsCheck<true>(Blacks, Whites) : IsCheck<false>(Blacks, Whites);
     return Result;
 }
 
@@ -594,55 +724,33 @@ PushDest(chess_game_state *Game, chess_piece *Piece, u32 R, u32 C, b32 IsCapture
     ++Piece->DestinationsCount;
 }
 
+template <b32 MoverIsWhite>
 internal b32
-PushDestIfCapturableBlackAndNoCheck(chess_game_state *Game, chess_piece *MovingPiece, s32 R, s32 C)
-{
-    b32 Result = false;
-    Assert(0 <= R && R <= 7  &&  0 <= C && C <= 7);
-    chess_piece *CapturableBlack = GetBlack(Game->Blacks, R, C);
-    if (CapturableBlack)
-    {
-        //Assert(CapturableBlack->Type != ChessPieceType_King);
-        MovingPiece->Row = R;
-        MovingPiece->Column = C;
-        chess_piece_type SaveType = CapturableBlack->Type;
-        CapturableBlack->Type = ChessPieceType_Empty;
-        if (SaveType == ChessPieceType_King || !WhiteIsCheck(Game->Blacks, Game->Whites))
-        {
-            PushDest(Game, MovingPiece, R, C, true);
-            Result = true;
-        }
-        CapturableBlack->Type = SaveType;
-    }
-    return Result;
-}
-
-internal b32
-PushDestIfCapturableWhiteAndNoCheck(chess_game_state *Game, chess_piece *MovingPiece, s32 R, s32 C)
+PushDestIfCapturableAndNoCheck(chess_game_state *Game, chess_piece *MovingPiece, s32 R, s32 C)
 {
     b32 Result = false;
     Assert(0 <= R && R <= 7  &&  0 <= C && C <= 7);
-    chess_piece *CapturableWhite = GetWhite(Game->Whites, R, C);
-    if (CapturableWhite)
+    chess_piece *Capturable = 
+        MoverIsWhite ? GetBlack(Game->Blacks, R, C) : GetWhite(Game->Whites, R, C);
+    if (Capturable)
     {
-        //Assert(CapturableWhite->Type != ChessPieceType_King);
         MovingPiece->Row = R;
         MovingPiece->Column = C;
-        chess_piece_type SaveType = CapturableWhite->Type;
-        CapturableWhite->Type = ChessPieceType_Empty;
-        if (SaveType == ChessPieceType_King || !BlackIsCheck(Game->Blacks, Game->Whites))
+        chess_piece_type SaveType = Capturable->Type;
+        Capturable->Type = ChessPieceType_Empty;
+        if (SaveType == ChessPieceType_King || !IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites))
         {
             PushDest(Game, MovingPiece, R, C, true);
             Result = true;
         }
-        CapturableWhite->Type = SaveType;
+        Capturable->Type = SaveType;
     }
     return Result;
 }
 
+template <b32 MoverIsWhite>
 internal void
-PushDestIfFreeOrCapturableAndNoCheck(chess_game_state *Game, chess_piece *MovingPiece, s32 R, s32 C,
-                                     b32 MoverIsWhite)
+PushDestIfFreeOrCapturableAndNoCheck(chess_game_state *Game, chess_piece *MovingPiece, s32 R, s32 C)
 {
     Assert(0 <= R && R <= 7  &&  0 <= C && C <= 7);
     
@@ -656,7 +764,7 @@ PushDestIfFreeOrCapturableAndNoCheck(chess_game_state *Game, chess_piece *Moving
             chess_piece_type SaveType = PieceResult.Piece->Type;
             PieceResult.Piece->Type = ChessPieceType_Empty;
             if (SaveType == ChessPieceType_King || 
-                !IsCheck_(Game->Blacks, Game->Whites, MoverIsWhite))
+                !IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites))
                 PushDest(Game, MovingPiece, R, C, true);
             PieceResult.Piece->Type = SaveType;
         }
@@ -665,7 +773,7 @@ PushDestIfFreeOrCapturableAndNoCheck(chess_game_state *Game, chess_piece *Moving
     {
         MovingPiece->Row = R;
         MovingPiece->Column = C;
-        if (!IsCheck_(Game->Blacks, Game->Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites))
             PushDest(Game, MovingPiece, R, C, false);
     }
 }
@@ -675,8 +783,9 @@ Assert(0 <= (s32)Row && Row <= 7  &&  0 <= (s32)Column && Column <= 7)
 
 
 
+template <b32 MoverIsWhite>
 internal void
-PushDestinationsForRook(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C, b32 MoverIsWhite)
+PushDestinationsForRook(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C)
 {
     // NOTE(vincent): determine the unoccupied squares within the rook's range
     chess_piece *Blacks = Game->Blacks;
@@ -700,14 +809,14 @@ PushDestinationsForRook(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C
     {
         Piece->Row = CurrentR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, C, false);
     }
     for (s32 CurrentR = R+1; CurrentR <= MaxR; ++CurrentR)
     {
         Piece->Row = CurrentR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, C, false);
     }
     
@@ -716,44 +825,31 @@ PushDestinationsForRook(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C
     {
         Piece->Column = CurrentC;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, R, CurrentC, false);
     }
     for (s32 CurrentC = C+1; CurrentC <= MaxC; ++CurrentC)
     {
         Piece->Column = CurrentC;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, R, CurrentC, false);
     }
     
     // NOTE(vincent): test for possible captures beyond that range
-    if (MoverIsWhite)
-    {
-        if (MinR > 0)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, MinR-1, C);
-        if (MaxR < 7)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, MaxR+1, C);
-        if (MinC > 0)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, R, MinC-1);
-        if (MaxC < 7)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, R, MaxC+1);
-    }
-    else
-    {
-        if (MinR > 0)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, MinR-1, C);
-        if (MaxR < 7)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, MaxR+1, C);
-        if (MinC > 0)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, R, MinC-1);
-        if (MaxC < 7)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, R, MaxC+1);
-    }
+    if (MinR > 0)
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, MinR-1, C);
+    if (MaxR < 7)
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, MaxR+1, C);
+    if (MinC > 0)
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R, MinC-1);
+    if (MaxC < 7)
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R, MaxC+1);
 }
 
+template <b32 MoverIsWhite>
 internal void
-PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C, b32 MoverIsWhite)
+PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32 C)
 {
     Assert(0 <= R && R <= 7  &&  0 <= C && C <= 7);
     // NOTE(vincent): Determine the unoccupied squares within the bishop's range.
@@ -785,7 +881,7 @@ PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32
         Piece->Row = CurrentR;
         Piece->Column = CurrentR + CmR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, Piece->Column, false);
     }
     for (s32 CurrentR = R+1; CurrentR <= AscendingMaxR; ++CurrentR)
@@ -793,7 +889,7 @@ PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32
         Piece->Row = CurrentR;
         Piece->Column = CurrentR + CmR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, Piece->Column, false);
     }
     for (s32 CurrentR = DescendingMinR; CurrentR < R; ++CurrentR)
@@ -801,7 +897,7 @@ PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32
         Piece->Row = CurrentR;
         Piece->Column = CpR - CurrentR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, Piece->Column, false);
     }
     for (s32 CurrentR = R+1; CurrentR <= DescendingMaxR; ++CurrentR)
@@ -809,50 +905,46 @@ PushDestinationsForBishop(chess_game_state *Game, chess_piece *Piece, s32 R, s32
         Piece->Row = CurrentR;
         Piece->Column = CpR - CurrentR;
         AssertInBounds(Piece->Row, Piece->Column);
-        if (!IsCheck_(Blacks, Whites, MoverIsWhite))
+        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
             PushDest(Game, Piece, CurrentR, Piece->Column, false);
     }
     
     // NOTE(vincent): test for possible captures beyond that range
-    if (MoverIsWhite)
+    if (AscendingMinR > 0 && CmR + AscendingMinR > 0)
     {
-        if (AscendingMinR > 0 && CmR + AscendingMinR > 0)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, AscendingMinR - 1, CmR + (AscendingMinR - 1));
-        if (AscendingMaxR < 7 && CmR + AscendingMaxR < 7)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, AscendingMaxR + 1, CmR + (AscendingMaxR + 1));
-        if (DescendingMinR > 0 && CpR - DescendingMinR < 7)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, DescendingMinR-1, CpR - (DescendingMinR - 1));
-        if (DescendingMaxR < 7 && CpR - DescendingMaxR > 0)
-            PushDestIfCapturableBlackAndNoCheck(Game, Piece, DescendingMaxR+1, CpR - (DescendingMaxR + 1));
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, AscendingMinR - 1, 
+                                                     CmR + (AscendingMinR - 1));
     }
-    else
+    if (AscendingMaxR < 7 && CmR + AscendingMaxR < 7)
+    {
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, AscendingMaxR + 1, 
+                                                     CmR + (AscendingMaxR + 1));
+    }
+    if (DescendingMinR > 0 && CpR - DescendingMinR < 7)
+    {
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, DescendingMinR - 1, 
+                                                     CpR - (DescendingMinR - 1));
+    }
+    if (DescendingMaxR < 7 && CpR - DescendingMaxR > 0)
     {
-        if (AscendingMinR > 0 && CmR + AscendingMinR > 0)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, AscendingMinR-1, CmR + (AscendingMinR - 1));
-        if (AscendingMaxR < 7 && CmR + AscendingMaxR < 7)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, AscendingMaxR+1, CmR + (AscendingMaxR + 1));
-        if (DescendingMinR > 0 && CpR - DescendingMinR < 7)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, DescendingMinR-1, CpR - (DescendingMinR - 1));
-        if (DescendingMaxR < 7 && CpR - DescendingMaxR > 0)
-            PushDestIfCapturableWhiteAndNoCheck(Game, Piece, DescendingMaxR+1, CpR - (DescendingMaxR + 1));
+        PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, DescendingMaxR + 1, 
+                                                     CpR - (DescendingMaxR + 1));
     }
 }
 
+template <b32 MoverIsWhite>
 internal void
-PushDiagPawnDestIfLegal(chess_game_state *Game, chess_piece *Piece, u32 CurrentR, u32 EnPassantR, 
-                        u32 DestR, u32 DestC, b32 MoverIsWhite)
+PushDiagPawnDestIfLegal(chess_game_state *Game, chess_piece *Piece, u32 CurrentR, 
+                        u32 DestR, u32 DestC)
 {
     Assert(DestR <= 7  &&  DestC <= 7);
     
-    b32 RegularCapture;
-    if (MoverIsWhite)
-        RegularCapture = PushDestIfCapturableBlackAndNoCheck(Game, Piece, DestR, DestC);
-    else
-        RegularCapture = PushDestIfCapturableWhiteAndNoCheck(Game, Piece, DestR, DestC);
+    b32 RegularCapture = PushDestIfCapturableAndNoCheck<MoverIsWhite>(Game, Piece, DestR, DestC);
     
     if (!RegularCapture)
     {
         // NOTE(vincent): test en passant
+        u32 EnPassantR = MoverIsWhite ? 4 : 3;
         if (CurrentR == EnPassantR)
         {
             Assert(Game->History.EntryCount > 0);
@@ -873,23 +965,16 @@ PushDiagPawnDestIfLegal(chess_game_state *Game, chess_piece *Piece, u32 CurrentR
                 Assert(GetPiece(Blacks, Whites, DestR, DestC).Piece == 0);
                 Piece->Row = DestR;
                 Piece->Column = DestC;
-                if (MoverIsWhite)
-                {
-                    if (!WhiteIsCheck(Blacks, Whites))
-                        PushDest(Game, Piece, DestR, DestC, true);
-                }
-                else
-                {
-                    if (!BlackIsCheck(Blacks, Whites))
-                        PushDest(Game, Piece, DestR, DestC, true);
-                }
+                if (!IsCheck<MoverIsWhite>(Blacks, Whites))
+                    PushDest(Game, Piece, DestR, DestC, true);
             }
         }
     }
 }
 
+template <b32 MoverIsWhite>
 internal void
-PushDestinationsForPiece(chess_game_state *Game, chess_piece *Piece, b32 MoverIsWhite)
+PushDestinationsForPiece(chess_game_state *Game, chess_piece *Piece)
 {
 #if DEBUG
     chess_game_state Copy = *Game;
@@ -905,205 +990,136 @@ PushDestinationsForPiece(chess_game_state *Game, chess_piece *Piece, b32 MoverIs
         case ChessPieceType_Pawn:
         {
             Assert(1 <= R && R < 7);
-            if (MoverIsWhite)
-            {
-                // (R+1, C) if (R+1, C) free and white won't be in check;
-                // (R+2, C) if (R+1, C) and (R+2, C) free and white won't be in check and R == 1;
-                // (R+1, C+1) if C < 7 and white won't be in check
-                // and [(R+1, C+1)] has a black piece or En-Passant is possible];
-                // (R+1, C-1) if C > 0 and white won't be in check
-                // and [(R+1, C+1)] has a black piece or En-Passant is possible];
-                
-                b32 ForwardFree = !HasPiece(Blacks, Whites, R+1, C);
-                if (ForwardFree)
-                {
-                    Piece->Row = R+1;
-                    if (!WhiteIsCheck(Blacks, Whites))
-                        PushDest(Game, Piece, R+1, C, false);
-                    if (R == 1)
-                    {
-                        b32 ForwardForwardFree = !HasPiece(Blacks, Whites, R+2, C);
-                        if (ForwardForwardFree)
-                        {
-                            Piece->Row = R+2;
-                            if (!WhiteIsCheck(Blacks, Whites))
-                                PushDest(Game, Piece, R+2, C, false);
-                        }
-                    }
-                }
-                if (C < 7)
-                    PushDiagPawnDestIfLegal(Game, Piece, R, 4, R+1, C+1, true);
-                if (C > 0)
-                    PushDiagPawnDestIfLegal(Game, Piece, R, 4, R+1, C-1, true);
-            }
+            // (R+F, C) if (R+F, C) free and the mover won't be in check, F being the
+            // pawn's forward direction;
+            // (R+2F, C) if (R+F, C) and (R+2F, C) free and the mover won't be in check
+            // and the pawn is on its start row;
+            // (R+F, C+1) if C < 7 and the mover won't be in check
+            // and [(R+F, C+1)] has an opposing piece or En-Passant is possible];
+            // (R+F, C-1) if C > 0 and the mover won't be in check
+            // and [(R+F, C-1)] has an opposing piece or En-Passant is possible];
+            u32 ForwardR = MoverIsWhite ? R+1 : R-1;
+            u32 ForwardForwardR = MoverIsWhite ? R+2 : R-2;
+            u32 StartR = MoverIsWhite ? 1 : 6;
             
-            else
+            b32 ForwardFree = !HasPiece(Blacks, Whites, ForwardR, C);
+            if (ForwardFree)
             {
-                if (C == 5)
+                Piece->Row = ForwardR;
+                if (!IsCheck<MoverIsWhite>(Blacks, Whites))
+                    PushDest(Game, Piece, ForwardR, C, false);
+                if (R == StartR)
                 {
-                    C += 5;
-                    C -= 5;
-                }
-                
-                // same but for moving black pawn
-                b32 ForwardFree = !HasPiece(Blacks, Whites, R-1, C);
-                if (ForwardFree)
-                {
-                    Piece->Row = R-1;
-                    if (!BlackIsCheck(Blacks, Whites))
-                        PushDest(Game, Piece, R-1, C, false);
-                    if (R == 6)
+                    b32 ForwardForwardFree = !HasPiece(Blacks, Whites, ForwardForwardR, C);
+                    if (ForwardForwardFree)
                     {
-                        b32 ForwardForwardFree = !HasPiece(Blacks, Whites, R-2, C);
-                        if (ForwardForwardFree)
-                        {
-                            Piece->Row = R-2;
-                            if (!BlackIsCheck(Blacks, Whites))
-                                PushDest(Game, Piece, R-2, C, false);
-                        }
+                        Piece->Row = ForwardForwardR;
+                        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
+                            PushDest(Game, Piece, ForwardForwardR, C, false);
                     }
                 }
-                if (C < 7)
-                    PushDiagPawnDestIfLegal(Game, Piece, R, 3, R-1, C+1, false);
-                if (C > 0)
-                    PushDiagPawnDestIfLegal(Game, Piece, R, 3, R-1, C-1, false);
             }
+            if (C < 7)
+                PushDiagPawnDestIfLegal<MoverIsWhite>(Game, Piece, R, ForwardR, C+1);
+            if (C > 0)
+                PushDiagPawnDestIfLegal<MoverIsWhite>(Game, Piece, R, ForwardR, C-1);
         } break;
         
         case ChessPieceType_Rook:
         {
-            PushDestinationsForRook(Game, Piece, R, C, MoverIsWhite);
+            PushDestinationsForRook<MoverIsWhite>(Game, Piece, R, C);
         } break;
         
         case ChessPieceType_Knight:
         {
             if (R >= 2 && C >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-2, C-1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-2, C-1);
             if (R >= 2 && C <= 6)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-2, C+1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-2, C+1);
             if (R <= 5 && C >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+2, C-1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+2, C-1);
             if (R <= 5 && C <= 6)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+2, C+1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+2, C+1);
             
             if (R >= 1 && C >= 2)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-1, C-2, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-1, C-2);
             if (R >= 1 && C <= 5)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-1, C+2, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-1, C+2);
             if (R <= 6 && C >= 2)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+1, C-2, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+1, C-2);
             if (R <= 6 && C <= 5)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+1, C+2, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+1, C+2);
         } break;
         
         case ChessPieceType_Bishop:
         {
-            PushDestinationsForBishop(Game, Piece, R, C, MoverIsWhite);
+            PushDestinationsForBishop<MoverIsWhite>(Game, Piece, R, C);
         } break;
         
         case ChessPieceType_King:
         {
             if (R >= 1 && C >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-1, C-1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-1, C-1);
             if (R >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-1, C, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-1, C);
             if (R >= 1 && C < 7)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R-1, C+1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R-1, C+1);
             if (C >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R, C-1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R, C-1);
             if (C < 7)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R, C+1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R, C+1);
             if (R < 7 && C >= 1)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+1, C-1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+1, C-1);
             if (R < 7)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+1, C, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+1, C);
             if (R < 7 && C < 7)
-                PushDestIfFreeOrCapturableAndNoCheck(Game, Piece, R+1, C+1, MoverIsWhite);
+                PushDestIfFreeOrCapturableAndNoCheck<MoverIsWhite>(Game, Piece, R+1, C+1);
             
             Piece->Row = R;
             Piece->Column = C;
             
             // NOTE(vincent): Castling
-            if (Piece->MoveCount == 0)
+            chess_piece *Rooks = MoverIsWhite ? Whites : Blacks;
+            u32 HomeR = MoverIsWhite ? 0 : 7;
+            if (Piece->MoveCount == 0 && !IsCheck<MoverIsWhite>(Blacks, Whites))
             {
-                if (MoverIsWhite)
+                // kingside
+                Piece->Row = HomeR;
+                if (Rooks[15].MoveCount == 0 && !HasPiece(Blacks, Whites, HomeR, 5) &&
+                    !HasPiece(Blacks, Whites, HomeR, 6))
                 {
-                    if (!WhiteIsCheck(Blacks, Whites))
+                    Piece->Column = 5;
+                    if (!IsCheck<MoverIsWhite>(Blacks, Whites))
                     {
-                        // kingside
-                        Piece->Row = 0;
-                        if (Whites[15].MoveCount == 0 && !HasPiece(Blacks, Whites, 0, 5) && !HasPiece(Blacks,Whites, 0, 6))
-                        {
-                            Piece->Column = 5;
-                            if (!WhiteIsCheck(Blacks, Whites))
-                            {
-                                Piece->Column = 6;
-                                if (!WhiteIsCheck(Blacks, Whites))
-                                    PushDest(Game, Piece, 0, 6, false);
-                            }
-                            Piece->Column = C;
-                        }
-                        
-                        // queenside
-                        if (Whites[8].MoveCount == 0 && !HasPiece(Blacks, Whites, 0, 3) &&
-                            !HasPiece(Blacks, Whites, 0, 2) && !HasPiece(Blacks, Whites, 0, 1))
-                        {
-                            Piece->Column = 3;
-                            if (!WhiteIsCheck(Blacks, Whites))
-                            {
-                                Piece->Column = 2;
-                                if (!WhiteIsCheck(Blacks, Whites))
-                                {
-                                    PushDest(Game, Piece, 0, 2, false);
-                                }
-                            }
-                            Piece->Column = C;
-                        }
+                        Piece->Column = 6;
+                        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
+                            PushDest(Game, Piece, HomeR, 6, false);
                     }
+                    Piece->Column = C;
                 }
                 
-                else 
+                // queenside
+                if (Rooks[8].MoveCount == 0 && !HasPiece(Blacks, Whites, HomeR, 3) &&
+                    !HasPiece(Blacks, Whites, HomeR, 2) && !HasPiece(Blacks, Whites, HomeR, 1))
                 {
-                    if (!BlackIsCheck(Blacks, Whites))
+                    Piece->Column = 3;
+                    if (!IsCheck<MoverIsWhite>(Blacks, Whites))
                     {
-                        // kingside
-                        Piece->Row = 7;
-                        if (Blacks[15].MoveCount == 0 && !HasPiece(Blacks, Whites, 7, 5) &&
-                            !HasPiece(Blacks, Whites, 7, 6))
-                        {
-                            Piece->Column = 5;
-                            if (!BlackIsCheck(Blacks, Whites))
-                            {
-                                Piece->Column = 6;
-                                if (!BlackIsCheck(Blacks, Whites))
-                                    PushDest(Game, Piece, 7, 6, false);
-                            }
-                            Piece->Column = C;
-                        }
-                        // queenside
-                        if (Blacks[8].MoveCount == 0 && !HasPiece(Blacks, Whites, 7, 3) &&
-                            !HasPiece(Blacks, Whites, 7, 2) && !HasPiece(Blacks, Whites, 7, 1))
+                        Piece->Column = 2;
+                        if (!IsCheck<MoverIsWhite>(Blacks, Whites))
                         {
-                            Piece->Column = 3;
-                            if (!BlackIsCheck(Blacks, Whites))
-                            {
-                                Piece->Column = 2;
-                                if (!BlackIsCheck(Blacks, Whites))
-                                {
-                                    PushDest(Game, Piece, 7, 2, false);
-                                }
-                            }
-                            Piece->Column = C;
+                            PushDest(Game, Piece, HomeR, 2, false);
                         }
                     }
+                    Piece->Column = C;
                 }
             }
         } break;
         
         case ChessPieceType_Queen:
         {
-            PushDestinationsForRook(Game, Piece, R, C, MoverIsWhite);
-            PushDestinationsForBishop(Game, Piece, R, C, MoverIsWhite);
+            PushDestinationsForRook<MoverIsWhite>(Game, Piece, R, C);
+            PushDestinationsForBishop<MoverIsWhite>(Game, Piece, R, C);
         } break;
         
         InvalidDefaultCase;
@@ -1123,6 +1139,15 @@ PushDestinationsForPiece(chess_game_state *Game, chess_piece *Piece, b32 MoverIs
 #endif
 }
 
+internal void
+PushDestinationsForPiece(chess_game_state *Game, chess_piece *Piece, b32 MoverIsWhite)
+{
+    if (MoverIsWhite)
+        PushDestinationsForPiece<true>(Game, Piece);
+    else
+        PushDestinationsForPiece<false>(Game, Piece);
+}
+
 #if DEBUG
 internal void
 AssertDestPointersWithinBounds(chess_game_state *Game)
@@ -1142,7 +1167,7 @@ AssertDestPointersWithinBounds(chess_game_state *Game)
 #endif
 
 internal void
-RecomputeDestinations(chess_game_state *Game)
+RegenerateAllDestinations(chess_game_state *Game)
 {
 #if DEBUG
     chess_game_state Copy = *Game;
@@ -1198,15 +1223,228 @@ RecomputeDestinations(chess_game_state *Game)
     }
 }
 
-internal void
-UpdateWrappedCounterOnButtonPress(s32 *Counter, button_state DecrementButton,
-                                  button_state IncrementButton, s32 Modulo)
+internal b32
+DestinationsMayDependOnSquare(chess_piece *Piece, chess_piece *King, s32 SR, s32 SC, 
+                              b32 IsWhite)
 {
-    Assert(0 <= *Counter && *Counter < Modulo);
-    if (DecrementButton.IsPressed && !DecrementButton.WasPressed)
-        --(*Counter);
-    if (IncrementButton.IsPressed && !IncrementButton.WasPressed)
-        ++(*Counter);
+    // NOTE(vincent): Whether a change on (SR, SC) may change the piece's destinations:
+    // the square is within its reach, or on the line from its king through it (the piece
+    // may get pinned or unpinned). Conservative, blockers are ignored.
+    u32 From = Piece->Row*8 + Piece->Column;
+    u32 KingSquare = King->Row*8 + King->Column;
+    u32 Square = SR*8 + SC;
+    u64 SquareBit = (u64)1 << Square;
+    b32 Result = ((AttackTables.Lines[KingSquare][From] & SquareBit) && Square != KingSquare &&
+                  !(AttackTables.Between[From][Square] & ((u64)1 << KingSquare)));
+    
+    u64 Reach = (u64)1 << From;
+    switch (Piece->Type)
+    {
+        case ChessPieceType_Pawn:
+        {
+            u64 Pushes = IsWhite ? (Reach << 8) | (Reach << 16) : (Reach >> 8) | (Reach >> 16);
+            Reach |= AttackTables.PawnAttacks[IsWhite][From] | Pushes;
+        } break;
+        case ChessPieceType_Knight: Reach |= AttackTables.KnightAttacks[From]; break;
+        case ChessPieceType_Rook: Reach |= AttackTables.RookRays[From]; break;
+        case ChessPieceType_Bishop: Reach |= AttackTables.BishopRays[From]; break;
+        case ChessPieceType_Queen: 
+        {
+            Reach |= AttackTables.RookRays[From] | AttackTables.BishopRays[From];
+        } break;
+        default: Reach = ~(u64)0; break;
+    }
+    Result |= ((Reach & SquareBit) != 0);
+    return Result;
+}
+
+internal void
+RecomputeDestinations(chess_game_state *Game)
+{
+    // NOTE(vincent): Generates the destinations of the side to move. Only the pieces that
+    // the changes since that side's last generation may have affected get regenerated:
+    // pieces that moved, got captured or promoted, pieces within reach of or pinned through
+    // a changed square, the king, pawns that may take en passant, and the whole side if its
+    // king moved or is or was in check. Everyone else gets back the list they had then.
+    // The other side's kept lists stay where they are, hidden from its pieces.
+    u32 MoverIsWhite = Game->BlackIsPlaying ? 0 : 1;
+    b32 Check = IsCheck_(Game->Blacks, Game->Whites, MoverIsWhite);
+    b32 BoardIsValid = Game->DestinationsBoardIsValid[MoverIsWhite];
+    u8 *BoardSquares = Game->DestinationsBoardSquares[MoverIsWhite];
+    u8 *BoardTypes = Game->DestinationsBoardTypes[MoverIsWhite];
+    chess_piece *King = MoverIsWhite ? Game->Whites + 12 : Game->Blacks + 12;
+    
+    s32 ChangedR[64];
+    s32 ChangedC[64];
+    u32 ChangedCount = 0;
+    for (u32 Index = 0; Index < 32 && BoardIsValid; ++Index)
+    {
+        chess_piece *Piece = (Index < 16) ? Game->Blacks + Index : Game->Whites + Index - 16;
+        u8 Square = (u8)(Piece->Type ? Piece->Row*8 + Piece->Column : 0xFF);
+        u8 OldSquare = BoardSquares[Index];
+        if (Square != OldSquare || Piece->Type != BoardTypes[Index])
+        {
+            if (OldSquare != 0xFF)
+            {
+                ChangedR[ChangedCount] = OldSquare / 8;
+                ChangedC[ChangedCount++] = OldSquare % 8;
+            }
+            if (Square != 0xFF)
+            {
+                ChangedR[ChangedCount] = Square / 8;
+                ChangedC[ChangedCount++] = Square % 8;
+            }
+        }
+    }
+    b32 WholeSideIsAffected = (!BoardIsValid || Check || 
+                               Game->DestinationsBoardChecks[MoverIsWhite] ||
+                               King->Row*8 + King->Column != BoardSquares[16*MoverIsWhite + 12]);
+    
+    destination OldDestinations[ArrayCount(Game->Destinations)];
+    for (u32 i = 0; i < Game->DestinationsCount; ++i)
+        OldDestinations[i] = Game->Destinations[i];
+    
+    u32 OldOffset = 0;
+    Game->DestinationsCount = 0;
+    b32 CanMove = false;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        for (u32 IsWhite = 0; IsWhite < 2; ++IsWhite)
+        {
+            u32 PieceIndex = Index + 16*IsWhite;
+            chess_piece *Piece = IsWhite ? Game->Whites + Index : Game->Blacks + Index;
+            u32 OldCount = Game->DestinationsKeptCounts[PieceIndex];
+            
+            b32 Affected = false;
+            if (IsWhite == MoverIsWhite)
+            {
+                Affected = (WholeSideIsAffected || Piece->Type == ChessPieceType_King ||
+                            Piece->Row*8 + Piece->Column != BoardSquares[PieceIndex] ||
+                            Piece->Type != BoardTypes[PieceIndex] ||
+                            (Piece->Type == ChessPieceType_Pawn && 
+                             Piece->Row == (IsWhite ? 4u : 3u)));
+                for (u32 i = 0; i < ChangedCount && !Affected; ++i)
+                {
+                    Affected = DestinationsMayDependOnSquare(Piece, King, ChangedR[i], 
+                                                             ChangedC[i], IsWhite);
+                }
+            }
+            
+            Piece->DestinationsCount = 0;
+            Piece->Destinations = 0;
+            if (Affected)
+            {
+                if (Piece->Type != ChessPieceType_Empty)
+                    PushDestinationsForPiece(Game, Piece, IsWhite);
+                Game->DestinationsKeptCounts[PieceIndex] = (u8)Piece->DestinationsCount;
+            }
+            else
+            {
+                destination *Kept = Game->Destinations + Game->DestinationsCount;
+                for (u32 i = 0; i < OldCount; ++i)
+                    Game->Destinations[Game->DestinationsCount++] = OldDestinations[OldOffset + i];
+                if (IsWhite == MoverIsWhite && OldCount)
+                {
+                    Piece->DestinationsCount = OldCount;
+                    Piece->Destinations = Kept;
+                }
+            }
+            OldOffset += OldCount;
+            
+            if (IsWhite == MoverIsWhite && Piece->DestinationsCount > 0)
+                CanMove = true;
+        }
+    }
+    if (MoverIsWhite)
+        Game->WhiteCanMove = CanMove;
+    else
+        Game->BlackCanMove = CanMove;
+    
+#if DEBUG
+    // NOTE(vincent): Cross-check against regenerating everything.
+    chess_game_state Full = *Game;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        Full.Blacks[Index].Destinations = 0;
+        Full.Whites[Index].Destinations = 0;
+    }
+    RegenerateAllDestinations(&Full);
+    chess_piece *Pieces = MoverIsWhite ? Game->Whites : Game->Blacks;
+    chess_piece *FullPieces = MoverIsWhite ? Full.Whites : Full.Blacks;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        Assert(FullPieces[Index].DestinationsCount == Pieces[Index].DestinationsCount);
+        for (u32 i = 0; i < Pieces[Index].DestinationsCount; ++i)
+        {
+            Assert(FullPieces[Index].Destinations[i].DestCode == 
+                   Pieces[Index].Destinations[i].DestCode);
+        }
+    }
+#endif
+    
+    Game->DestinationsAreCurrent = true;
+    Game->DestinationsBoardIsValid[MoverIsWhite] = true;
+    Game->DestinationsBoardChecks[MoverIsWhite] = Check;
+    for (u32 Index = 0; Index < 32; ++Index)
+    {
+        chess_piece *Piece = (Index < 16) ? Game->Blacks + Index : Game->Whites + Index - 16;
+        BoardSquares[Index] = (u8)(Piece->Type ? Piece->Row*8 + Piece->Column : 0xFF);
+        BoardTypes[Index] = (u8)Piece->Type;
+    }
+}
+
+internal void
+UpdateDestinations(chess_game_state *Game)
+{
+    if (!Game->DestinationsAreCurrent)
+        RecomputeDestinations(Game);
+}
+
+internal u32
+GetDestinationsOnDemand(chess_game_state *Game, chess_piece *Piece, b32 IsWhite, 
+                        destination *Result, u32 MaxCount)
+{
+    // NOTE(vincent): For pieces of the side not to move, which have no list. Returns the
+    // piece's destination count, copies up to MaxCount of them. They are pushed at the
+    // free end of Destinations and dropped right away, the piece is left as it was.
+    u32 SavedCount = Game->DestinationsCount;
+    u32 SavedPieceCount = Piece->DestinationsCount;
+    destination *SavedPieceDestinations = Piece->Destinations;
+    
+    Piece->DestinationsCount = 0;
+    if (Piece->Type != ChessPieceType_Empty)
+        PushDestinationsForPiece(Game, Piece, IsWhite);
+    u32 Count = Piece->DestinationsCount;
+    for (u32 i = 0; i < Count && i < MaxCount; ++i)
+        Result[i] = Piece->Destinations[i];
+    
+    Piece->DestinationsCount = SavedPieceCount;
+    Piece->Destinations = SavedPieceDestinations;
+    Game->DestinationsCount = SavedCount;
+    return Count;
+}
+
+internal b32
+HasLegalMove(chess_game_state *Game, b32 IsWhite)
+{
+    // NOTE(vincent): Stops at the first piece that can move, for checkmate and stalemate
+    // detection without generating the whole side.
+    chess_piece *Pieces = IsWhite ? Game->Whites : Game->Blacks;
+    b32 Result = false;
+    for (u32 Index = 0; Index < 16 && !Result; ++Index)
+        Result = (GetDestinationsOnDemand(Game, Pieces + Index, IsWhite, 0, 0) > 0);
+    return Result;
+}
+
+internal void
+UpdateWrappedCounterOnButtonPress(s32 *Counter, button_state DecrementButton,
+                                  button_state IncrementButton, s32 Modulo)
+{
+    Assert(0 <= *Counter && *Counter < Modulo);
+    if (DecrementButton.IsPressed && !DecrementButton.WasPressed)
+        --(*Counter);
+    if (IncrementButton.IsPressed && !IncrementButton.WasPressed)
+        ++(*Counter);
     if (*Counter < 0)
         *Counter += Modulo;
     else if (*Counter >= Modulo)
@@ -1416,6 +1654,7 @@ SelectedPieceToCursorDestCodeIfLegal(chess_game_state *Game)
     u8 CursorDestCode = Game->Cursor.Row | (Game->Cursor.Column << 3);
     if (Game->BlackIsPlaying == !Game->SelectedPiece.IsWhite)
     {
+        UpdateDestinations(Game);
         for (u32 DestIndex = 0; 
              DestIndex < Game->SelectedPiece.Piece->DestinationsCount;
              ++DestIndex)
@@ -1431,15 +1670,71 @@ SelectedPieceToCursorDestCodeIfLegal(chess_game_state *Game)
     return Result;
 }
 
+enum material_draw
+{
+    MaterialDraw_None,
+    MaterialDraw_CannotForce,  // mate takes the defender's help
+    MaterialDraw_Dead,         // no sequence of legal moves mates
+};
+
+internal material_draw
+GetMaterialDraw(chess_piece *Blacks, chess_piece *Whites)
+{
+    // NOTE(vincent): Dead positions (bare kings, a single minor piece, bishops that all
+    // stand on squares of one color) end the game as a draw, and since the search plays its
+    // moves through MovePieceAfterwork() too, it stops there. A minor piece each, or two
+    // knights against a bare king, can still mate if the defender blunders, so the game
+    // goes on and only the evaluation stops counting on a win (HeuristicEvaluation()).
+    u32 Counts[2][7] = {};  // [IsWhite][chess_piece_type]
+    u32 BishopSquareColors = 0;  // bit 0: some bishop on a dark square, bit 1: on a light one
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        chess_piece *Black = Blacks + Index;
+        chess_piece *White = Whites + Index;
+        ++Counts[0][Black->Type];
+        ++Counts[1][White->Type];
+        if (Black->Type == ChessPieceType_Bishop)
+            BishopSquareColors |= 1 << ((Black->Row + Black->Column) & 1);
+        if (White->Type == ChessPieceType_Bishop)
+            BishopSquareColors |= 1 << ((White->Row + White->Column) & 1);
+    }
+    
+    material_draw Result = MaterialDraw_None;
+    if (Counts[0][ChessPieceType_Pawn] + Counts[1][ChessPieceType_Pawn] + 
+        Counts[0][ChessPieceType_Rook] + Counts[1][ChessPieceType_Rook] + 
+        Counts[0][ChessPieceType_Queen] + Counts[1][ChessPieceType_Queen] == 0)
+    {
+        u32 Knights[2] = {Counts[0][ChessPieceType_Knight], Counts[1][ChessPieceType_Knight]};
+        u32 Minors[2] = {Knights[0] + Counts[0][ChessPieceType_Bishop],
+            Knights[1] + Counts[1][ChessPieceType_Bishop]};
+        if (Knights[0] + Knights[1] == 0 && BishopSquareColors != 3)
+            Result = MaterialDraw_Dead;
+        else if (Minors[0] + Minors[1] <= 1)
+            Result = MaterialDraw_Dead;
+        else if (Minors[0] <= 1 && Minors[1] <= 1)
+            Result = MaterialDraw_CannotForce;
+        else if ((Knights[0] == 2 && Minors[0] == 2 && Minors[1] == 0) ||
+                 (Knights[1] == 2 && Minors[1] == 2 && Minors[0] == 0))
+            Result = MaterialDraw_CannotForce;
+    }
+    return Result;
+}
+
 internal void
 MovePieceAfterwork(chess_game_state *Game)
 {
-    RecomputeDestinations(Game);
+    // NOTE(vincent): The opponent's destinations get generated when someone asks for them,
+    // knowing whether it can move at all is enough here.
+    Game->DestinationsAreCurrent = false;
     
     Game->RunningState = ChessGameRunningState_Normal;
     b32 OpponentIsCheck = IsCheck_(Game->Blacks, Game->Whites, 
                                    Game->BlackIsPlaying);
-    b32 OpponentCanMove = (Game->BlackIsPlaying ? Game->WhiteCanMove : Game->BlackCanMove);
+    b32 OpponentCanMove = HasLegalMove(Game, Game->BlackIsPlaying);
+    if (Game->BlackIsPlaying)
+        Game->WhiteCanMove = OpponentCanMove;
+    else
+        Game->BlackCanMove = OpponentCanMove;
     
     if (OpponentIsCheck)
     {
@@ -1450,23 +1745,8 @@ MovePieceAfterwork(chess_game_state *Game)
     }
     else if (!OpponentCanMove)
         Game->RunningState = ChessGameRunningState_Stalemate;
-    else
-    {
-        b32 TwoKingsStalemate = true;
-        for (u32 i = 0; i < ArrayCount(Game->Blacks); ++i)
-        {
-            if ((Game->Blacks[i].Type != ChessPieceType_Empty && 
-                 Game->Blacks[i].Type != ChessPieceType_King    ) ||
-                (Game->Whites[i].Type != ChessPieceType_Empty && 
-                 Game->Whites[i].Type != ChessPieceType_King))
-            {
-                TwoKingsStalemate = false;
-                break;
-            }
-        }
-        if (TwoKingsStalemate)
-            Game->RunningState = ChessGameRunningState_Stalemate;
-    }
+    else if (GetMaterialDraw(Game->Blacks, Game->Whites) == MaterialDraw_Dead)
+        Game->RunningState = ChessGameRunningState_Stalemate;
     
     if (Game->RunningState != ChessGameRunningState_Checkmate && 
         ArrayCount(Game->History.Entries) == Game->CurrentEntryIndex)
@@ -1754,6 +2034,7 @@ MoveSelectedPieceToCursorIfLegal(chess_game_state *Game)
 internal decision
 GetRandomDecision(chess_game_state *Game, random_series *Series)
 {
+    UpdateDestinations(Game);
     Assert(Game->DestinationsCount > 0);
     chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
     u32 TotalDestCount = 0;
@@ -1802,8 +2083,266 @@ GetRandomDecision(chess_game_state *Game, random_series *Series)
     return Result;
 }
 
+// NOTE(vincent): Pawn structure terms, in tenths of a pawn like the rest of the evaluation.
+// Passed pawn values are indexed by the row counted from the pawn's own side.
+#define DOUBLED_PAWN_PENALTY 2
+#define ISOLATED_PAWN_PENALTY 1
+global_variable s32 PassedPawnValues[8] = {0, 1, 1, 2, 3, 5, 8, 0};
+global_variable s32 FreePassedPawnValues[8] = {0, 0, 0, 1, 2, 3, 5, 0};
+
+#define FILE_A_SQUARES 0x0101010101010101ULL
+#define FILE_H_SQUARES 0x8080808080808080ULL
+
+internal u64
+FillUp(u64 Squares)
+{
+    Squares |= Squares << 8;
+    Squares |= Squares << 16;
+    Squares |= Squares << 32;
+    return Squares;
+}
+
+internal u64
+FillDown(u64 Squares)
+{
+    Squares |= Squares >> 8;
+    Squares |= Squares >> 16;
+    Squares |= Squares >> 32;
+    return Squares;
+}
+
+internal u64
+GetSideSquares(u64 Squares)
+{
+    u64 Result = ((Squares & ~FILE_H_SQUARES) << 1) | ((Squares & ~FILE_A_SQUARES) >> 1);
+    return Result;
+}
+
+struct pawn_structure
+{
+    s32 Value;      // from white's point of view
+    u64 Passed[2];  // black, white
+};
+
+template <s32 Shift>
+internal u64
+ShiftSquares(u64 Squares)
+{
+    u64 Result = (Shift > 0) ? (Squares << (Shift & 63)) : (Squares >> (-Shift & 63));
+    return Result;
+}
+
+internal pawn_structure
+ComputePawnStructure(chess_piece *Blacks, chess_piece *Whites)
+{
+    u64 Pawns[2] = {};
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        if (Blacks[Index].Type == ChessPieceType_Pawn)
+            Pawns[0] |= (u64)1 << (Blacks[Index].Row*8 + Blacks[Index].Column);
+        if (Whites[Index].Type == ChessPieceType_Pawn)
+            Pawns[1] |= (u64)1 << (Whites[Index].Row*8 + Whites[Index].Column);
+    }
+    
+    // NOTE(vincent): A pawn is passed when no opposing pawn stands ahead of it, on its file
+    // or the ones next to it. Doubled pawns are the ones with another pawn of theirs ahead.
+    pawn_structure Result = {};
+    u64 BlackSpan = FillDown(Pawns[0] >> 8);
+    u64 WhiteSpan = FillUp(Pawns[1] << 8);
+    Result.Passed[0] = Pawns[0] & ~(WhiteSpan | GetSideSquares(WhiteSpan));
+    Result.Passed[1] = Pawns[1] & ~(BlackSpan | GetSideSquares(BlackSpan));
+    u64 Doubled[2] = {Pawns[0] & FillUp(Pawns[0] << 8), Pawns[1] & FillDown(Pawns[1] >> 8)};
+    u64 SupportedFiles[2] = 
+    {
+        GetSideSquares(FillUp(Pawns[0]) | FillDown(Pawns[0])),
+        GetSideSquares(FillUp(Pawns[1]) | FillDown(Pawns[1])),
+    };
+    
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *Pieces = Color ? Whites : Blacks;
+        s32 Sign = Color ? 1 : -1;
+        for (u32 Index = 0; Index < 16; ++Index)
+        {
+            chess_piece *Piece = Pieces + Index;
+            if (Piece->Type == ChessPieceType_Pawn)
+            {
+                u64 Square = (u64)1 << (Piece->Row*8 + Piece->Column);
+                u32 OwnRow = Color ? Piece->Row : 7 - Piece->Row;
+                if (Doubled[Color] & Square)
+                    Result.Value -= Sign*DOUBLED_PAWN_PENALTY;
+                if (!(SupportedFiles[Color] & Square))
+                    Result.Value -= Sign*ISOLATED_PAWN_PENALTY;
+                if (Result.Passed[Color] & Square)
+                    Result.Value += Sign*PassedPawnValues[OwnRow];
+            }
+        }
+    }
+    return Result;
+}
+
+internal u64
+GetPawnKey(zobrist_keys *Keys, chess_piece *Blacks, chess_piece *Whites)
+{
+    // NOTE(vincent): The pawn part of ComputePositionKey(). No pawns is key 0, which a zeroed
+    // entry verifies against, and that's fine: it's also the right answer, nothing.
+    u64 Key = 0;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        if (Blacks[Index].Type == ChessPieceType_Pawn)
+            Key ^= Keys->Pieces[0][ChessPieceType_Pawn][Blacks[Index].Row*8 + Blacks[Index].Column];
+        if (Whites[Index].Type == ChessPieceType_Pawn)
+            Key ^= Keys->Pieces[1][ChessPieceType_Pawn][Whites[Index].Row*8 + Whites[Index].Column];
+    }
+    return Key;
+}
+
+internal pawn_structure
+GetPawnStructure(pawn_table *Table, chess_piece *Blacks, chess_piece *Whites)
+{
+    pawn_structure Result;
+    if (Table)
+    {
+        u64 Key = GetPawnKey(&Table->Keys, Blacks, Whites);
+        pawn_entry *Entry = Table->Entries + (Key & (Table->EntryCount - 1));
+        u64 Value = Entry->Value;
+        u64 Passed0 = Entry->Passed[0];
+        u64 Passed1 = Entry->Passed[1];
+        if ((Entry->KeyXorData ^ Value ^ Passed0 ^ Passed1) == Key)
+        {
+            Result.Value = (s32)(u32)Value;
+            Result.Passed[0] = Passed0;
+            Result.Passed[1] = Passed1;
+        }
+        else
+        {
+            Result = ComputePawnStructure(Blacks, Whites);
+            Value = (u32)Result.Value;
+            Entry->Value = Value;
+            Entry->Passed[0] = Result.Passed[0];
+            Entry->Passed[1] = Result.Passed[1];
+            Entry->KeyXorData = Key ^ Value ^ Result.Passed[0] ^ Result.Passed[1];
+        }
+    }
+    else
+        Result = ComputePawnStructure(Blacks, Whites);
+    return Result;
+}
+
+// NOTE(vincent): Piece activity terms, in quarters of a tenth of a pawn: per square a
+// piece reaches, per attack on the squares around the opposing king, per rook on a file
+// without pawns of its side (twice that without any pawns), and for the bishop pair.
+#define MOBILITY_VALUE 1
+#define KING_ZONE_ATTACK_VALUE 2
+#define ROOK_FILE_VALUE 4
+#define BISHOP_PAIR_VALUE 12
+
+template <s32 Shift, u64 Wrap>
+internal u64
+GetSlidingAttacks(u64 Sliders, u64 Empty)
+{
+    // NOTE(vincent): Occluded fill in one direction, for all the sliders at once: each step
+    // doubles the distance covered, and Wrap keeps moves off the opposite edge of the board.
+    u64 Open = Empty & Wrap;
+    Sliders |= Open & ShiftSquares<Shift>(Sliders);
+    Open &= ShiftSquares<Shift>(Open);
+    Sliders |= Open & ShiftSquares<2*Shift>(Sliders);
+    Open &= ShiftSquares<2*Shift>(Open);
+    Sliders |= Open & ShiftSquares<4*Shift>(Sliders);
+    u64 Result = ShiftSquares<Shift>(Sliders) & Wrap;
+    return Result;
+}
+
+internal u64
+GetRookAttacks(u64 Rooks, u64 Empty)
+{
+    u64 Result = (GetSlidingAttacks<8, ~0ULL>(Rooks, Empty) | 
+                  GetSlidingAttacks<-8, ~0ULL>(Rooks, Empty) |
+                  GetSlidingAttacks<1, ~FILE_A_SQUARES>(Rooks, Empty) | 
+                  GetSlidingAttacks<-1, ~FILE_H_SQUARES>(Rooks, Empty));
+    return Result;
+}
+
+internal u64
+GetBishopAttacks(u64 Bishops, u64 Empty)
+{
+    u64 Result = (GetSlidingAttacks<9, ~FILE_A_SQUARES>(Bishops, Empty) | 
+                  GetSlidingAttacks<7, ~FILE_H_SQUARES>(Bishops, Empty) |
+                  GetSlidingAttacks<-7, ~FILE_A_SQUARES>(Bishops, Empty) | 
+                  GetSlidingAttacks<-9, ~FILE_H_SQUARES>(Bishops, Empty));
+    return Result;
+}
+
+internal s32
+GetAttackActivity(u64 Attacks, u64 Targets, u64 KingZone)
+{
+    s32 Result = (MOBILITY_VALUE*CountSetBits(Attacks & Targets) +
+                  KING_ZONE_ATTACK_VALUE*CountSetBits(Attacks & KingZone));
+    return Result;
+}
+
+internal s32
+EvaluatePieceActivity(chess_piece *Blacks, chess_piece *Whites)
+{
+    // NOTE(vincent): Empty pieces land in Squares[Color][ChessPieceType_Empty], which 
+    // nothing reads, so filling the boards doesn't need to test anything.
+    u64 Squares[2][7] = {};  // [IsWhite][chess_piece_type]
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        Squares[0][Blacks[Index].Type] |= (u64)1 << (Blacks[Index].Row*8 + Blacks[Index].Column);
+        Squares[1][Whites[Index].Type] |= (u64)1 << (Whites[Index].Row*8 + Whites[Index].Column);
+    }
+    u64 Own[2];
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        Own[Color] = (Squares[Color][ChessPieceType_Pawn] | Squares[Color][ChessPieceType_Rook] |
+                      Squares[Color][ChessPieceType_Knight] | Squares[Color][ChessPieceType_Bishop] |
+                      Squares[Color][ChessPieceType_Queen] | Squares[Color][ChessPieceType_King]);
+    }
+    u64 Empty = ~(Own[0] | Own[1]);
+    u64 AllPawns = Squares[0][ChessPieceType_Pawn] | Squares[1][ChessPieceType_Pawn];
+    
+    s32 Activity[2] = {};
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *OpposingKing = (Color ? Blacks : Whites) + 12;
+        u32 KingSquare = OpposingKing->Row*8 + OpposingKing->Column;
+        u64 KingZone = AttackTables.KingAttacks[KingSquare] | ((u64)1 << KingSquare);
+        u64 Targets = ~Own[Color];
+        u64 OwnPawns = Squares[Color][ChessPieceType_Pawn];
+        u64 Queens = Squares[Color][ChessPieceType_Queen];
+        
+        // NOTE(vincent): One loop per piece type, over that type's squares. Queens go 
+        // through both slider loops: their rook and bishop attacks never overlap.
+        for (u64 Left = Squares[Color][ChessPieceType_Knight]; Left; Left &= Left - 1)
+        {
+            u64 Attacks = AttackTables.KnightAttacks[FindLowestSetBit(Left)];
+            Activity[Color] += GetAttackActivity(Attacks, Targets, KingZone);
+        }
+        for (u64 Left = Squares[Color][ChessPieceType_Bishop] | Queens; Left; Left &= Left - 1)
+        {
+            u64 Attacks = GetBishopAttacks((u64)1 << FindLowestSetBit(Left), Empty);
+            Activity[Color] += GetAttackActivity(Attacks, Targets, KingZone);
+        }
+        for (u64 Left = Squares[Color][ChessPieceType_Rook] | Queens; Left; Left &= Left - 1)
+        {
+            u64 Attacks = GetRookAttacks((u64)1 << FindLowestSetBit(Left), Empty);
+            Activity[Color] += GetAttackActivity(Attacks, Targets, KingZone);
+        }
+        for (u64 Left = Squares[Color][ChessPieceType_Rook]; Left; Left &= Left - 1)
+        {
+            u64 File = FILE_A_SQUARES << (FindLowestSetBit(Left) % 8);
+            Activity[Color] += ROOK_FILE_VALUE*(!(File & OwnPawns) + !(File & AllPawns));
+        }
+        Activity[Color] += BISHOP_PAIR_VALUE*(CountSetBits(Squares[Color][ChessPieceType_Bishop]) >= 2);
+    }
+    
+    s32 Result = (Activity[1] - Activity[0]) / 4;
+    return Result;
+}
+
 internal f32
-HeuristicEvaluation(chess_game_state *Game, random_series *Series)
+HeuristicEvaluation(chess_game_state *Game, pawn_table *PawnTable, random_series *Series)
 {
     s32 Result = 0;
     
@@ -1829,6 +2368,35 @@ HeuristicEvaluation(chess_game_state *Game, random_series *Series)
         }
     }
     
+    pawn_structure Pawns = GetPawnStructure(PawnTable, Game->Blacks, Game->Whites);
+    Result += Pawns.Value;
+    Result += EvaluatePieceActivity(Game->Blacks, Game->Whites);
+    
+    // NOTE(vincent): Passed pawns are worth more with nothing in the way of their next step.
+    // That depends on the other pieces, so it's not part of the cached terms.
+    if (Pawns.Passed[0] | Pawns.Passed[1])
+    {
+        u64 Occupied = GetOccupiedSquares(Game->Blacks, Game->Whites);
+        u64 FreeBlacks = Pawns.Passed[0] & ~(Occupied << 8);
+        u64 FreeWhites = Pawns.Passed[1] & ~(Occupied >> 8);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            chess_piece *Black = Game->Blacks + i;
+            chess_piece *White = Game->Whites + i;
+            if (Black->Type == ChessPieceType_Pawn && 
+                (FreeBlacks & ((u64)1 << (Black->Row*8 + Black->Column))))
+                Result -= FreePassedPawnValues[7 - Black->Row];
+            if (White->Type == ChessPieceType_Pawn && 
+                (FreeWhites & ((u64)1 << (White->Row*8 + White->Column))))
+                Result += FreePassedPawnValues[White->Row];
+        }
+    }
+    
+    // NOTE(vincent): Whoever is ahead can't force a win with this material, but keeps
+    // the sign of the evaluation, to still prefer the lines where the other side may err.
+    if (GetMaterialDraw(Game->Blacks, Game->Whites) == MaterialDraw_CannotForce)
+        Result /= 16;
+    
     Result += RandomS32(Series, -1, 1);
     //Result *= (1.0f - 0.001f * Game->History.EntryCount);
     
@@ -1991,6 +2559,7 @@ GameHistoryMoveBack(chess_game_state *Game)
 internal decision
 GetDecisionAndApply(chess_game_state *Game, chess_piece *Pieces, u32 PieceIndex, u32 DestIndex)
 {
+    UpdateDestinations(Game);
     Assert(Pieces[PieceIndex].Destinations && Pieces[PieceIndex].DestinationsCount);
     // NOTE(vincent): Get decision data 
     decision Decision = {};
@@ -2021,53 +2590,2451 @@ GetDecisionAndApply(chess_game_state *Game, chess_piece *Pieces, u32 PieceIndex,
     return Decision;
 }
 
-struct minimax_stage
-{
-    f32 Alpha;
-    f32 Beta;
-    chess_game_state GameCopy;
-    u32 DecisionIndex;
-    u32 DecisionsCount;
-    decision *Decisions;
-};
+// NOTE(vincent): Entry count of the transposition table, 16 bytes each.
+#define TRANSPOSITION_TABLE_ENTRY_COUNT (1 << 24)
 
-struct minimax_context
+// NOTE(vincent): The learning file keeps the results of the AI's root searches from one
+// session to the next, in the same entry format as the transposition table.
+#define LEARNING_FILENAME "chess_learning"
+#define LEARNING_TABLE_ENTRY_COUNT (1 << 20)
+
+// NOTE(vincent): Entry count of the pawn structure table, 32 bytes each. Far fewer pawn
+// structures than positions show up in a search.
+#define PAWN_TABLE_ENTRY_COUNT (1 << 16)
+
+internal u64
+SplitMix64(u64 *State)
 {
-    minimax_stage *Stages;
-    u32 CurrentDepth;
-};
+    u64 Z = (*State += 0x9E3779B97F4A7C15ULL);
+    Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+    return Z ^ (Z >> 31);
+}
 
+internal void
+InitializeZobristKeys(zobrist_keys *Keys)
+{
+    // NOTE(vincent): Fixed seed, so that keys are the same from one run to the next,
+    // and from one process to another (see OpenSharedTranspositionEntries()).
+    u64 State = 0x636865737321ULL;
+    for (u32 Color = 0; Color < 2; ++Color)
+        for (u32 Type = 0; Type < 7; ++Type)
+            for (u32 Square = 0; Square < 64; ++Square)
+                Keys->Pieces[Color][Type][Square] = SplitMix64(&State);
+    Keys->BlackToMove = SplitMix64(&State);
+    for (u32 i = 0; i < ArrayCount(Keys->Castling); ++i)
+        Keys->Castling[i] = SplitMix64(&State);
+    for (u32 i = 0; i < ArrayCount(Keys->EnPassant); ++i)
+        Keys->EnPassant[i] = SplitMix64(&State);
+}
 
 internal void
-CopyGame(chess_game_state *Source, chess_game_state *Dest)
+InitializeTranspositionTable(transposition_table *Table, void *Memory, u64 EntryCount,
+                             platform_page_kind PageKind)
 {
-    Dest->RunningState = Source->RunningState;
-    Dest->PromotingPawn = Source->PromotingPawn;
-    
-    for (u32 i = 0; i < 16; ++i)
-    {
-        Dest->Blacks[i] = Source->Blacks[i];
-        Dest->Whites[i] = Source->Whites[i];
-    }
-    
-    Dest->Cursor.Row = Source->Cursor.Row;
-    Dest->Cursor.Column = Source->Cursor.Column;
-    Dest->SelectedPiece = Source->SelectedPiece;
-    Dest->PieceOnCursor = Source->PieceOnCursor;
-    Dest->BlackCanMove = Source->WhiteCanMove;
-    Dest->BlackIsPlaying = Source->BlackIsPlaying;
-    Dest->History = Source->History;
-    Dest->GameIsOver = Source->GameIsOver;
-    Dest->CurrentEntryIndex = Source->CurrentEntryIndex;
-    Dest->DestinationsCount = Source->DestinationsCount;
-    for (u32 i = 0; i < ArrayCount(Source->Destinations); ++i)
-    {
-        Dest->Destinations[i] = Source->Destinations[i];
-    }
+    // NOTE(vincent): Memory is expected to be zeroed. An all-zero entry only verifies
+    // against key 0, and carries no move and no depth, so it's harmless either way.
+    Assert((EntryCount & (EntryCount - 1)) == 0);
+    Table->Entries = (transposition_entry *)Memory;
+    Table->EntryCount = Memory ? EntryCount : 0;
+    Table->Generation = 0;
+    Table->PageKind = PageKind;
+    InitializeZobristKeys(&Table->Keys);
 }
 
+internal void
+InitializePawnTable(pawn_table *Table, void *Memory, u64 EntryCount)
+{
+    // NOTE(vincent): Memory is expected to be zeroed, see GetPawnKey() about key 0.
+    Assert((EntryCount & (EntryCount - 1)) == 0);
+    Table->Entries = (pawn_entry *)Memory;
+    Table->EntryCount = Memory ? EntryCount : 0;
+    InitializeZobristKeys(&Table->Keys);
+}
 
-PLATFORM_WORK_QUEUE_CALLBACK(GetGoodDecision)
+// NOTE(vincent): Start of a transposition table placed in shared memory (or in the
+// learning file), followed by the entries. Game processes on the same machine read and write the entries concurrently,
+// which the Key ^ Data verification already copes with. The header is there so that we
+// don't misread a segment left by a build with a different table size or different keys.
+#define SHARED_TABLE_MAGIC 0x3130747373656863ULL
+struct shared_table_header
+{
+    u64 Magic;
+    u64 EntryCount;
+    u64 KeyCheck;
+    u64 Reserved[5];  // keeps the entries on a cache line boundary
+};
+
+internal u64
+ZobristKeyCheck(zobrist_keys *Keys)
+{
+    u64 Result = 0;
+    u64 *Key = (u64 *)Keys;
+    for (u32 i = 0; i < sizeof(zobrist_keys) / sizeof(u64); ++i)
+        Result = (Result ^ Key[i]) * 0x100000001B3ULL;
+    return Result;
+}
+
+internal void *
+OpenSharedTranspositionEntries(char *Name, u64 EntryCount, platform_page_kind *PageKind)
+{
+    // NOTE(vincent): Returns 0 when the segment can't be used, and the caller falls back
+    // to a private table.
+    void *Result = 0;
+    zobrist_keys Keys;
+    InitializeZobristKeys(&Keys);
+    u64 KeyCheck = ZobristKeyCheck(&Keys);
+    
+    shared_table_header *Header = (shared_table_header *)
+        GlobalPlatform->OpenSharedMemory(Name, sizeof(shared_table_header) + 
+                                         EntryCount*sizeof(transposition_entry), PageKind);
+    if (Header)
+    {
+        if (Header->Magic == 0)
+        {
+            // NOTE(vincent): Fresh segment. Processes that get here at the same time all
+            // write the same values, unless they disagree on the table, and then the check
+            // below sends at least one of them back to a private table.
+            Header->EntryCount = EntryCount;
+            Header->KeyCheck = KeyCheck;
+            CompilerWriteBarrier;
+            Header->Magic = SHARED_TABLE_MAGIC;
+        }
+        if (Header->Magic == SHARED_TABLE_MAGIC && Header->EntryCount == EntryCount &&
+            Header->KeyCheck == KeyCheck)
+        {
+            Result = Header + 1;
+        }
+    }
+    return Result;
+}
+
+internal void *
+OpenLearningEntries(char *Filename, u64 EntryCount)
+{
+    // NOTE(vincent): Same header as a shared table. A file left by a build with a different
+    // table size or different keys is of no use to us, so it gets cleared.
+    void *Result = 0;
+    zobrist_keys Keys;
+    InitializeZobristKeys(&Keys);
+    u64 KeyCheck = ZobristKeyCheck(&Keys);
+    
+    memory_index Size = sizeof(shared_table_header) + EntryCount*sizeof(transposition_entry);
+    shared_table_header *Header = (shared_table_header *)GlobalPlatform->MapFile(Filename, Size);
+    if (Header)
+    {
+        if (Header->Magic != SHARED_TABLE_MAGIC || Header->EntryCount != EntryCount ||
+            Header->KeyCheck != KeyCheck)
+        {
+            ZeroBytes((u8 *)Header, Size);
+            Header->EntryCount = EntryCount;
+            Header->KeyCheck = KeyCheck;
+            CompilerWriteBarrier;
+            Header->Magic = SHARED_TABLE_MAGIC;
+        }
+        Result = Header + 1;
+    }
+    return Result;
+}
+
+internal u64
+ComputePositionKey(zobrist_keys *Keys, chess_game_state *Game)
+{
+    // NOTE(vincent): Everything that decides which moves are legal: piece placement,
+    // side to move, castling rights and en passant. Piece indices are left out on purpose,
+    // two positions that only differ by which rook is which are the same position.
+    u64 Key = 0;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        chess_piece *Black = Game->Blacks + i;
+        chess_piece *White = Game->Whites + i;
+        if (Black->Type != ChessPieceType_Empty)
+            Key ^= Keys->Pieces[0][Black->Type][Black->Row*8 + Black->Column];
+        if (White->Type != ChessPieceType_Empty)
+            Key ^= Keys->Pieces[1][White->Type][White->Row*8 + White->Column];
+    }
+    if (Game->BlackIsPlaying)
+        Key ^= Keys->BlackToMove;
+    
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *Pieces = Color ? Game->Whites : Game->Blacks;
+        if (Pieces[12].MoveCount == 0)
+        {
+            if (Pieces[8].Type == ChessPieceType_Rook && Pieces[8].MoveCount == 0)
+                Key ^= Keys->Castling[2*Color];
+            if (Pieces[15].Type == ChessPieceType_Rook && Pieces[15].MoveCount == 0)
+                Key ^= Keys->Castling[2*Color + 1];
+        }
+    }
+    
+    if (Game->History.EntryCount > 0)
+    {
+        history_entry LastEntry = Game->History.Entries[Game->History.EntryCount-1];
+        chess_piece *Opponents = Game->BlackIsPlaying ? Game->Whites : Game->Blacks;
+        chess_piece *LastMoved = Opponents + (LastEntry.Indices & 15);
+        if (LastMoved->Type == ChessPieceType_Pawn && (LastEntry.Delta & 7) == 2)
+            Key ^= Keys->EnPassant[LastMoved->Column];
+    }
+    return Key;
+}
+
+struct transposition_probe
+{
+    u32 Depth;  // 0 when only the move is worth anything
+    transposition_bound Bound;
+    s32 Value;
+    b32 HasMove;
+    u32 FromSquare;  // Row*8 + Column
+    u32 DestCode;    // without the capture bit
+};
+
+internal b32
+ProbeTransposition(transposition_table *Table, u64 Key, transposition_probe *Probe)
+{
+    transposition_entry *Entry = Table->Entries + (Key & (Table->EntryCount - 1));
+    u64 Data = Entry->Data;
+    b32 Found = ((Entry->KeyXorData ^ Data) == Key);
+    if (Found)
+    {
+        Probe->FromSquare = Data & 63;
+        Probe->DestCode = (Data >> 6) & 63;
+        Probe->HasMove = (Data >> 12) & 1;
+        Probe->Depth = (Data >> 16) & 0xff;
+        Probe->Bound = (transposition_bound)((Data >> 24) & 3);
+        Probe->Value = (s16)((Data >> 32) & 0xffff);
+    }
+    return Found;
+}
+
+internal void
+StoreTransposition(transposition_table *Table, u64 Key, u32 Depth, transposition_bound Bound,
+                   s32 Value, decision *BestDecision)
+{
+    transposition_entry *Entry = Table->Entries + (Key & (Table->EntryCount - 1));
+    u64 OldData = Entry->Data;
+    b32 SamePosition = ((Entry->KeyXorData ^ OldData) == Key);
+    u32 Generation = Table->Generation & 0xff;
+    u32 OldDepth = (OldData >> 16) & 0xff;
+    u32 OldGeneration = (OldData >> 48) & 0xff;
+    
+    // NOTE(vincent): Keep a deeper result of the current search over a shallower one.
+    if (!SamePosition || OldGeneration != Generation || Depth >= OldDepth)
+    {
+        Assert(Depth <= 0xff && -32768 <= Value && Value <= 32767);
+        u64 Data = ((u64)Depth << 16) | ((u64)Bound << 24) | 
+            ((u64)(u16)(s16)Value << 32) | ((u64)Generation << 48);
+        if (BestDecision && BestDecision->Piece)
+        {
+            chess_piece *Piece = BestDecision->Piece;
+            Data |= (Piece->Row*8 + Piece->Column) | 
+                ((u64)(BestDecision->Destination.DestCode & 63) << 6) | (1 << 12);
+        }
+        else if (SamePosition)
+        {
+            Data |= OldData & 0x1fff;  // keep the move we knew about
+        }
+        Entry->Data = Data;
+        Entry->KeyXorData = Key ^ Data;
+    }
+}
+
+internal b32
+FindDecision(chess_piece *Pieces, u32 FromSquare, u32 DestCode, decision *Result)
+{
+    // NOTE(vincent): Turns a move from the transposition table back into a decision,
+    // checking that it is legal here (different positions can share an entry's index, and
+    // in rare cases, a key).
+    b32 Found = false;
+    for (u32 PieceIndex = 0; PieceIndex < 16 && !Found; ++PieceIndex)
+    {
+        chess_piece *Piece = Pieces + PieceIndex;
+        if (Piece->Type != ChessPieceType_Empty && Piece->Row*8 + Piece->Column == FromSquare)
+        {
+            for (u32 DestIndex = 0; DestIndex < Piece->DestinationsCount; ++DestIndex)
+            {
+                if ((Piece->Destinations[DestIndex].DestCode & 63) == DestCode)
+                {
+                    Result->Piece = Piece;
+                    Result->Destination = Piece->Destinations[DestIndex];
+                    Result->PromotionType = ChessPieceType_Empty;
+                    u32 DestRow = DestCode & 7;
+                    if (Piece->Type == ChessPieceType_Pawn && (DestRow == 0 || DestRow == 7))
+                        Result->PromotionType = ChessPieceType_Queen;
+                    Found = true;
+                    break;
+                }
+            }
+        }
+    }
+    return Found;
+}
+
+#define BOOK_FILENAME "chess_book.bin"
+#define BOOK_ENTRY_SIZE 16
+
+// NOTE(vincent): How many plies into the game each AI keeps playing from the book,
+// indexed by its search depth (AI level - 1). Deeper AIs stay in it longer, the depths
+// past the end of the table use its last value.
+global_variable u32 BookPliesBySearchDepth[] = {0, 6, 10, 16, 24};
+
+internal u64
+ReadBigEndianU64(u8 *At)
+{
+    u64 Result = 0;
+    for (u32 i = 0; i < 8; ++i)
+        Result = (Result << 8) | At[i];
+    return Result;
+}
+
+internal u32
+ReadBigEndianU16(u8 *At)
+{
+    u32 Result = ((u32)At[0] << 8) | At[1];
+    return Result;
+}
+
+// NOTE(vincent): Polyglot's Random64 table, so that books made by other tools can be used.
+// 0-767 are the piece keys at 64*Kind + Row*8 + Column, Kind going black pawn, white pawn,
+// black knight, white knight, ... white king. Then the castling keys (white king side, white
+// queen side, black king side, black queen side), the en passant files, and white to move.
+global_variable u64 PolyglotRandom64[781] =
+{
+    0x9D39247E33776D41, 0x2AF7398005AAA5C7, 0x44DB015024623547, 0x9C15F73E62A76AE2,
+    0x75834465489C0C89, 0x3290AC3A203001BF, 0x0FBBAD1F61042279, 0xE83A908FF2FB60CA,
+    0x0D7E765D58755C10, 0x1A083822CEAFE02D, 0x9605D5F0E25EC3B0, 0xD021FF5CD13A2ED5,
+    0x40BDF15D4A672E32, 0x011355146FD56395, 0x5DB4832046F3D9E5, 0x239F8B2D7FF719CC,
+    0x05D1A1AE85B49AA1, 0x679F848F6E8FC971, 0x7449BBFF801FED0B, 0x7D11CDB1C3B7ADF0,
+    0x82C7709E781EB7CC, 0xF3218F1C9510786C, 0x331478F3AF51BBE6, 0x4BB38DE5E7219443,
+    0xAA649C6EBCFD50FC, 0x8DBD98A352AFD40B, 0x87D2074B81D79217, 0x19F3C751D3E92AE1,
+    0xB4AB30F062B19ABF, 0x7B0500AC42047AC4, 0xC9452CA81A09D85D, 0x24AA6C514DA27500,
+    0x4C9F34427501B447, 0x14A68FD73C910841, 0xA71B9B83461CBD93, 0x03488B95B0F1850F,
+    0x637B2B34FF93C040, 0x09D1BC9A3DD90A94, 0x3575668334A1DD3B, 0x735E2B97A4C45A23,
+    0x18727070F1BD400B, 0x1FCBACD259BF02E7, 0xD310A7C2CE9B6555, 0xBF983FE0FE5D8244,
+    0x9F74D14F7454A824, 0x51EBDC4AB9BA3035, 0x5C82C505DB9AB0FA, 0xFCF7FE8A3430B241,
+    0x3253A729B9BA3DDE, 0x8C74C368081B3075, 0xB9BC6C87167C33E7, 0x7EF48F2B83024E20,
+    0x11D505D4C351BD7F, 0x6568FCA92C76A243, 0x4DE0B0F40F32A7B8, 0x96D693460CC37E5D,
+    0x42E240CB63689F2F, 0x6D2BDCDAE2919661, 0x42880B0236E4D951, 0x5F0F4A5898171BB6,
+    0x39F890F579F92F88, 0x93C5B5F47356388B, 0x63DC359D8D231B78, 0xEC16CA8AEA98AD76,
+    0x5355F900C2A82DC7, 0x07FB9F855A997142, 0x5093417AA8A7ED5E, 0x7BCBC38DA25A7F3C,
+    0x19FC8A768CF4B6D4, 0x637A7780DECFC0D9, 0x8249A47AEE0E41F7, 0x79AD695501E7D1E8,
+    0x14ACBAF4777D5776, 0xF145B6BECCDEA195, 0xDABF2AC8201752FC, 0x24C3C94DF9C8D3F6,
+    0xBB6E2924F03912EA, 0x0CE26C0B95C980D9, 0xA49CD132BFBF7CC4, 0xE99D662AF4243939,
+    0x27E6AD7891165C3F, 0x8535F040B9744FF1, 0x54B3F4FA5F40D873, 0x72B12C32127FED2B,
+    0xEE954D3C7B411F47, 0x9A85AC909A24EAA1, 0x70AC4CD9F04F21F5, 0xF9B89D3E99A075C2,
+    0x87B3E2B2B5C907B1, 0xA366E5B8C54F48B8, 0xAE4A9346CC3F7CF2, 0x1920C04D47267BBD,
+    0x87BF02C6B49E2AE9, 0x092237AC237F3859, 0xFF07F64EF8ED14D0, 0x8DE8DCA9F03CC54E,
+    0x9C1633264DB49C89, 0xB3F22C3D0B0B38ED, 0x390E5FB44D01144B, 0x5BFEA5B4712768E9,
+    0x1E1032911FA78984, 0x9A74ACB964E78CB3, 0x4F80F7A035DAFB04, 0x6304D09A0B3738C4,
+    0x2171E64683023A08, 0x5B9B63EB9CEFF80C, 0x506AACF489889342, 0x1881AFC9A3A701D6,
+    0x6503080440750644, 0xDFD395339CDBF4A7, 0xEF927DBCF00C20F2, 0x7B32F7D1E03680EC,
+    0xB9FD7620E7316243, 0x05A7E8A57DB91B77, 0xB5889C6E15630A75, 0x4A750A09CE9573F7,
+    0xCF464CEC899A2F8A, 0xF538639CE705B824, 0x3C79A0FF5580EF7F, 0xEDE6C87F8477609D,
+    0x799E81F05BC93F31, 0x86536B8CF3428A8C, 0x97D7374C60087B73, 0xA246637CFF328532,
+    0x043FCAE60CC0EBA0, 0x920E449535DD359E, 0x70EB093B15B290CC, 0x73A1921916591CBD,
+    0x56436C9FE1A1AA8D, 0xEFAC4B70633B8F81, 0xBB215798D45DF7AF, 0x45F20042F24F1768,
+    0x930F80F4E8EB7462, 0xFF6712FFCFD75EA1, 0xAE623FD67468AA70, 0xDD2C5BC84BC8D8FC,
+    0x7EED120D54CF2DD9, 0x22FE545401165F1C, 0xC91800E98FB99929, 0x808BD68E6AC10365,
+    0xDEC468145B7605F6, 0x1BEDE3A3AEF53302, 0x43539603D6C55602, 0xAA969B5C691CCB7A,
+    0xA87832D392EFEE56, 0x65942C7B3C7E11AE, 0xDED2D633CAD004F6, 0x21F08570F420E565,
+    0xB415938D7DA94E3C, 0x91B859E59ECB6350, 0x10CFF333E0ED804A, 0x28AED140BE0BB7DD,
+    0xC5CC1D89724FA456, 0x5648F680F11A2741, 0x2D255069F0B7DAB3, 0x9BC5A38EF729ABD4,
+    0xEF2F054308F6A2BC, 0xAF2042F5CC5C2858, 0x480412BAB7F5BE2A, 0xAEF3AF4A563DFE43,
+    0x19AFE59AE451497F, 0x52593803DFF1E840, 0xF4F076E65F2CE6F0, 0x11379625747D5AF3,
+    0xBCE5D2248682C115, 0x9DA4243DE836994F, 0x066F70B33FE09017, 0x4DC4DE189B671A1C,
+    0x51039AB7712457C3, 0xC07A3F80C31FB4B4, 0xB46EE9C5E64A6E7C, 0xB3819A42ABE61C87,
+    0x21A007933A522A20, 0x2DF16F761598AA4F, 0x763C4A1371B368FD, 0xF793C46702E086A0,
+    0xD7288E012AEB8D31, 0xDE336A2A4BC1C44B, 0x0BF692B38D079F23, 0x2C604A7A177326B3,
+    0x4850E73E03EB6064, 0xCFC447F1E53C8E1B, 0xB05CA3F564268D99, 0x9AE182C8BC9474E8,
+    0xA4FC4BD4FC5558CA, 0xE755178D58FC4E76, 0x69B97DB1A4C03DFE, 0xF9B5B7C4ACC67C96,
+    0xFC6A82D64B8655FB, 0x9C684CB6C4D24417, 0x8EC97D2917456ED0, 0x6703DF9D2924E97E,
+    0xC547F57E42A7444E, 0x78E37644E7CAD29E, 0xFE9A44E9362F05FA, 0x08BD35CC38336615,
+    0x9315E5EB3A129ACE, 0x94061B871E04DF75, 0xDF1D9F9D784BA010, 0x3BBA57B68871B59D,
+    0xD2B7ADEEDED1F73F, 0xF7A255D83BC373F8, 0xD7F4F2448C0CEB81, 0xD95BE88CD210FFA7,
+    0x336F52F8FF4728E7, 0xA74049DAC312AC71, 0xA2F61BB6E437FDB5, 0x4F2A5CB07F6A35B3,
+    0x87D380BDA5BF7859, 0x16B9F7E06C453A21, 0x7BA2484C8A0FD54E, 0xF3A678CAD9A2E38C,
+    0x39B0BF7DDE437BA2, 0xFCAF55C1BF8A4424, 0x18FCF680573FA594, 0x4C0563B89F495AC3,
+    0x40E087931A00930D, 0x8CFFA9412EB642C1, 0x68CA39053261169F, 0x7A1EE967D27579E2,
+    0x9D1D60E5076F5B6F, 0x3810E399B6F65BA2, 0x32095B6D4AB5F9B1, 0x35CAB62109DD038A,
+    0xA90B24499FCFAFB1, 0x77A225A07CC2C6BD, 0x513E5E634C70E331, 0x4361C0CA3F692F12,
+    0xD941ACA44B20A45B, 0x528F7C8602C5807B, 0x52AB92BEB9613989, 0x9D1DFA2EFC557F73,
+    0x722FF175F572C348, 0x1D1260A51107FE97, 0x7A249A57EC0C9BA2, 0x04208FE9E8F7F2D6,
+    0x5A110C6058B920A0, 0x0CD9A497658A5698, 0x56FD23C8F9715A4C, 0x284C847B9D887AAE,
+    0x04FEABFBBDB619CB, 0x742E1E651C60BA83, 0x9A9632E65904AD3C, 0x881B82A13B51B9E2,
+    0x506E6744CD974924, 0xB0183DB56FFC6A79, 0x0ED9B915C66ED37E, 0x5E11E86D5873D484,
+    0xF678647E3519AC6E, 0x1B85D488D0F20CC5, 0xDAB9FE6525D89021, 0x0D151D86ADB73615,
+    0xA865A54EDCC0F019, 0x93C42566AEF98FFB, 0x99E7AFEABE000731, 0x48CBFF086DDF285A,
+    0x7F9B6AF1EBF78BAF, 0x58627E1A149BBA21, 0x2CD16E2ABD791E33, 0xD363EFF5F0977996,
+    0x0CE2A38C344A6EED, 0x1A804AADB9CFA741, 0x907F30421D78C5DE, 0x501F65EDB3034D07,
+    0x37624AE5A48FA6E9, 0x957BAF61700CFF4E, 0x3A6C27934E31188A, 0xD49503536ABCA345,
+    0x088E049589C432E0, 0xF943AEE7FEBF21B8, 0x6C3B8E3E336139D3, 0x364F6FFA464EE52E,
+    0xD60F6DCEDC314222, 0x56963B0DCA418FC0, 0x16F50EDF91E513AF, 0xEF1955914B609F93,
+    0x565601C0364E3228, 0xECB53939887E8175, 0xBAC7A9A18531294B, 0xB344C470397BBA52,
+    0x65D34954DAF3CEBD, 0xB4B81B3FA97511E2, 0xB422061193D6F6A7, 0x071582401C38434D,
+    0x7A13F18BBEDC4FF5, 0xBC4097B116C524D2, 0x59B97885E2F2EA28, 0x99170A5DC3115544,
+    0x6F423357E7C6A9F9, 0x325928EE6E6F8794, 0xD0E4366228B03343, 0x565C31F7DE89EA27,
+    0x30F5611484119414, 0xD873DB391292ED4F, 0x7BD94E1D8E17DEBC, 0xC7D9F16864A76E94,
+    0x947AE053EE56E63C, 0xC8C93882F9475F5F, 0x3A9BF55BA91F81CA, 0xD9A11FBB3D9808E4,
+    0x0FD22063EDC29FCA, 0xB3F256D8ACA0B0B9, 0xB03031A8B4516E84, 0x35DD37D5871448AF,
+    0xE9F6082B05542E4E, 0xEBFAFA33D7254B59, 0x9255ABB50D532280, 0xB9AB4CE57F2D34F3,
+    0x693501D628297551, 0xC62C58F97DD949BF, 0xCD454F8F19C5126A, 0xBBE83F4ECC2BDECB,
+    0xDC842B7E2819E230, 0xBA89142E007503B8, 0xA3BC941D0A5061CB, 0xE9F6760E32CD8021,
+    0x09C7E552BC76492F, 0x852F54934DA55CC9, 0x8107FCCF064FCF56, 0x098954D51FFF6580,
+    0x23B70EDB1955C4BF, 0xC330DE426430F69D, 0x4715ED43E8A45C0A, 0xA8D7E4DAB780A08D,
+    0x0572B974F03CE0BB, 0xB57D2E985E1419C7, 0xE8D9ECBE2CF3D73F, 0x2FE4B17170E59750,
+    0x11317BA87905E790, 0x7FBF21EC8A1F45EC, 0x1725CABFCB045B00, 0x964E915CD5E2B207,
+    0x3E2B8BCBF016D66D, 0xBE7444E39328A0AC, 0xF85B2B4FBCDE44B7, 0x49353FEA39BA63B1,
+    0x1DD01AAFCD53486A, 0x1FCA8A92FD719F85, 0xFC7C95D827357AFA, 0x18A6A990C8B35EBD,
+    0xCCCB7005C6B9C28D, 0x3BDBB92C43B17F26, 0xAA70B5B4F89695A2, 0xE94C39A54A98307F,
+    0xB7A0B174CFF6F36E, 0xD4DBA84729AF48AD, 0x2E18BC1AD9704A68, 0x2DE0966DAF2F8B1C,
+    0xB9C11D5B1E43A07E, 0x64972D68DEE33360, 0x94628D38D0C20584, 0xDBC0D2B6AB90A559,
+    0xD2733C4335C6A72F, 0x7E75D99D94A70F4D, 0x6CED1983376FA72B, 0x97FCAACBF030BC24,
+    0x7B77497B32503B12, 0x8547EDDFB81CCB94, 0x79999CDFF70902CB, 0xCFFE1939438E9B24,
+    0x829626E3892D95D7, 0x92FAE24291F2B3F1, 0x63E22C147B9C3403, 0xC678B6D860284A1C,
+    0x5873888850659AE7, 0x0981DCD296A8736D, 0x9F65789A6509A440, 0x9FF38FED72E9052F,
+    0xE479EE5B9930578C, 0xE7F28ECD2D49EECD, 0x56C074A581EA17FE, 0x5544F7D774B14AEF,
+    0x7B3F0195FC6F290F, 0x12153635B2C0CF57, 0x7F5126DBBA5E0CA7, 0x7A76956C3EAFB413,
+    0x3D5774A11D31AB39, 0x8A1B083821F40CB4, 0x7B4A38E32537DF62, 0x950113646D1D6E03,
+    0x4DA8979A0041E8A9, 0x3BC36E078F7515D7, 0x5D0A12F27AD310D1, 0x7F9D1A2E1EBE1327,
+    0xDA3A361B1C5157B1, 0xDCDD7D20903D0C25, 0x36833336D068F707, 0xCE68341F79893389,
+    0xAB9090168DD05F34, 0x43954B3252DC25E5, 0xB438C2B67F98E5E9, 0x10DCD78E3851A492,
+    0xDBC27AB5447822BF, 0x9B3CDB65F82CA382, 0xB67B7896167B4C84, 0xBFCED1B0048EAC50,
+    0xA9119B60369FFEBD, 0x1FFF7AC80904BF45, 0xAC12FB171817EEE7, 0xAF08DA9177DDA93D,
+    0x1B0CAB936E65C744, 0xB559EB1D04E5E932, 0xC37B45B3F8D6F2BA, 0xC3A9DC228CAAC9E9,
+    0xF3B8B6675A6507FF, 0x9FC477DE4ED681DA, 0x67378D8ECCEF96CB, 0x6DD856D94D259236,
+    0xA319CE15B0B4DB31, 0x073973751F12DD5E, 0x8A8E849EB32781A5, 0xE1925C71285279F5,
+    0x74C04BF1790C0EFE, 0x4DDA48153C94938A, 0x9D266D6A1CC0542C, 0x7440FB816508C4FE,
+    0x13328503DF48229F, 0xD6BF7BAEE43CAC40, 0x4838D65F6EF6748F, 0x1E152328F3318DEA,
+    0x8F8419A348F296BF, 0x72C8834A5957B511, 0xD7A023A73260B45C, 0x94EBC8ABCFB56DAE,
+    0x9FC10D0F989993E0, 0xDE68A2355B93CAE6, 0xA44CFE79AE538BBE, 0x9D1D84FCCE371425,
+    0x51D2B1AB2DDFB636, 0x2FD7E4B9E72CD38C, 0x65CA5B96B7552210, 0xDD69A0D8AB3B546D,
+    0x604D51B25FBF70E2, 0x73AA8A564FB7AC9E, 0x1A8C1E992B941148, 0xAAC40A2703D9BEA0,
+    0x764DBEAE7FA4F3A6, 0x1E99B96E70A9BE8B, 0x2C5E9DEB57EF4743, 0x3A938FEE32D29981,
+    0x26E6DB8FFDF5ADFE, 0x469356C504EC9F9D, 0xC8763C5B08D1908C, 0x3F6C6AF859D80055,
+    0x7F7CC39420A3A545, 0x9BFB227EBDF4C5CE, 0x89039D79D6FC5C5C, 0x8FE88B57305E2AB6,
+    0xA09E8C8C35AB96DE, 0xFA7E393983325753, 0xD6B6D0ECC617C699, 0xDFEA21EA9E7557E3,
+    0xB67C1FA481680AF8, 0xCA1E3785A9E724E5, 0x1CFC8BED0D681639, 0xD18D8549D140CAEA,
+    0x4ED0FE7E9DC91335, 0xE4DBF0634473F5D2, 0x1761F93A44D5AEFE, 0x53898E4C3910DA55,
+    0x734DE8181F6EC39A, 0x2680B122BAA28D97, 0x298AF231C85BAFAB, 0x7983EED3740847D5,
+    0x66C1A2A1A60CD889, 0x9E17E49642A3E4C1, 0xEDB454E7BADC0805, 0x50B704CAB602C329,
+    0x4CC317FB9CDDD023, 0x66B4835D9EAFEA22, 0x219B97E26FFC81BD, 0x261E4E4C0A333A9D,
+    0x1FE2CCA76517DB90, 0xD7504DFA8816EDBB, 0xB9571FA04DC089C8, 0x1DDC0325259B27DE,
+    0xCF3F4688801EB9AA, 0xF4F5D05C10CAB243, 0x38B6525C21A42B0E, 0x36F60E2BA4FA6800,
+    0xEB3593803173E0CE, 0x9C4CD6257C5A3603, 0xAF0C317D32ADAA8A, 0x258E5A80C7204C4B,
+    0x8B889D624D44885D, 0xF4D14597E660F855, 0xD4347F66EC8941C3, 0xE699ED85B0DFB40D,
+    0x2472F6207C2D0484, 0xC2A1E7B5B459AEB5, 0xAB4F6451CC1D45EC, 0x63767572AE3D6174,
+    0xA59E0BD101731A28, 0x116D0016CB948F09, 0x2CF9C8CA052F6E9F, 0x0B090A7560A968E3,
+    0xABEEDDB2DDE06FF1, 0x58EFC10B06A2068D, 0xC6E57A78FBD986E0, 0x2EAB8CA63CE802D7,
+    0x14A195640116F336, 0x7C0828DD624EC390, 0xD74BBE77E6116AC7, 0x804456AF10F5FB53,
+    0xEBE9EA2ADF4321C7, 0x03219A39EE587A30, 0x49787FEF17AF9924, 0xA1E9300CD8520548,
+    0x5B45E522E4B1B4EF, 0xB49C3B3995091A36, 0xD4490AD526F14431, 0x12A8F216AF9418C2,
+    0x001F837CC7350524, 0x1877B51E57A764D5, 0xA2853B80F17F58EE, 0x993E1DE72D36D310,
+    0xB3598080CE64A656, 0x252F59CF0D9F04BB, 0xD23C8E176D113600, 0x1BDA0492E7E4586E,
+    0x21E0BD5026C619BF, 0x3B097ADAF088F94E, 0x8D14DEDB30BE846E, 0xF95CFFA23AF5F6F4,
+    0x3871700761B3F743, 0xCA672B91E9E4FA16, 0x64C8E531BFF53B55, 0x241260ED4AD1E87D,
+    0x106C09B972D2E822, 0x7FBA195410E5CA30, 0x7884D9BC6CB569D8, 0x0647DFEDCD894A29,
+    0x63573FF03E224774, 0x4FC8E9560F91B123, 0x1DB956E450275779, 0xB8D91274B9E9D4FB,
+    0xA2EBEE47E2FBFCE1, 0xD9F1F30CCD97FB09, 0xEFED53D75FD64E6B, 0x2E6D02C36017F67F,
+    0xA9AA4D20DB084E9B, 0xB64BE8D8B25396C1, 0x70CB6AF7C2D5BCF0, 0x98F076A4F7A2322E,
+    0xBF84470805E69B5F, 0x94C3251F06F90CF3, 0x3E003E616A6591E9, 0xB925A6CD0421AFF3,
+    0x61BDD1307C66E300, 0xBF8D5108E27E0D48, 0x240AB57A8B888B20, 0xFC87614BAF287E07,
+    0xEF02CDD06FFDB432, 0xA1082C0466DF6C0A, 0x8215E577001332C8, 0xD39BB9C3A48DB6CF,
+    0x2738259634305C14, 0x61CF4F94C97DF93D, 0x1B6BACA2AE4E125B, 0x758F450C88572E0B,
+    0x959F587D507A8359, 0xB063E962E045F54D, 0x60E8ED72C0DFF5D1, 0x7B64978555326F9F,
+    0xFD080D236DA814BA, 0x8C90FD9B083F4558, 0x106F72FE81E2C590, 0x7976033A39F7D952,
+    0xA4EC0132764CA04B, 0x733EA705FAE4FA77, 0xB4D8F77BC3E56167, 0x9E21F4F903B33FD9,
+    0x9D765E419FB69F6D, 0xD30C088BA61EA5EF, 0x5D94337FBFAF7F5B, 0x1A4E4822EB4D7A59,
+    0x6FFE73E81B637FB3, 0xDDF957BC36D8B9CA, 0x64D0E29EEA8838B3, 0x08DD9BDFD96B9F63,
+    0x087E79E5A57D1D13, 0xE328E230E3E2B3FB, 0x1C2559E30F0946BE, 0x720BF5F26F4D2EAA,
+    0xB0774D261CC609DB, 0x443F64EC5A371195, 0x4112CF68649A260E, 0xD813F2FAB7F5C5CA,
+    0x660D3257380841EE, 0x59AC2C7873F910A3, 0xE846963877671A17, 0x93B633ABFA3469F8,
+    0xC0C0F5A60EF4CDCF, 0xCAF21ECD4377B28C, 0x57277707199B8175, 0x506C11B9D90E8B1D,
+    0xD83CC2687A19255F, 0x4A29C6465A314CD1, 0xED2DF21216235097, 0xB5635C95FF7296E2,
+    0x22AF003AB672E811, 0x52E762596BF68235, 0x9AEBA33AC6ECC6B0, 0x944F6DE09134DFB6,
+    0x6C47BEC883A7DE39, 0x6AD047C430A12104, 0xA5B1CFDBA0AB4067, 0x7C45D833AFF07862,
+    0x5092EF950A16DA0B, 0x9338E69C052B8E7B, 0x455A4B4CFE30E3F5, 0x6B02E63195AD0CF8,
+    0x6B17B224BAD6BF27, 0xD1E0CCD25BB9C169, 0xDE0C89A556B9AE70, 0x50065E535A213CF6,
+    0x9C1169FA2777B874, 0x78EDEFD694AF1EED, 0x6DC93D9526A50E68, 0xEE97F453F06791ED,
+    0x32AB0EDB696703D3, 0x3A6853C7E70757A7, 0x31865CED6120F37D, 0x67FEF95D92607890,
+    0x1F2B1D1F15F6DC9C, 0xB69E38A8965C6B65, 0xAA9119FF184CCCF4, 0xF43C732873F24C13,
+    0xFB4A3D794A9A80D2, 0x3550C2321FD6109C, 0x371F77E76BB8417E, 0x6BFA9AAE5EC05779,
+    0xCD04F3FF001A4778, 0xE3273522064480CA, 0x9F91508BFFCFC14A, 0x049A7F41061A9E60,
+    0xFCB6BE43A9F2FE9B, 0x08DE8A1C7797DA9B, 0x8F9887E6078735A1, 0xB5B4071DBFC73A66,
+    0x230E343DFBA08D33, 0x43ED7F5A0FAE657D, 0x3A88A0FBBCB05C63, 0x21874B8B4D2DBC4F,
+    0x1BDEA12E35F6A8C9, 0x53C065C6C8E63528, 0xE34A1D250E7A8D6B, 0xD6B04D3B7651DD7E,
+    0x5E90277E7CB39E2D, 0x2C046F22062DC67D, 0xB10BB459132D0A26, 0x3FA9DDFB67E2F199,
+    0x0E09B88E1914F7AF, 0x10E8B35AF3EEAB37, 0x9EEDECA8E272B933, 0xD4C718BC4AE8AE5F,
+    0x81536D601170FC20, 0x91B534F885818A06, 0xEC8177F83F900978, 0x190E714FADA5156E,
+    0xB592BF39B0364963, 0x89C350C893AE7DC1, 0xAC042E70F8B383F2, 0xB49B52E587A1EE60,
+    0xFB152FE3FF26DA89, 0x3E666E6F69AE2C15, 0x3B544EBE544C19F9, 0xE805A1E290CF2456,
+    0x24B33C9D7ED25117, 0xE74733427B72F0C1, 0x0A804D18B7097475, 0x57E3306D881EDB4F,
+    0x4AE7D6A36EB5DBCB, 0x2D8D5432157064C8, 0xD1E649DE1E7F268B, 0x8A328A1CEDFE552C,
+    0x07A3AEC79624C7DA, 0x84547DDC3E203C94, 0x990A98FD5071D263, 0x1A4FF12616EEFC89,
+    0xF6F7FD1431714200, 0x30C05B1BA332F41C, 0x8D2636B81555A786, 0x46C9FEB55D120902,
+    0xCCEC0A73B49C9921, 0x4E9D2827355FC492, 0x19EBB029435DCB0F, 0x4659D2B743848A2C,
+    0x963EF2C96B33BE31, 0x74F85198B05A2E7D, 0x5A0F544DD2B1FB18, 0x03727073C2E134B1,
+    0xC7F6AA2DE59AEA61, 0x352787BAA0D7C22F, 0x9853EAB63B5E0B35, 0xABBDCDD7ED5C0860,
+    0xCF05DAF5AC8D77B0, 0x49CAD48CEBF4A71E, 0x7A4C10EC2158C4A6, 0xD9E92AA246BF719E,
+    0x13AE978D09FE5557, 0x730499AF921549FF, 0x4E4B705B92903BA4, 0xFF577222C14F0A3A,
+    0x55B6344CF97AAFAE, 0xB862225B055B6960, 0xCAC09AFBDDD2CDB4, 0xDAF8E9829FE96B5F,
+    0xB5FDFC5D3132C498, 0x310CB380DB6F7503, 0xE87FBB46217A360E, 0x2102AE466EBB1148,
+    0xF8549E1A3AA5E00D, 0x07A69AFDCC42261A, 0xC4C118BFE78FEAAE, 0xF9F4892ED96BD438,
+    0x1AF3DBE25D8F45DA, 0xF5B4B0B0D2DEEEB4, 0x962ACEEFA82E1C84, 0x046E3ECAAF453CE9,
+    0xF05D129681949A4C, 0x964781CE734B3C84, 0x9C2ED44081CE5FBD, 0x522E23F3925E319E,
+    0x177E00F9FC32F791, 0x2BC60A63A6F3B3F2, 0x222BBFAE61725606, 0x486289DDCC3D6780,
+    0x7DC7785B8EFDFC80, 0x8AF38731C02BA980, 0x1FAB64EA29A2DDF7, 0xE4D9429322CD065A,
+    0x9DA058C67844F20C, 0x24C0E332B70019B0, 0x233003B5A6CFE6AD, 0xD586BD01C5C217F6,
+    0x5E5637885F29BC2B, 0x7EBA726D8C94094B, 0x0A56A5F0BFE39272, 0xD79476A84EE20D06,
+    0x9E4C1269BAA4BF37, 0x17EFEE45B0DEE640, 0x1D95B0A5FCF90BC6, 0x93CBE0B699C2585D,
+    0x65FA4F227A2B6D79, 0xD5F9E858292504D5, 0xC2B5A03F71471A6F, 0x59300222B4561E00,
+    0xCE2F8642CA0712DC, 0x7CA9723FBB2E8988, 0x2785338347F2BA08, 0xC61BB3A141E50E8C,
+    0x150F361DAB9DEC26, 0x9F6A419D382595F4, 0x64A53DC924FE7AC9, 0x142DE49FFF7A7C3D,
+    0x0C335248857FA9E7, 0x0A9C32D5EAE45305, 0xE6C42178C4BBB92E, 0x71F1CE2490D20B07,
+    0xF1BCC3D275AFE51A, 0xE728E8C83C334074, 0x96FBF83A12884624, 0x81A1549FD6573DA5,
+    0x5FA7867CAF35E149, 0x56986E2EF3ED091B, 0x917F1DD5F8886C61, 0xD20D8C88C8FFE65F,
+    0x31D71DCE64B2C310, 0xF165B587DF898190, 0xA57E6339DD2CF3A0, 0x1EF6E6DBB1961EC9,
+    0x70CC73D90BC26E24, 0xE21A6B35DF0C3AD7, 0x003A93D8B2806962, 0x1C99DED33CB890A1,
+    0xCF3145DE0ADD4289, 0xD0E4427A5514FB72, 0x77C621CC9FB3A483, 0x67A34DAC4356550B,
+    0xF8D626AAAF278509
+};
+
+// NOTE(vincent): Black Polyglot kind of each chess_piece_type, the white one is one more.
+global_variable u32 PolyglotKinds[] = {0, 0, 6, 2, 4, 8, 10};
+
+internal u64
+ComputeBookKey(chess_game_state *Game)
+{
+    // NOTE(vincent): Kept apart from ComputePositionKey(), whose keys are free to change
+    // with the transposition table. En passant only counts when a pawn of the side to move
+    // stands next to the pawn that just moved two squares, like Polyglot does.
+    u64 Key = 0;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        chess_piece *Black = Game->Blacks + i;
+        chess_piece *White = Game->Whites + i;
+        if (Black->Type != ChessPieceType_Empty)
+            Key ^= PolyglotRandom64[64*PolyglotKinds[Black->Type] + 
+                                    Black->Row*8 + Black->Column];
+        if (White->Type != ChessPieceType_Empty)
+            Key ^= PolyglotRandom64[64*(PolyglotKinds[White->Type] + 1) + 
+                                    White->Row*8 + White->Column];
+    }
+    
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *Pieces = Color ? Game->Blacks : Game->Whites;
+        if (Pieces[12].MoveCount == 0)
+        {
+            if (Pieces[15].Type == ChessPieceType_Rook && Pieces[15].MoveCount == 0)
+                Key ^= PolyglotRandom64[768 + 2*Color];
+            if (Pieces[8].Type == ChessPieceType_Rook && Pieces[8].MoveCount == 0)
+                Key ^= PolyglotRandom64[769 + 2*Color];
+        }
+    }
+    
+    if (Game->History.EntryCount > 0)
+    {
+        history_entry LastEntry = Game->History.Entries[Game->History.EntryCount-1];
+        chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+        chess_piece *Opponents = Game->BlackIsPlaying ? Game->Whites : Game->Blacks;
+        chess_piece *LastMoved = Opponents + (LastEntry.Indices & 15);
+        if (LastMoved->Type == ChessPieceType_Pawn && (LastEntry.Delta & 7) == 2)
+        {
+            for (u32 i = 0; i < 8; ++i)
+            {
+                chess_piece *Pawn = Pieces + i;
+                if (Pawn->Type == ChessPieceType_Pawn && Pawn->Row == LastMoved->Row &&
+                    (Pawn->Column == LastMoved->Column + 1 || 
+                     Pawn->Column + 1 == LastMoved->Column))
+                {
+                    Key ^= PolyglotRandom64[772 + LastMoved->Column];
+                    break;
+                }
+            }
+        }
+    }
+    
+    if (!Game->BlackIsPlaying)
+        Key ^= PolyglotRandom64[780];
+    return Key;
+}
+
+internal void
+LoadOpeningBook(opening_book *Book, char *Filename)
+{
+    memory_index Size = 0;
+    Book->Entries = (u8 *)GlobalPlatform->MapReadOnlyFile(Filename, &Size);
+    Book->EntryCount = Size / BOOK_ENTRY_SIZE;
+    if (!Book->EntryCount)
+        Book->Entries = 0;
+}
+
+internal b32
+FindBookDecision(chess_piece *Pieces, u32 Move, decision *Result)
+{
+    // NOTE(vincent): Book moves: to file in bits 0-2, to row in 3-5, from file in 6-8,
+    // from row in 9-11, promotion in 12-14. Castling is written as the king taking its own
+    // rook.
+    u32 ToColumn = Move & 7;
+    u32 ToRow = (Move >> 3) & 7;
+    u32 FromColumn = (Move >> 6) & 7;
+    u32 FromRow = (Move >> 9) & 7;
+    u32 Promotion = (Move >> 12) & 7;
+    
+    chess_piece *King = Pieces + 12;
+    if (King->Type == ChessPieceType_King && King->MoveCount == 0 &&
+        King->Row == FromRow && King->Column == FromColumn && ToRow == FromRow)
+    {
+        if (ToColumn == 7)
+            ToColumn = 6;
+        else if (ToColumn == 0)
+            ToColumn = 2;
+    }
+    
+    b32 Found = FindDecision(Pieces, FromRow*8 + FromColumn, ToRow | (ToColumn << 3), Result);
+    if (Found && Result->PromotionType != ChessPieceType_Empty)
+    {
+        switch (Promotion)
+        {
+            case 1: Result->PromotionType = ChessPieceType_Knight; break;
+            case 2: Result->PromotionType = ChessPieceType_Bishop; break;
+            case 3: Result->PromotionType = ChessPieceType_Rook; break;
+            default: Result->PromotionType = ChessPieceType_Queen; break;
+        }
+    }
+    return Found;
+}
+
+internal b32
+LookUpBookDecision(opening_book *Book, chess_game_state *Game, u32 MaxDepth, 
+                   random_series *Series, decision *Result)
+{
+    // NOTE(vincent): Picks one of the book moves of this position at random, weighted by
+    // the weights of the entries. Moves that aren't legal here (key collisions) are skipped.
+    b32 Found = false;
+    u32 LastDepth = ArrayCount(BookPliesBySearchDepth) - 1;
+    u32 BookPlies = BookPliesBySearchDepth[MaxDepth < LastDepth ? MaxDepth : LastDepth];
+    if (Book && Book->Entries && Game->CurrentEntryIndex < BookPlies)
+    {
+        u64 Key = ComputeBookKey(Game);
+        chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+        UpdateDestinations(Game);
+        
+        // NOTE(vincent): First entry with this key.
+        u64 Low = 0;
+        u64 High = Book->EntryCount;
+        while (Low < High)
+        {
+            u64 Middle = Low + (High - Low) / 2;
+            if (ReadBigEndianU64(Book->Entries + Middle*BOOK_ENTRY_SIZE) < Key)
+                Low = Middle + 1;
+            else
+                High = Middle;
+        }
+        
+        u32 TotalWeight = 0;
+        for (u64 EntryIndex = Low; EntryIndex < Book->EntryCount; ++EntryIndex)
+        {
+            u8 *Entry = Book->Entries + EntryIndex*BOOK_ENTRY_SIZE;
+            if (ReadBigEndianU64(Entry) != Key)
+                break;
+            
+            // NOTE(vincent): Single pass weighted choice: each candidate replaces the one
+            // we have with probability Weight / TotalWeight so far.
+            decision Candidate = {};
+            u32 Weight = ReadBigEndianU16(Entry + 10);
+            if (Weight && FindBookDecision(Pieces, ReadBigEndianU16(Entry + 8), &Candidate))
+            {
+                TotalWeight += Weight;
+                if (RandomU32(Series, 1, TotalWeight) <= Weight)
+                {
+                    *Result = Candidate;
+                    Found = true;
+                }
+            }
+        }
+    }
+    return Found;
+}
+
+// NOTE(vincent): Endgame tables. Positions with few enough pieces get their exact
+// win/draw/loss value from a table instead of being searched. Tables are found by the
+// material on the board, in both color orientations.
+#define ENDGAME_TABLE_SLOT_COUNT 4096
+
+// NOTE(vincent): Value of a table win whose distance to mate we don't know. Above any
+// heuristic value, below the checkmate values, and decreasing with the ply so that the
+// search still prefers to get there sooner.
+#define ENDGAME_WIN_VALUE 4000
+#define MAX_ENDGAME_PLY 512  // ply + distance to mate, bitbase distances stay below 255
+
+// NOTE(vincent): Bitbases are the small endgames we generate ourselves, by retrograde 
+// analysis (see GenerateBitbases()). They are listed in dependency order: the tables that
+// captures and promotions lead to come first.
+#define BITBASE_FILENAME "chess_bitbases"
+#define BITBASE_MAX_PIECES 4
+global_variable char *BitbaseNames[] = 
+{
+    "KQvK", "KRvK", "KPvK", "KRvKN", "KRvKB", "KRvKR", "KRvKQ", "KRvKP",
+};
+
+struct bitbase_layout
+{
+    // NOTE(vincent): Pieces in index order: the white king, the black king, then the others
+    // in the order of the name. Colors are 0 for white, 1 for black.
+    u32 PieceCount;
+    u32 Colors[BITBASE_MAX_PIECES];
+    chess_piece_type Types[BITBASE_MAX_PIECES];
+    b32 HasPawns;
+    u64 PositionsPerSide;
+};
+
+struct endgame_table
+{
+    u64 MaterialCode;  // 0 for a free slot
+    b32 CanProbe;
+    b32 ColorsSwapped;  // the table's white pieces are our black ones
+    
+    // NOTE(vincent): One byte per position, see BitbaseIndex().
+    u8 *Values;
+    bitbase_layout *Layout;
+};
+
+struct endgame_tables
+{
+    endgame_table Slots[ENDGAME_TABLE_SLOT_COUNT];
+    u32 TableCount;
+    u32 MaxPieceCount;  // of the tables we can probe, 0 if there are none
+    bitbase_layout BitbaseLayouts[ArrayCount(BitbaseNames)];
+};
+
+struct endgame_probe
+{
+    s32 WDL;             // for the side to move: 1 win, 0 draw, -1 loss
+    b32 KnowsDistance;
+    u32 DistanceToMate;  // in plies, when KnowsDistance
+};
+
+// NOTE(vincent): Order of the piece types in material codes.
+global_variable chess_piece_type EndgamePieceTypes[] = 
+{
+    ChessPieceType_Queen, ChessPieceType_Rook, ChessPieceType_Bishop,
+    ChessPieceType_Knight, ChessPieceType_Pawn,
+};
+global_variable char EndgamePieceLetters[] = "QRBNP";
+
+internal u64
+MaterialCode(u32 *WhiteCounts, u32 *BlackCounts)
+{
+    // NOTE(vincent): Counts of each piece type but the king, 4 bits each, white first.
+    // Always non-zero, thanks to the marker bit.
+    u64 Result = 1ULL << 40;
+    for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+    {
+        Result |= (u64)(WhiteCounts[TypeIndex] & 15) << (4*TypeIndex);
+        Result |= (u64)(BlackCounts[TypeIndex] & 15) << (4*TypeIndex + 20);
+    }
+    return Result;
+}
+
+internal u32
+CountMaterial(chess_piece *Pieces, u32 *Counts)
+{
+    // NOTE(vincent): Returns the number of pieces, king included.
+    u32 Result = 0;
+    for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+        Counts[TypeIndex] = 0;
+    for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+    {
+        chess_piece_type Type = Pieces[PieceIndex].Type;
+        if (Type != ChessPieceType_Empty)
+            ++Result;
+        for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+        {
+            if (Type == EndgamePieceTypes[TypeIndex])
+                Counts[TypeIndex]++;
+        }
+    }
+    return Result;
+}
+
+internal endgame_table *
+FindEndgameTable(endgame_tables *Tables, u64 Code, b32 ForInsertion)
+{
+    // NOTE(vincent): Open addressing. Returns the slot for Code, or 0 if it isn't there
+    // (when ForInsertion, the free slot where it would go).
+    endgame_table *Result = 0;
+    u32 SlotIndex = (u32)((Code * 0x9E3779B97F4A7C15ULL) >> 52) & (ENDGAME_TABLE_SLOT_COUNT - 1);
+    for (u32 Probe = 0; Probe < ENDGAME_TABLE_SLOT_COUNT; ++Probe)
+    {
+        endgame_table *Slot = Tables->Slots + SlotIndex;
+        if (Slot->MaterialCode == Code)
+        {
+            Result = Slot;
+            break;
+        }
+        if (Slot->MaterialCode == 0)
+        {
+            if (ForInsertion)
+                Result = Slot;
+            break;
+        }
+        SlotIndex = (SlotIndex + 1) & (ENDGAME_TABLE_SLOT_COUNT - 1);
+    }
+    return Result;
+}
+
+internal void
+AddEndgameTable(endgame_tables *Tables, endgame_table *Table, u32 *WhiteCounts, 
+                u32 *BlackCounts, u32 PieceCount)
+{
+    // NOTE(vincent): Goes in twice: as is, and with the colors swapped.
+    for (u32 Swapped = 0; Swapped < 2; ++Swapped)
+    {
+        u64 Code = Swapped ? MaterialCode(BlackCounts, WhiteCounts) : 
+            MaterialCode(WhiteCounts, BlackCounts);
+        endgame_table *Slot = FindEndgameTable(Tables, Code, true);
+        if (Slot && (Slot->MaterialCode == 0 || (!Slot->CanProbe && Table->CanProbe)))
+        {
+            // NOTE(vincent): A table we can probe replaces one we can't. Bitbases come in
+            // while searches are probing, so a slot only shows up (or becomes probeable)
+            // once the rest of it is written.
+            if (Slot->MaterialCode == 0)
+                Tables->TableCount++;
+            Slot->CanProbe = false;
+            CompilerWriteBarrier;
+            Slot->ColorsSwapped = Swapped;
+            Slot->Values = Table->Values;
+            Slot->Layout = Table->Layout;
+            CompilerWriteBarrier;
+            Slot->MaterialCode = Code;
+            CompilerWriteBarrier;
+            Slot->CanProbe = Table->CanProbe;
+        }
+    }
+    CompilerWriteBarrier;
+    if (Table->CanProbe && PieceCount > Tables->MaxPieceCount)
+        Tables->MaxPieceCount = PieceCount;
+}
+
+internal u32
+AppendString(char *Dest, u32 At, u32 Capacity, char *Source)
+{
+    while (*Source && At + 1 < Capacity)
+        Dest[At++] = *Source++;
+    Dest[At] = 0;
+    return At;
+}
+
+internal void
+InitializeEndgameTables(endgame_tables *Tables)
+{
+    ZeroBytes((u8 *)Tables, sizeof(endgame_tables));
+}
+
+// NOTE(vincent): Bitbases. Every position of a bitbase's material gets its distance to
+// mate in plies, or a draw, by retrograde analysis: mates first, then the positions one
+// move away from them, and so on. Values are 0 for a draw, DistanceToMate + 1 otherwise;
+// the side to move wins when that distance is odd (it gets to deliver the mate).
+#define BITBASE_MAGIC 0x3145534142544942ULL  // "BITBASE1"
+#define BITBASE_ILLEGAL 255                  // only while generating
+#define BITBASE_MAX_MOVES 128
+#define BITBASE_JOB_COUNT 64
+
+struct bitbase_file_entry
+{
+    char Name[16];
+    u64 Offset;
+    u64 Size;
+};
+
+struct bitbase_file_header
+{
+    u64 Magic;  // written last, so that an interrupted generation leaves an invalid file
+    u32 TableCount;
+    u32 Padding;
+    bitbase_file_entry Tables[ArrayCount(BitbaseNames)];
+};
+
+struct bitbase_position
+{
+    u32 PieceCount;
+    u32 Colors[BITBASE_MAX_PIECES];
+    chess_piece_type Types[BITBASE_MAX_PIECES];
+    u32 Squares[BITBASE_MAX_PIECES];  // Row*8 + Column
+    u32 SideToMove;
+    u8 Board[64];                     // piece index + 1, 0 for an empty square
+};
+
+struct bitbase_move
+{
+    u32 PieceIndex;
+    u32 To;
+    chess_piece_type Promotion;  // Empty when the piece stays what it is
+};
+
+enum bitbase_phase
+{
+    BitbasePhase_Initialize,  // illegal positions, mates, and where captures lead
+    BitbasePhase_Push,        // flags the predecessors of the positions resolved at Level
+    BitbasePhase_Pull,        // resolves the flagged positions at Level + 1
+    BitbasePhase_Finalize,    // illegal positions become 0, like draws
+};
+
+struct bitbase_job
+{
+    bitbase_generator *Generator;
+    u64 Begin;
+    u64 End;
+    u32 ResolvedCount;
+    u32 MaxRevisit;
+};
+
+struct bitbase_generator
+{
+    b32 volatile Finished;
+    u8 *File;  // 0 if the generation failed
+    memory_index FileSize;
+    
+    // NOTE(vincent): What the jobs of the current phase share.
+    bitbase_phase Phase;
+    s32 Level;
+    bitbase_layout *Layout;
+    u8 *Values;
+    u8 *Flags;    // some successor got resolved since the position was last looked at
+    u8 *Revisit;  // level + 1 at which a capture or a promotion decides the position
+    endgame_tables *Tables;  // the bitbases generated so far
+    bitbase_job Jobs[BITBASE_JOB_COUNT];
+};
+
+global_variable u32 BitbaseTriangleSquares[] = {0, 1, 2, 3, 9, 10, 11, 18, 19, 27};
+global_variable u32 BitbaseTriangleRowStarts[] = {0, 4, 7, 9};
+
+internal s32
+EndgamePieceTypeIndex(chess_piece_type Type)
+{
+    s32 Result = -1;
+    for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+    {
+        if (EndgamePieceTypes[TypeIndex] == Type)
+            Result = (s32)TypeIndex;
+    }
+    return Result;
+}
+
+internal u32
+ParseBitbaseLayout(char *Name, bitbase_layout *Layout, u32 *WhiteCounts, u32 *BlackCounts)
+{
+    // NOTE(vincent): Names look like "KRvKP". Returns the number of pieces.
+    for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+    {
+        WhiteCounts[TypeIndex] = 0;
+        BlackCounts[TypeIndex] = 0;
+    }
+    Layout->PieceCount = 2;
+    Layout->Colors[0] = 0;
+    Layout->Colors[1] = 1;
+    Layout->Types[0] = ChessPieceType_King;
+    Layout->Types[1] = ChessPieceType_King;
+    Layout->HasPawns = false;
+    
+    u32 Color = 0;
+    for (char *At = Name; *At; ++At)
+    {
+        if (*At == 'v')
+            Color = 1;
+        for (u32 TypeIndex = 0; TypeIndex < ArrayCount(EndgamePieceTypes); ++TypeIndex)
+        {
+            if (*At == EndgamePieceLetters[TypeIndex] &&
+                Layout->PieceCount < BITBASE_MAX_PIECES)
+            {
+                Layout->Colors[Layout->PieceCount] = Color;
+                Layout->Types[Layout->PieceCount] = EndgamePieceTypes[TypeIndex];
+                Layout->PieceCount++;
+                if (Color)
+                    BlackCounts[TypeIndex]++;
+                else
+                    WhiteCounts[TypeIndex]++;
+                if (EndgamePieceTypes[TypeIndex] == ChessPieceType_Pawn)
+                    Layout->HasPawns = true;
+            }
+        }
+    }
+    
+    // NOTE(vincent): The white king has 32 squares (files a-d) with pawns, 10 without.
+    Layout->PositionsPerSide = Layout->HasPawns ? 32 : 10;
+    for (u32 PieceIndex = 1; PieceIndex < Layout->PieceCount; ++PieceIndex)
+        Layout->PositionsPerSide *= 64;
+    return Layout->PieceCount;
+}
+
+internal u64
+BitbaseIndex(bitbase_layout *Layout, u32 *Squares, u32 SideToMove)
+{
+    // NOTE(vincent): Positions get mirrored so that the white king ends up on files a-d,
+    // and without pawns, in the a1-d1-d4 triangle. Flipping bits 0-2 of a square flips
+    // its column, bits 3-5 its row.
+    u32 King = Squares[0];
+    u32 Flip = ((King & 7) > 3) ? 7 : 0;
+    if (!Layout->HasPawns && (King >> 3) > 3)
+        Flip |= 56;
+    King ^= Flip;
+    b32 Transpose = (!Layout->HasPawns && (King >> 3) > (King & 7));
+    
+    u64 Result = 0;
+    for (u32 PieceIndex = 0; PieceIndex < Layout->PieceCount; ++PieceIndex)
+    {
+        u32 Square = Squares[PieceIndex] ^ Flip;
+        if (Transpose)
+            Square = ((Square & 7) << 3) | (Square >> 3);
+        if (PieceIndex == 0)
+        {
+            u32 Row = Square >> 3;
+            u32 Column = Square & 7;
+            Result = Layout->HasPawns ? (Row*4 + Column) :
+                (BitbaseTriangleRowStarts[Row] + Column - Row);
+        }
+        else
+            Result = Result*64 + Square;
+    }
+    Result += SideToMove*Layout->PositionsPerSide;
+    return Result;
+}
+
+internal void
+DecodeBitbaseIndex(bitbase_layout *Layout, u64 Index, u32 *Squares, u32 *SideToMove)
+{
+    *SideToMove = (u32)(Index / Layout->PositionsPerSide);
+    Index %= Layout->PositionsPerSide;
+    for (u32 PieceIndex = Layout->PieceCount - 1; PieceIndex > 0; --PieceIndex)
+    {
+        Squares[PieceIndex] = (u32)(Index & 63);
+        Index >>= 6;
+    }
+    Squares[0] = Layout->HasPawns ? (u32)((Index / 4)*8 + Index % 4) :
+        BitbaseTriangleSquares[Index];
+}
+
+internal void
+FillBitbaseBoard(bitbase_position *Position)
+{
+    ZeroBytes(Position->Board, sizeof(Position->Board));
+    for (u32 PieceIndex = 0; PieceIndex < Position->PieceCount; ++PieceIndex)
+        Position->Board[Position->Squares[PieceIndex]] = (u8)(PieceIndex + 1);
+}
+
+internal b32
+BitbaseSquareAttacked(bitbase_position *Position, u32 Target, u32 ByColor)
+{
+    u64 Occupied = 0;
+    for (u32 PieceIndex = 0; PieceIndex < Position->PieceCount; ++PieceIndex)
+        Occupied |= (u64)1 << Position->Squares[PieceIndex];
+    
+    b32 Result = false;
+    for (u32 PieceIndex = 0; PieceIndex < Position->PieceCount && !Result; ++PieceIndex)
+    {
+        if (Position->Colors[PieceIndex] == ByColor)
+        {
+            Result = PieceAttacksSquare(Position->Types[PieceIndex], ByColor == 0, 
+                                        Position->Squares[PieceIndex], Target, Occupied);
+        }
+    }
+    return Result;
+}
+
+internal u32
+AddBitbasePawnMove(bitbase_move *Moves, u32 Count, u32 PieceIndex, u32 To)
+{
+    // NOTE(vincent): Reaching the last row means one move per promotion.
+    u32 Row = To >> 3;
+    if (Row == 0 || Row == 7)
+    {
+        chess_piece_type Promotions[] =
+        {
+            ChessPieceType_Queen, ChessPieceType_Rook, ChessPieceType_Bishop,
+            ChessPieceType_Knight,
+        };
+        for (u32 i = 0; i < ArrayCount(Promotions); ++i)
+            Moves[Count++] = {PieceIndex, To, Promotions[i]};
+    }
+    else
+        Moves[Count++] = {PieceIndex, To, ChessPieceType_Empty};
+    return Count;
+}
+
+internal u32
+GenerateBitbaseMoves(bitbase_position *Position, u32 Color, b32 Unmoves, bitbase_move *Moves)
+{
+    // NOTE(vincent): Pseudo-legal moves of Color's pieces. Unmoves are the moves that could
+    // have led to the position without changing its material: no captures, no promotions,
+    // and pawns going backwards.
+    u32 Count = 0;
+    for (u32 PieceIndex = 0; PieceIndex < Position->PieceCount; ++PieceIndex)
+    {
+        if (Position->Colors[PieceIndex] != Color)
+            continue;
+        s32 Row = (s32)(Position->Squares[PieceIndex] >> 3);
+        s32 Column = (s32)(Position->Squares[PieceIndex] & 7);
+        chess_piece_type Type = Position->Types[PieceIndex];
+        
+        if (Type == ChessPieceType_Pawn)
+        {
+            s32 Forward = Color ? -1 : 1;
+            s32 StartRow = Color ? 6 : 1;
+            if (Unmoves)
+            {
+                s32 From = Row - Forward;
+                if (From >= 1 && From <= 6 && !Position->Board[From*8 + Column])
+                {
+                    Moves[Count++] = {PieceIndex, (u32)(From*8 + Column), ChessPieceType_Empty};
+                    if (Row == StartRow + 2*Forward && !Position->Board[StartRow*8 + Column])
+                    {
+                        Moves[Count++] = {PieceIndex, (u32)(StartRow*8 + Column),
+                            ChessPieceType_Empty};
+                    }
+                }
+            }
+            else
+            {
+                s32 To = Row + Forward;
+                if (!Position->Board[To*8 + Column])
+                {
+                    Count = AddBitbasePawnMove(Moves, Count, PieceIndex, (u32)(To*8 + Column));
+                    if (Row == StartRow && !Position->Board[(To + Forward)*8 + Column])
+                    {
+                        Moves[Count++] = {PieceIndex, (u32)((To + Forward)*8 + Column),
+                            ChessPieceType_Empty};
+                    }
+                }
+                for (s32 Side = -1; Side <= 1; Side += 2)
+                {
+                    s32 ToColumn = Column + Side;
+                    if (ToColumn < 0 || ToColumn > 7)
+                        continue;
+                    u32 Occupant = Position->Board[To*8 + ToColumn];
+                    if (Occupant && Position->Colors[Occupant - 1] != Color &&
+                        Position->Types[Occupant - 1] != ChessPieceType_King)
+                    {
+                        Count = AddBitbasePawnMove(Moves, Count, PieceIndex,
+                                                   (u32)(To*8 + ToColumn));
+                    }
+                }
+            }
+            continue;
+        }
+        
+        const s32 (*Steps)[2] = (Type == ChessPieceType_Knight) ? KnightJumps : KingSteps;
+        b32 Slides = (Type == ChessPieceType_Rook || Type == ChessPieceType_Bishop ||
+                      Type == ChessPieceType_Queen);
+        for (u32 StepIndex = 0; StepIndex < 8; ++StepIndex)
+        {
+            if ((Type == ChessPieceType_Rook && (StepIndex & 1)) ||
+                (Type == ChessPieceType_Bishop && !(StepIndex & 1)))
+            {
+                continue;
+            }
+            s32 ToRow = Row;
+            s32 ToColumn = Column;
+            for (;;)
+            {
+                ToRow += Steps[StepIndex][0];
+                ToColumn += Steps[StepIndex][1];
+                if (ToRow < 0 || ToRow > 7 || ToColumn < 0 || ToColumn > 7)
+                    break;
+                u32 To = (u32)(ToRow*8 + ToColumn);
+                u32 Occupant = Position->Board[To];
+                if (Occupant)
+                {
+                    if (!Unmoves && Position->Colors[Occupant - 1] != Color &&
+                        Position->Types[Occupant - 1] != ChessPieceType_King)
+                    {
+                        Moves[Count++] = {PieceIndex, To, ChessPieceType_Empty};
+                    }
+                    break;
+                }
+                Moves[Count++] = {PieceIndex, To, ChessPieceType_Empty};
+                if (!Slides)
+                    break;
+            }
+        }
+    }
+    Assert(Count <= BITBASE_MAX_MOVES);
+    return Count;
+}
+
+internal b32
+ApplyBitbaseMove(bitbase_position *Source, bitbase_move *Move, bitbase_position *Dest)
+{
+    // NOTE(vincent): Returns true when the material changes, which takes the position to
+    // another table. Kings are never captured, so they stay at indices 0 and 1.
+    *Dest = *Source;
+    u32 PieceIndex = Move->PieceIndex;
+    b32 Result = false;
+    u32 Occupant = Source->Board[Move->To];
+    if (Occupant)
+    {
+        for (u32 i = Occupant - 1; i + 1 < Dest->PieceCount; ++i)
+        {
+            Dest->Colors[i] = Dest->Colors[i + 1];
+            Dest->Types[i] = Dest->Types[i + 1];
+            Dest->Squares[i] = Dest->Squares[i + 1];
+        }
+        Dest->PieceCount--;
+        if (PieceIndex > Occupant - 1)
+            PieceIndex--;
+        Result = true;
+    }
+    if (Move->Promotion != ChessPieceType_Empty)
+    {
+        Dest->Types[PieceIndex] = Move->Promotion;
+        Result = true;
+    }
+    Dest->Squares[PieceIndex] = Move->To;
+    Dest->SideToMove ^= 1;
+    FillBitbaseBoard(Dest);
+    return Result;
+}
+
+internal b32
+LookUpBitbase(endgame_tables *Tables, bitbase_position *Position, u8 *Value)
+{
+    // NOTE(vincent): Bare kings, and a lone minor piece, can't mate: those are draws
+    // without a table.
+    u32 WhiteCounts[ArrayCount(EndgamePieceTypes)] = {};
+    u32 BlackCounts[ArrayCount(EndgamePieceTypes)] = {};
+    b32 CanMate = false;
+    for (u32 PieceIndex = 2; PieceIndex < Position->PieceCount; ++PieceIndex)
+    {
+        s32 TypeIndex = EndgamePieceTypeIndex(Position->Types[PieceIndex]);
+        if (TypeIndex < 0)
+            return false;
+        if (Position->Colors[PieceIndex])
+            BlackCounts[TypeIndex]++;
+        else
+            WhiteCounts[TypeIndex]++;
+        if (Position->PieceCount > 3 || (Position->Types[PieceIndex] != ChessPieceType_Bishop &&
+                                         Position->Types[PieceIndex] != ChessPieceType_Knight))
+        {
+            CanMate = true;
+        }
+    }
+    if (!CanMate)
+    {
+        *Value = 0;
+        return true;
+    }
+    
+    b32 Found = false;
+    endgame_table *Table = FindEndgameTable(Tables, MaterialCode(WhiteCounts, BlackCounts), false);
+    if (Table && Table->CanProbe)
+    {
+        // NOTE(vincent): Matches our pieces with the table's. With the colors swapped, the
+        // board also gets flipped so that pawns keep going the right way.
+        bitbase_layout *Layout = Table->Layout;
+        u32 Swap = Table->ColorsSwapped ? 1 : 0;
+        u32 Squares[BITBASE_MAX_PIECES];
+        u32 Used = 0;
+        for (u32 TableIndex = 0; TableIndex < Layout->PieceCount; ++TableIndex)
+        {
+            for (u32 PieceIndex = 0; PieceIndex < Position->PieceCount; ++PieceIndex)
+            {
+                if (!(Used & (1 << PieceIndex)) &&
+                    Position->Colors[PieceIndex] == (Layout->Colors[TableIndex] ^ Swap) &&
+                    Position->Types[PieceIndex] == Layout->Types[TableIndex])
+                {
+                    Used |= (1 << PieceIndex);
+                    Squares[TableIndex] = Position->Squares[PieceIndex] ^ (Swap ? 56 : 0);
+                    break;
+                }
+            }
+        }
+        *Value = Table->Values[BitbaseIndex(Layout, Squares, Position->SideToMove ^ Swap)];
+        Found = true;
+    }
+    return Found;
+}
+
+internal void
+EvaluateBitbasePosition(bitbase_generator *Generator, bitbase_job *Job, u64 Index,
+                        bitbase_position *Position)
+{
+    // NOTE(vincent): Resolves the position at Level + 1 if its successors now allow it.
+    // Successors in this table only count once resolved at Level or below, which the
+    // other jobs of the phase don't change. Captures and promotions lead to tables that
+    // are already done.
+    s32 Level = Generator->Level;
+    u32 Mover = Position->SideToMove;
+    bitbase_move Moves[BITBASE_MAX_MOVES];
+    u32 MoveCount = GenerateBitbaseMoves(Position, Mover, false, Moves);
+    u32 LegalCount = 0;
+    u32 MinWin = 0xFFFF;   // shortest mate we can deliver
+    u32 MaxLoss = 0;       // longest we can hold out when all moves lose
+    b32 AllLose = true;
+    for (u32 MoveIndex = 0; MoveIndex < MoveCount; ++MoveIndex)
+    {
+        bitbase_position Child;
+        b32 LeavesTable = ApplyBitbaseMove(Position, Moves + MoveIndex, &Child);
+        if (BitbaseSquareAttacked(&Child, Child.Squares[Mover], Mover ^ 1))
+            continue;
+        ++LegalCount;
+        
+        u32 Value = 0;
+        if (LeavesTable)
+        {
+            u8 TableValue = 0;
+            LookUpBitbase(Generator->Tables, &Child, &TableValue);
+            Value = TableValue;
+        }
+        else
+        {
+            Value = Generator->Values[BitbaseIndex(Generator->Layout, Child.Squares,
+                                                   Child.SideToMove)];
+            if ((s32)Value > Level + 1)
+                Value = 0;
+        }
+        
+        if (Value == 0)
+            AllLose = false;
+        else if ((Value - 1) & 1)
+        {
+            if (Value > MaxLoss)
+                MaxLoss = Value;
+        }
+        else if (Value < MinWin)
+            MinWin = Value;
+    }
+    
+    if (LegalCount == 0)
+    {
+        if (Level < 0 && BitbaseSquareAttacked(Position, Position->Squares[Mover], Mover ^ 1))
+            Generator->Values[Index] = 1;
+        return;
+    }
+    
+    // NOTE(vincent): A successor's value is its distance + 1, so MinWin and MaxLoss are
+    // already our own distance.
+    u32 Distance = 0;
+    if (MinWin != 0xFFFF)
+        Distance = MinWin;
+    else if (AllLose)
+        Distance = MaxLoss;
+    if (Distance)
+    {
+        Assert(Distance < BITBASE_ILLEGAL - 1);
+        if ((s32)Distance <= Level + 1)
+        {
+            Generator->Values[Index] = (u8)(Distance + 1);
+            Job->ResolvedCount++;
+        }
+        else
+        {
+            Generator->Revisit[Index] = (u8)Distance;
+            if (Distance > Job->MaxRevisit)
+                Job->MaxRevisit = Distance;
+        }
+    }
+}
+
+internal
+PLATFORM_WORK_QUEUE_CALLBACK(RunBitbaseJob)
+{
+    bitbase_job *Job = (bitbase_job *)Data;
+    bitbase_generator *Generator = Job->Generator;
+    bitbase_layout *Layout = Generator->Layout;
+    u8 *Values = Generator->Values;
+    s32 Level = Generator->Level;
+    for (u64 Index = Job->Begin; Index < Job->End; ++Index)
+    {
+        b32 Wanted = false;
+        switch (Generator->Phase)
+        {
+            case BitbasePhase_Initialize: Wanted = true; break;
+            case BitbasePhase_Push: Wanted = (Values[Index] == Level + 1); break;
+            case BitbasePhase_Pull:
+            {
+                Wanted = (Values[Index] == 0 &&
+                          (Generator->Flags[Index] || Generator->Revisit[Index] == Level + 1));
+            } break;
+            case BitbasePhase_Finalize:
+            {
+                if (Values[Index] == BITBASE_ILLEGAL)
+                    Values[Index] = 0;
+            } break;
+        }
+        if (!Wanted)
+            continue;
+        
+        bitbase_position Position;
+        Position.PieceCount = Layout->PieceCount;
+        for (u32 PieceIndex = 0; PieceIndex < Layout->PieceCount; ++PieceIndex)
+        {
+            Position.Colors[PieceIndex] = Layout->Colors[PieceIndex];
+            Position.Types[PieceIndex] = Layout->Types[PieceIndex];
+        }
+        DecodeBitbaseIndex(Layout, Index, Position.Squares, &Position.SideToMove);
+        FillBitbaseBoard(&Position);
+        
+        if (Generator->Phase == BitbasePhase_Initialize)
+        {
+            // NOTE(vincent): Illegal: pieces on top of each other, pawns on the first or
+            // last row, or the side that just moved still in check.
+            b32 Legal = true;
+            for (u32 PieceIndex = 0; PieceIndex < Layout->PieceCount; ++PieceIndex)
+            {
+                u32 Square = Position.Squares[PieceIndex];
+                if (Position.Board[Square] != PieceIndex + 1 ||
+                    (Position.Types[PieceIndex] == ChessPieceType_Pawn &&
+                     ((Square >> 3) == 0 || (Square >> 3) == 7)))
+                {
+                    Legal = false;
+                }
+            }
+            u32 Waiting = Position.SideToMove ^ 1;
+            if (Legal && BitbaseSquareAttacked(&Position, Position.Squares[Waiting],
+                                               Position.SideToMove))
+            {
+                Legal = false;
+            }
+            Values[Index] = Legal ? 0 : BITBASE_ILLEGAL;
+            Generator->Flags[Index] = 0;
+            Generator->Revisit[Index] = 0;
+            if (Legal)
+                EvaluateBitbasePosition(Generator, Job, Index, &Position);
+        }
+        else if (Generator->Phase == BitbasePhase_Push)
+        {
+            // NOTE(vincent): Setting a flag that may already be set, from several jobs at
+            // once, is fine: they all write 1.
+            u32 Mover = Position.SideToMove ^ 1;
+            bitbase_move Moves[BITBASE_MAX_MOVES];
+            u32 MoveCount = GenerateBitbaseMoves(&Position, Mover, true, Moves);
+            for (u32 MoveIndex = 0; MoveIndex < MoveCount; ++MoveIndex)
+            {
+                u32 Squares[BITBASE_MAX_PIECES];
+                for (u32 PieceIndex = 0; PieceIndex < Layout->PieceCount; ++PieceIndex)
+                    Squares[PieceIndex] = Position.Squares[PieceIndex];
+                Squares[Moves[MoveIndex].PieceIndex] = Moves[MoveIndex].To;
+                Generator->Flags[BitbaseIndex(Layout, Squares, Mover)] = 1;
+                if (!Layout->HasPawns)
+                {
+                    // NOTE(vincent): With the white king on the a1-h8 diagonal, a position
+                    // and its mirror image along it both have an index. Flag both.
+                    for (u32 PieceIndex = 0; PieceIndex < Layout->PieceCount; ++PieceIndex)
+                    {
+                        u32 Square = Squares[PieceIndex];
+                        Squares[PieceIndex] = ((Square & 7) << 3) | (Square >> 3);
+                    }
+                    Generator->Flags[BitbaseIndex(Layout, Squares, Mover)] = 1;
+                }
+            }
+        }
+        else
+        {
+            Generator->Flags[Index] = 0;
+            EvaluateBitbasePosition(Generator, Job, Index, &Position);
+        }
+    }
+}
+
+internal void
+RunBitbasePhase(platform_work_queue *Queue, bitbase_generator *Generator, bitbase_phase Phase,
+                s32 Level, u32 *ResolvedCount, u32 *MaxRevisit)
+{
+    Generator->Phase = Phase;
+    Generator->Level = Level;
+    u64 IndexCount = 2*Generator->Layout->PositionsPerSide;
+    platform_work_handle Handle = {};
+    for (u32 JobIndex = 0; JobIndex < BITBASE_JOB_COUNT; ++JobIndex)
+    {
+        bitbase_job *Job = Generator->Jobs + JobIndex;
+        Job->Generator = Generator;
+        Job->Begin = IndexCount*JobIndex / BITBASE_JOB_COUNT;
+        Job->End = IndexCount*(JobIndex + 1) / BITBASE_JOB_COUNT;
+        Job->ResolvedCount = 0;
+        Job->MaxRevisit = 0;
+        GlobalPlatform->AddEntry(Queue, RunBitbaseJob, Job, &Handle, 
+                                 PlatformWorkPriority_Background, 0);
+    }
+    GlobalPlatform->CompleteWork(Queue, &Handle);
+    
+    for (u32 JobIndex = 0; JobIndex < BITBASE_JOB_COUNT; ++JobIndex)
+    {
+        bitbase_job *Job = Generator->Jobs + JobIndex;
+        *ResolvedCount += Job->ResolvedCount;
+        if (Job->MaxRevisit > *MaxRevisit)
+            *MaxRevisit = Job->MaxRevisit;
+    }
+}
+
+internal void
+AddBitbaseTable(endgame_tables *Tables, u32 TableIndex, u8 *Values)
+{
+    u32 WhiteCounts[ArrayCount(EndgamePieceTypes)];
+    u32 BlackCounts[ArrayCount(EndgamePieceTypes)];
+    bitbase_layout *Layout = Tables->BitbaseLayouts + TableIndex;
+    u32 PieceCount = ParseBitbaseLayout(BitbaseNames[TableIndex], Layout, WhiteCounts, 
+                                        BlackCounts);
+    endgame_table Table = {};
+    Table.CanProbe = true;
+    Table.Values = Values;
+    Table.Layout = Layout;
+    AddEndgameTable(Tables, &Table, WhiteCounts, BlackCounts, PieceCount);
+}
+
+internal b32
+LoadBitbases(endgame_tables *Tables, u8 *File, memory_index FileSize)
+{
+    // NOTE(vincent): Takes all the tables of a finished bitbase file, or none of them.
+    bitbase_file_header *Header = (bitbase_file_header *)File;
+    b32 Valid = (File && FileSize >= sizeof(bitbase_file_header) && 
+                 Header->Magic == BITBASE_MAGIC && 
+                 Header->TableCount == ArrayCount(BitbaseNames));
+    for (u32 TableIndex = 0; Valid && TableIndex < ArrayCount(BitbaseNames); ++TableIndex)
+    {
+        bitbase_file_entry *Entry = Header->Tables + TableIndex;
+        bitbase_layout Layout;
+        u32 WhiteCounts[ArrayCount(EndgamePieceTypes)];
+        u32 BlackCounts[ArrayCount(EndgamePieceTypes)];
+        ParseBitbaseLayout(BitbaseNames[TableIndex], &Layout, WhiteCounts, BlackCounts);
+        char *Name = BitbaseNames[TableIndex];
+        u32 Length = 0;
+        while (Name[Length] && Entry->Name[Length] == Name[Length])
+            ++Length;
+        Valid = (Name[Length] == 0 && Entry->Name[Length] == 0 &&
+                 Entry->Size == 2*Layout.PositionsPerSide &&
+                 Entry->Offset >= sizeof(bitbase_file_header) &&
+                 Entry->Offset + Entry->Size <= FileSize);
+    }
+    if (Valid)
+    {
+        for (u32 TableIndex = 0; TableIndex < ArrayCount(BitbaseNames); ++TableIndex)
+            AddBitbaseTable(Tables, TableIndex, File + Header->Tables[TableIndex].Offset);
+    }
+    return Valid;
+}
+
+internal
+PLATFORM_WORK_QUEUE_CALLBACK(GenerateBitbases)
+{
+    // NOTE(vincent): Runs as one long background entry, that splits each phase of each
+    // table into jobs for the other threads and helps with them while it waits. Tables
+    // get written straight into the mapped file.
+    bitbase_generator *Generator = (bitbase_generator *)Data;
+    memory_index FileSize = sizeof(bitbase_file_header);
+    memory_index LargestTable = 0;
+    for (u32 TableIndex = 0; TableIndex < ArrayCount(BitbaseNames); ++TableIndex)
+    {
+        bitbase_layout Layout;
+        u32 WhiteCounts[ArrayCount(EndgamePieceTypes)];
+        u32 BlackCounts[ArrayCount(EndgamePieceTypes)];
+        ParseBitbaseLayout(BitbaseNames[TableIndex], &Layout, WhiteCounts, BlackCounts);
+        FileSize += 2*Layout.PositionsPerSide;
+        if (2*Layout.PositionsPerSide > LargestTable)
+            LargestTable = 2*Layout.PositionsPerSide;
+    }
+    
+    platform_page_kind PageKind;
+    memory_index ScratchSize = sizeof(endgame_tables) + 2*LargestTable;
+    u8 *Scratch = (u8 *)GlobalPlatform->AllocateLargeMemory(ScratchSize, &PageKind);
+    u8 *File = (u8 *)GlobalPlatform->MapFile(BITBASE_FILENAME, FileSize);
+    if (Scratch && File)
+    {
+        Generator->Tables = (endgame_tables *)Scratch;
+        Generator->Flags = Scratch + sizeof(endgame_tables);
+        Generator->Revisit = Generator->Flags + LargestTable;
+        
+        bitbase_file_header *Header = (bitbase_file_header *)File;
+        Header->Magic = 0;
+        Header->TableCount = ArrayCount(BitbaseNames);
+        memory_index Offset = sizeof(bitbase_file_header);
+        for (u32 TableIndex = 0; TableIndex < ArrayCount(BitbaseNames); ++TableIndex)
+        {
+            bitbase_file_entry *Entry = Header->Tables + TableIndex;
+            ZeroBytes((u8 *)Entry->Name, sizeof(Entry->Name));
+            AppendString(Entry->Name, 0, sizeof(Entry->Name), BitbaseNames[TableIndex]);
+            Generator->Layout = Generator->Tables->BitbaseLayouts + TableIndex;
+            u32 WhiteCounts[ArrayCount(EndgamePieceTypes)];
+            u32 BlackCounts[ArrayCount(EndgamePieceTypes)];
+            ParseBitbaseLayout(BitbaseNames[TableIndex], Generator->Layout, WhiteCounts, 
+                               BlackCounts);
+            Entry->Offset = Offset;
+            Entry->Size = 2*Generator->Layout->PositionsPerSide;
+            Generator->Values = File + Offset;
+            Offset += Entry->Size;
+            
+            u32 ResolvedCount = 0;
+            u32 MaxRevisit = 0;
+            RunBitbasePhase(Queue, Generator, BitbasePhase_Initialize, -1, &ResolvedCount,
+                            &MaxRevisit);
+            for (s32 Level = 0; Level < BITBASE_ILLEGAL - 2; ++Level)
+            {
+                ResolvedCount = 0;
+                RunBitbasePhase(Queue, Generator, BitbasePhase_Push, Level, &ResolvedCount,
+                                &MaxRevisit);
+                RunBitbasePhase(Queue, Generator, BitbasePhase_Pull, Level, &ResolvedCount,
+                                &MaxRevisit);
+                if (ResolvedCount == 0 && (s32)MaxRevisit <= Level + 1)
+                    break;
+            }
+            RunBitbasePhase(Queue, Generator, BitbasePhase_Finalize, 0, &ResolvedCount,
+                            &MaxRevisit);
+            
+            // NOTE(vincent): Done, so the next tables can look it up.
+            AddBitbaseTable(Generator->Tables, TableIndex, Generator->Values);
+        }
+        CompilerWriteBarrier;
+        Header->Magic = BITBASE_MAGIC;
+        Generator->File = File;
+        Generator->FileSize = FileSize;
+    }
+    if (Scratch)
+        GlobalPlatform->FreeLargeMemory(Scratch, ScratchSize);
+    
+    CompilerWriteBarrier;
+    Generator->Finished = true;
+}
+
+internal b32
+ProbeBitbase(endgame_tables *Tables, chess_game_state *Game, endgame_probe *Probe)
+{
+    // NOTE(vincent): Bitbases don't know about castling. En passant never comes up with
+    // the material they have.
+    bitbase_position Position = {};
+    Position.SideToMove = Game->BlackIsPlaying ? 1 : 0;
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *Pieces = Color ? Game->Blacks : Game->Whites;
+        if (Pieces[12].MoveCount == 0 && 
+            ((Pieces[8].Type == ChessPieceType_Rook && Pieces[8].MoveCount == 0) ||
+             (Pieces[15].Type == ChessPieceType_Rook && Pieces[15].MoveCount == 0)))
+        {
+            return false;
+        }
+        
+        // NOTE(vincent): Kings go first, at their color's index.
+        Position.Colors[Color] = Color;
+        Position.Types[Color] = ChessPieceType_King;
+        Position.Squares[Color] = Pieces[12].Row*8 + Pieces[12].Column;
+    }
+    Position.PieceCount = 2;
+    for (u32 Color = 0; Color < 2; ++Color)
+    {
+        chess_piece *Pieces = Color ? Game->Blacks : Game->Whites;
+        for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+        {
+            chess_piece *Piece = Pieces + PieceIndex;
+            if (Piece->Type == ChessPieceType_Empty || Piece->Type == ChessPieceType_King)
+                continue;
+            if (Position.PieceCount == BITBASE_MAX_PIECES)
+                return false;
+            Position.Colors[Position.PieceCount] = Color;
+            Position.Types[Position.PieceCount] = Piece->Type;
+            Position.Squares[Position.PieceCount] = Piece->Row*8 + Piece->Column;
+            Position.PieceCount++;
+        }
+    }
+    
+    u8 Value;
+    b32 Found = LookUpBitbase(Tables, &Position, &Value);
+    if (Found)
+    {
+        Probe->KnowsDistance = (Value != 0);
+        Probe->DistanceToMate = Value ? Value - 1 : 0;
+        Probe->WDL = Value ? ((Probe->DistanceToMate & 1) ? 1 : -1) : 0;
+    }
+    return Found;
+}
+
+internal b32
+ProbeEndgameTables(endgame_tables *Tables, chess_game_state *Game, endgame_probe *Probe)
+{
+    b32 Found = false;
+    u32 WhiteCounts[ArrayCount(EndgamePieceTypes)];
+    u32 BlackCounts[ArrayCount(EndgamePieceTypes)];
+    u32 PieceCount = CountMaterial(Game->Whites, WhiteCounts) + 
+        CountMaterial(Game->Blacks, BlackCounts);
+    if (PieceCount <= Tables->MaxPieceCount)
+    {
+        endgame_table *Table = 
+            FindEndgameTable(Tables, MaterialCode(WhiteCounts, BlackCounts), false);
+        if (Table && Table->CanProbe)
+            Found = ProbeBitbase(Tables, Game, Probe);
+    }
+    return Found;
+}
+
+// NOTE(vincent): Below the root, the search gets its decisions in phases: the move from
+// the transposition table, then captures and promotions (most valuable victim first, then
+// least valuable attacker), then the killer moves of the depth, then the quiet moves, and
+// last the captures that lose material (StaticExchangeEvaluation()). A phase is only
+// generated once the ones before it didn't cause a cutoff. Generation is pseudo-legal, the
+// search checks that a decision doesn't leave its king in check right before playing it
+// (DecisionIsLegal()).
+enum move_picker_phase
+{
+    MovePickerPhase_Start = 0,
+    MovePickerPhase_List,  // the root: all the legal decisions, in the order to try them
+    MovePickerPhase_HashDecision,
+    MovePickerPhase_GenerateCaptures,
+    MovePickerPhase_Captures,
+    MovePickerPhase_Killers,
+    MovePickerPhase_GenerateQuiets,
+    MovePickerPhase_Quiets,
+    MovePickerPhase_BadCaptures,
+    MovePickerPhase_Done,
+};
+
+#define MAX_STAGE_DECISIONS 500
+
+struct minimax_stage
+{
+    f32 Alpha;
+    f32 Beta;
+    chess_game_state GameCopy;
+    u32 DecisionIndex;
+    u32 DecisionsCount;
+    decision *Decisions;
+    u16 *DecisionScores;    // of captures, to pick them in order
+    decision LastDecision;  // last decision applied from this stage
+    decision BestDecision;  // decision that set the current Alpha or Beta, if any
+    
+    move_picker_phase Phase;
+    chess_piece *Board[64];  // by Row*8 + Column, at this stage's position
+    decision HashDecision;
+    decision Killers[2];     // quiet decisions that caused a cutoff at this depth lately
+    u32 KillerIndex;
+    u32 BadCapturesCount;    // kept backwards from the end of Decisions
+    u32 SearchedCount;       // legal decisions searched from this stage so far
+    u32 Horizon;             // depth at which this stage's subtree ends, less than MaxDepth
+                             // below a reduced decision
+    
+    u64 Key;              // of the position at this stage, when there is a transposition table
+    f32 OriginalAlpha;    // window the stage was entered with, to tell what kind of bound
+    f32 OriginalBeta;     // its value is when it goes in the transposition table
+};
+
+struct minimax_context
+{
+    minimax_stage *Stages;
+    u32 CurrentDepth;
+};
+
+struct minimax_search
+{
+    chess_game_state Game;  // the game the search plays and undoes moves on
+    minimax_context Context;
+    b32 RootPlayerIsBlack;
+    b32 AnsweredFromLearning;  // nothing to search, Params->Result came from the learning file
+    temporary_memory StagesMemory;
+};
+
+// NOTE(vincent): Indexed by chess_piece_type. Kings only ever attack.
+global_variable u32 MoveOrderPieceValues[] = {0, 1, 5, 3, 3, 9, 10};
+
+enum search_decision_kind
+{
+    SearchDecisionKind_Captures = 1,  // promotions too
+    SearchDecisionKind_Quiets = 2,
+};
+
+internal u32
+AddSearchDecision(decision *Decisions, u16 *Scores, u32 Count, chess_piece *Piece, 
+                  s32 ToRow, s32 ToColumn, chess_piece_type VictimType, b32 IsPromotion)
+{
+    Assert(Count < MAX_STAGE_DECISIONS);
+    decision *Dec = Decisions + Count;
+    Dec->Piece = Piece;
+    Dec->Destination.DestCode = 
+        (u8)(ToRow | (ToColumn << 3) | ((VictimType != ChessPieceType_Empty) << 6));
+    Dec->PromotionType = IsPromotion ? ChessPieceType_Queen : ChessPieceType_Empty;
+    if (Scores)
+    {
+        u32 Victim = MoveOrderPieceValues[VictimType] + (IsPromotion ? 8 : 0);
+        Scores[Count] = (u16)(16*Victim + 15 - MoveOrderPieceValues[Piece->Type]);
+    }
+    return Count + 1;
+}
+
+template <b32 MoverIsWhite>
+internal u32
+PushSearchDecisions(chess_game_state *Game, chess_piece **Board, chess_piece *Piece, 
+                    u32 Kinds, decision *Decisions, u16 *Scores, u32 Count)
+{
+    // NOTE(vincent): Pseudo-legal decisions of one piece: nothing checks that the king is
+    // safe afterwards, except for castling through attacked squares.
+    chess_piece *Opponents = MoverIsWhite ? Game->Blacks : Game->Whites;
+    b32 Captures = (Kinds & SearchDecisionKind_Captures);
+    b32 Quiets = (Kinds & SearchDecisionKind_Quiets);
+    s32 Row = Piece->Row;
+    s32 Column = Piece->Column;
+    
+    if (Piece->Type == ChessPieceType_Pawn)
+    {
+        s32 Forward = MoverIsWhite ? 1 : -1;
+        s32 StartRow = MoverIsWhite ? 1 : 6;
+        s32 EnPassantRow = MoverIsWhite ? 4 : 3;
+        s32 To = Row + Forward;
+        b32 IsPromotion = (To == 0 || To == 7);
+        if (!Board[To*8 + Column])
+        {
+            if (IsPromotion ? Captures : Quiets)
+            {
+                Count = AddSearchDecision(Decisions, Scores, Count, Piece, To, Column,
+                                          ChessPieceType_Empty, IsPromotion);
+            }
+            if (Quiets && Row == StartRow && !Board[(To + Forward)*8 + Column])
+            {
+                Count = AddSearchDecision(Decisions, Scores, Count, Piece, To + Forward, 
+                                          Column, ChessPieceType_Empty, false);
+            }
+        }
+        for (s32 Side = -1; Side <= 1 && Captures; Side += 2)
+        {
+            s32 ToColumn = Column + Side;
+            if (ToColumn < 0 || ToColumn > 7)
+                continue;
+            chess_piece *Victim = Board[To*8 + ToColumn];
+            if (Victim && Victim >= Opponents && Victim < Opponents + 16 &&
+                Victim->Type != ChessPieceType_King)
+            {
+                Count = AddSearchDecision(Decisions, Scores, Count, Piece, To, ToColumn,
+                                          Victim->Type, IsPromotion);
+            }
+            else if (!Victim && Row == EnPassantRow && Game->History.EntryCount > 0)
+            {
+                // NOTE(vincent): Same test as PushDiagPawnDestIfLegal().
+                history_entry LastEntry = Game->History.Entries[Game->History.EntryCount-1];
+                chess_piece *Pawn = Board[Row*8 + ToColumn];
+                if (Pawn && Pawn >= Opponents && Pawn < Opponents + 16 &&
+                    Pawn->Type == ChessPieceType_Pawn && Pawn->MoveCount == 1 &&
+                    (LastEntry.Indices & 15) == Pawn->Index)
+                {
+                    Count = AddSearchDecision(Decisions, Scores, Count, Piece, To, ToColumn,
+                                              ChessPieceType_Pawn, false);
+                }
+            }
+        }
+        return Count;
+    }
+    
+    const s32 (*Steps)[2] = (Piece->Type == ChessPieceType_Knight) ? KnightJumps : KingSteps;
+    b32 Slides = (Piece->Type == ChessPieceType_Rook || Piece->Type == ChessPieceType_Bishop ||
+                  Piece->Type == ChessPieceType_Queen);
+    for (u32 StepIndex = 0; StepIndex < 8; ++StepIndex)
+    {
+        if ((Piece->Type == ChessPieceType_Rook && (StepIndex & 1)) ||
+            (Piece->Type == ChessPieceType_Bishop && !(StepIndex & 1)))
+        {
+            continue;
+        }
+        s32 ToRow = Row;
+        s32 ToColumn = Column;
+        for (;;)
+        {
+            ToRow += Steps[StepIndex][0];
+            ToColumn += Steps[StepIndex][1];
+            if (ToRow < 0 || ToRow > 7 || ToColumn < 0 || ToColumn > 7)
+                break;
+            chess_piece *Occupant = Board[ToRow*8 + ToColumn];
+            if (Occupant)
+            {
+                if (Captures && Occupant >= Opponents && Occupant < Opponents + 16 &&
+                    Occupant->Type != ChessPieceType_King)
+                {
+                    Count = AddSearchDecision(Decisions, Scores, Count, Piece, ToRow, ToColumn,
+                                              Occupant->Type, false);
+                }
+                break;
+            }
+            if (Quiets)
+            {
+                Count = AddSearchDecision(Decisions, Scores, Count, Piece, ToRow, ToColumn,
+                                          ChessPieceType_Empty, false);
+            }
+            if (!Slides)
+                break;
+        }
+    }
+    
+    // NOTE(vincent): Castling, with the same tests as PushDestinationsForPiece().
+    if (Quiets && Piece->Type == ChessPieceType_King && Piece->MoveCount == 0 &&
+        !IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites))
+    {
+        chess_piece *Rooks = MoverIsWhite ? Game->Whites : Game->Blacks;
+        for (u32 Side = 0; Side < 2; ++Side)
+        {
+            s32 Step = Side ? -1 : 1;
+            u32 RookIndex = Side ? 8 : 15;
+            b32 PathIsFree = (!Board[Row*8 + Column + Step] && !Board[Row*8 + Column + 2*Step] &&
+                              (!Side || !Board[Row*8 + Column + 3*Step]));
+            if (Rooks[RookIndex].MoveCount == 0 && PathIsFree)
+            {
+                Piece->Column = Column + Step;
+                b32 Safe = !IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites);
+                Piece->Column = Column + 2*Step;
+                Safe = Safe && !IsCheck<MoverIsWhite>(Game->Blacks, Game->Whites);
+                Piece->Column = Column;
+                if (Safe)
+                {
+                    Count = AddSearchDecision(Decisions, Scores, Count, Piece, Row, 
+                                              Column + 2*Step, ChessPieceType_Empty, false);
+                }
+            }
+        }
+    }
+    return Count;
+}
+
+template <b32 MoverIsWhite>
+internal u32
+PushAllSearchDecisions(chess_game_state *Game, chess_piece **Board, u32 Kinds, 
+                       decision *Decisions, u16 *Scores)
+{
+    chess_piece *Pieces = MoverIsWhite ? Game->Whites : Game->Blacks;
+    u32 Count = 0;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        if (Pieces[Index].Type != ChessPieceType_Empty)
+        {
+            Count = PushSearchDecisions<MoverIsWhite>(Game, Board, Pieces + Index, Kinds,
+                                                      Decisions, Scores, Count);
+        }
+    }
+    return Count;
+}
+
+internal void
+FillSearchBoard(chess_game_state *Game, chess_piece **Board)
+{
+    for (u32 Square = 0; Square < 64; ++Square)
+        Board[Square] = 0;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        chess_piece *Black = Game->Blacks + Index;
+        chess_piece *White = Game->Whites + Index;
+        if (Black->Type != ChessPieceType_Empty)
+            Board[Black->Row*8 + Black->Column] = Black;
+        if (White->Type != ChessPieceType_Empty)
+            Board[White->Row*8 + White->Column] = White;
+    }
+}
+
+internal b32
+FindSearchDecision(chess_game_state *Game, chess_piece **Board, u32 FromSquare, u32 DestCode,
+                   u32 Kinds, decision *Result)
+{
+    // NOTE(vincent): Like FindDecision(), for positions whose pieces have no destinations.
+    // DestCode is pseudo-legal for the piece on FromSquare, legality is up to the caller.
+    b32 Found = false;
+    b32 MoverIsWhite = !Game->BlackIsPlaying;
+    chess_piece *Pieces = MoverIsWhite ? Game->Whites : Game->Blacks;
+    chess_piece *Piece = Board[FromSquare];
+    if (Piece && Piece >= Pieces && Piece < Pieces + 16)
+    {
+        decision Decisions[32];
+        u32 Count = MoverIsWhite ?
+            PushSearchDecisions<true>(Game, Board, Piece, Kinds, Decisions, 0, 0) :
+            PushSearchDecisions<false>(Game, Board, Piece, Kinds, Decisions, 0, 0);
+        for (u32 DecisionIndex = 0; DecisionIndex < Count && !Found; ++DecisionIndex)
+        {
+            if ((u32)(Decisions[DecisionIndex].Destination.DestCode & 63) == (DestCode & 63))
+            {
+                *Result = Decisions[DecisionIndex];
+                Found = true;
+            }
+        }
+    }
+    return Found;
+}
+
+internal b32
+DecisionIsLegal(chess_game_state *Game, chess_piece **Board, decision Decision)
+{
+    // NOTE(vincent): Plays the decision just enough to ask IsCheck_(), like
+    // PushDestinationsForPiece() does for every destination.
+    b32 MoverIsWhite = !Game->BlackIsPlaying;
+    chess_piece *Piece = Decision.Piece;
+    u32 Row = Piece->Row;
+    u32 Column = Piece->Column;
+    u32 ToRow = Decision.Destination.DestCode & 7;
+    u32 ToColumn = (Decision.Destination.DestCode >> 3) & 7;
+    chess_piece *Victim = Board[ToRow*8 + ToColumn];
+    if (!Victim && Piece->Type == ChessPieceType_Pawn && ToColumn != Column)
+        Victim = Board[Row*8 + ToColumn];  // en passant
+    
+    chess_piece_type VictimType = ChessPieceType_Empty;
+    if (Victim)
+    {
+        VictimType = Victim->Type;
+        Victim->Type = ChessPieceType_Empty;
+    }
+    Piece->Row = ToRow;
+    Piece->Column = ToColumn;
+    b32 Result = !IsCheck_(Game->Blacks, Game->Whites, MoverIsWhite);
+    Piece->Row = Row;
+    Piece->Column = Column;
+    if (Victim)
+        Victim->Type = VictimType;
+    return Result;
+}
+
+// NOTE(vincent): Indexed by chess_piece_type, in pawns. The king is worth more than
+// everything else together, so that an exchange never goes on past taking it.
+global_variable s32 ExchangePieceValues[] = {0, 1, 5, 3, 3, 9, 100};
+
+internal chess_piece *
+GetLeastValuableAttacker(chess_game_state *Game, b32 SideIsWhite, u32 Target, u64 Occupied)
+{
+    // NOTE(vincent): Pieces not on the Occupied squares have left the board already, so
+    // sliders see through them and the pieces lined up behind an attacker join the
+    // exchange after it. Pins are ignored.
+    chess_piece *Side = SideIsWhite ? Game->Whites : Game->Blacks;
+    chess_piece *Result = 0;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        chess_piece *Piece = Side + Index;
+        u32 Square = Piece->Row*8 + Piece->Column;
+        if (Piece->Type != ChessPieceType_Empty && (Occupied & ((u64)1 << Square)) &&
+            (!Result || ExchangePieceValues[Piece->Type] < ExchangePieceValues[Result->Type]) &&
+            PieceAttacksSquare(Piece->Type, SideIsWhite, Square, Target, Occupied))
+        {
+            Result = Piece;
+        }
+    }
+    return Result;
+}
+
+internal s32
+StaticExchangeEvaluation(chess_game_state *Game, chess_piece **Board, decision Decision)
+{
+    // NOTE(vincent): Material the side to move wins with a capture, in pawns, once both
+    // sides are done recapturing on its destination with their least valuable attacker.
+    // Either side stops recapturing as soon as it would lose by going on.
+    chess_piece *Piece = Decision.Piece;
+    b32 MoverIsWhite = !Game->BlackIsPlaying;
+    s32 Row = Decision.Destination.DestCode & 7;
+    s32 Column = (Decision.Destination.DestCode >> 3) & 7;
+    chess_piece *Victim = Board[Row*8 + Column];
+    
+    s32 Gains[32];
+    if (Victim)
+        Gains[0] = ExchangePieceValues[Victim->Type];
+    else  // en passant
+        Gains[0] = (Piece->Type == ChessPieceType_Pawn && (s32)Piece->Column != Column) ? 1 : 0;
+    s32 OnSquareValue = ExchangePieceValues[Piece->Type];
+    u64 Occupied = GetOccupiedSquares(Game->Blacks, Game->Whites);
+    Occupied &= ~((u64)1 << (Piece->Row*8 + Piece->Column));
+    u32 Count = 1;
+    for (;;)
+    {
+        b32 SideIsWhite = (Count & 1) ? !MoverIsWhite : MoverIsWhite;
+        chess_piece *Attacker = GetLeastValuableAttacker(Game, SideIsWhite, Row*8 + Column, 
+                                                         Occupied);
+        if (!Attacker)
+            break;
+        Assert(Count < ArrayCount(Gains));
+        Gains[Count] = OnSquareValue - Gains[Count-1];
+        OnSquareValue = ExchangePieceValues[Attacker->Type];
+        Occupied &= ~((u64)1 << (Attacker->Row*8 + Attacker->Column));
+        ++Count;
+    }
+    while (--Count)
+        Gains[Count-1] = -Maximum(-Gains[Count-1], Gains[Count]);
+    return Gains[0];
+}
+
+internal b32
+SameDecision(decision A, decision B)
+{
+    b32 Result = (A.Piece == B.Piece && 
+                  (A.Destination.DestCode & 63) == (B.Destination.DestCode & 63));
+    return Result;
+}
+
+internal void
+StoreKiller(minimax_stage *Stage, decision Decision)
+{
+    b32 IsQuiet = (!(Decision.Destination.DestCode >> 6) &&
+                   Decision.PromotionType == ChessPieceType_Empty);
+    if (IsQuiet && !SameDecision(Stage->Killers[0], Decision))
+    {
+        Stage->Killers[1] = Stage->Killers[0];
+        Stage->Killers[0] = Decision;
+    }
+}
+
+internal b32
+PickNextDecision(chess_game_state *Game, minimax_stage *Stage, decision *Result)
+{
+    b32 MoverIsWhite = !Game->BlackIsPlaying;
+    for (;;)
+    {
+        switch (Stage->Phase)
+        {
+            case MovePickerPhase_List:
+            {
+                if (Stage->DecisionIndex < Stage->DecisionsCount)
+                {
+                    *Result = Stage->Decisions[Stage->DecisionIndex++];
+                    return true;
+                }
+                Stage->Phase = MovePickerPhase_Done;
+            } break;
+            
+            case MovePickerPhase_HashDecision:
+            {
+                Stage->Phase = MovePickerPhase_GenerateCaptures;
+                if (Stage->HashDecision.Piece)
+                {
+                    *Result = Stage->HashDecision;
+                    return true;
+                }
+            } break;
+            
+            case MovePickerPhase_GenerateCaptures:
+            {
+                Stage->DecisionIndex = 0;
+                Stage->BadCapturesCount = 0;
+                u32 Kinds = SearchDecisionKind_Captures;
+                Stage->DecisionsCount = MoverIsWhite ?
+                    PushAllSearchDecisions<true>(Game, Stage->Board, Kinds, Stage->Decisions, 
+                                                 Stage->DecisionScores) :
+                    PushAllSearchDecisions<false>(Game, Stage->Board, Kinds, Stage->Decisions, 
+                                                  Stage->DecisionScores);
+                Stage->Phase = MovePickerPhase_Captures;
+            } break;
+            
+            case MovePickerPhase_Captures:
+            {
+                while (Stage->DecisionIndex < Stage->DecisionsCount)
+                {
+                    // NOTE(vincent): Selection sort, one step at a time, since a cutoff
+                    // usually comes before the end.
+                    u32 First = Stage->DecisionIndex++;
+                    u32 Best = First;
+                    for (u32 i = First + 1; i < Stage->DecisionsCount; ++i)
+                    {
+                        if (Stage->DecisionScores[i] > Stage->DecisionScores[Best])
+                            Best = i;
+                    }
+                    decision Decision = Stage->Decisions[Best];
+                    Stage->Decisions[Best] = Stage->Decisions[First];
+                    Stage->DecisionScores[Best] = Stage->DecisionScores[First];
+                    if (SameDecision(Decision, Stage->HashDecision))
+                        continue;
+                    
+                    // NOTE(vincent): Only a capture by a piece worth more than its victim
+                    // can lose material.
+                    u32 DestCode = Decision.Destination.DestCode;
+                    chess_piece *Victim = Stage->Board[(DestCode & 7)*8 + ((DestCode >> 3) & 7)];
+                    if (Decision.PromotionType == ChessPieceType_Empty && Victim &&
+                        ExchangePieceValues[Decision.Piece->Type] > 
+                        ExchangePieceValues[Victim->Type] &&
+                        StaticExchangeEvaluation(Game, Stage->Board, Decision) < 0)
+                    {
+                        ++Stage->BadCapturesCount;
+                        Stage->Decisions[MAX_STAGE_DECISIONS - Stage->BadCapturesCount] = Decision;
+                        continue;
+                    }
+                    *Result = Decision;
+                    return true;
+                }
+                Stage->KillerIndex = 0;
+                Stage->Phase = MovePickerPhase_Killers;
+            } break;
+            
+            case MovePickerPhase_Killers:
+            {
+                while (Stage->KillerIndex < ArrayCount(Stage->Killers))
+                {
+                    decision Killer = Stage->Killers[Stage->KillerIndex++];
+                    decision Decision;
+                    if (Killer.Piece && Killer.Piece->Type != ChessPieceType_Empty &&
+                        !SameDecision(Killer, Stage->HashDecision) &&
+                        FindSearchDecision(Game, Stage->Board, 
+                                           Killer.Piece->Row*8 + Killer.Piece->Column,
+                                           Killer.Destination.DestCode, 
+                                           SearchDecisionKind_Quiets, &Decision))
+                    {
+                        *Result = Decision;
+                        return true;
+                    }
+                }
+                Stage->Phase = MovePickerPhase_GenerateQuiets;
+            } break;
+            
+            case MovePickerPhase_GenerateQuiets:
+            {
+                Stage->DecisionIndex = 0;
+                u32 Kinds = SearchDecisionKind_Quiets;
+                Stage->DecisionsCount = MoverIsWhite ?
+                    PushAllSearchDecisions<true>(Game, Stage->Board, Kinds, Stage->Decisions, 0) :
+                    PushAllSearchDecisions<false>(Game, Stage->Board, Kinds, Stage->Decisions, 0);
+                Assert(Stage->DecisionsCount + Stage->BadCapturesCount <= MAX_STAGE_DECISIONS);
+                Stage->Phase = MovePickerPhase_Quiets;
+            } break;
+            
+            case MovePickerPhase_Quiets:
+            {
+                while (Stage->DecisionIndex < Stage->DecisionsCount)
+                {
+                    decision Decision = Stage->Decisions[Stage->DecisionIndex++];
+                    if (!SameDecision(Decision, Stage->HashDecision) &&
+                        !SameDecision(Decision, Stage->Killers[0]) &&
+                        !SameDecision(Decision, Stage->Killers[1]))
+                    {
+                        *Result = Decision;
+                        return true;
+                    }
+                }
+                Stage->DecisionIndex = 0;
+                Stage->Phase = MovePickerPhase_BadCaptures;
+            } break;
+            
+            case MovePickerPhase_BadCaptures:
+            {
+                if (Stage->DecisionIndex < Stage->BadCapturesCount)
+                {
+                    ++Stage->DecisionIndex;
+                    *Result = Stage->Decisions[MAX_STAGE_DECISIONS - Stage->DecisionIndex];
+                    return true;
+                }
+                Stage->Phase = MovePickerPhase_Done;
+            } break;
+            
+            case MovePickerPhase_Done:
+            {
+                return false;
+            } break;
+            
+            InvalidDefaultCase;
+        }
+    }
+}
+
+// NOTE(vincent): A checkmate delivered at ply N (the root move being ply 1) is worth
+// CHECKMATE_VALUE - N, so the search prefers faster mates and slower defeats.
+// Heuristic values never get anywhere near these.
+#define CHECKMATE_VALUE 5000
+#define MAX_MATE_PLY 100
+
+internal f32
+CheckmateValue(u32 Ply, b32 WhiteWins)
+{
+    f32 Result = (f32)(CHECKMATE_VALUE - (s32)Ply);
+    if (!WhiteWins)
+        Result = -Result;
+    return Result;
+}
+
+internal b32
+IsCheckmateValue(f32 Value)
+{
+    b32 Result = (AbsoluteValue(Value) >= CHECKMATE_VALUE - MAX_MATE_PLY);
+    return Result;
+}
+
+internal b32
+IsPlyDependentValue(f32 Value)
+{
+    // NOTE(vincent): Checkmate values and endgame table wins, which both count the plies
+    // from the root (see EndgameProbeValue()).
+    b32 Result = (AbsoluteValue(Value) >= ENDGAME_WIN_VALUE - MAX_ENDGAME_PLY);
+    return Result;
+}
+
+internal f32
+EndgameProbeValue(endgame_probe *Probe, b32 BlackIsPlaying, u32 Ply)
+{
+    // NOTE(vincent): Ply is the number of moves played from the root to the position.
+    f32 Result = 0.0f;
+    if (Probe->WDL != 0)
+    {
+        // NOTE(vincent): Mates too far away for the checkmate values still rank by distance.
+        b32 WhiteWins = ((Probe->WDL > 0) != BlackIsPlaying);
+        u32 MatePly = Ply + (Probe->KnowsDistance ? Probe->DistanceToMate : 0);
+        if (Probe->KnowsDistance && MatePly <= MAX_MATE_PLY)
+            Result = CheckmateValue(MatePly, WhiteWins);
+        else
+            Result = (f32)(WhiteWins ? ENDGAME_WIN_VALUE - (s32)MatePly : 
+                           -ENDGAME_WIN_VALUE + (s32)MatePly);
+    }
+    return Result;
+}
+
+
+internal void
+CopyGame(chess_game_state *Source, chess_game_state *Dest)
+{
+    Dest->RunningState = Source->RunningState;
+    Dest->PromotingPawn = Source->PromotingPawn;
+    
+    for (u32 i = 0; i < 16; ++i)
+    {
+        Dest->Blacks[i] = Source->Blacks[i];
+        Dest->Whites[i] = Source->Whites[i];
+    }
+    
+    Dest->Cursor.Row = Source->Cursor.Row;
+    Dest->Cursor.Column = Source->Cursor.Column;
+    Dest->SelectedPiece = Source->SelectedPiece;
+    Dest->PieceOnCursor = Source->PieceOnCursor;
+    Dest->BlackCanMove = Source->WhiteCanMove;
+    Dest->BlackIsPlaying = Source->BlackIsPlaying;
+    Dest->History = Source->History;
+    Dest->GameIsOver = Source->GameIsOver;
+    Dest->CurrentEntryIndex = Source->CurrentEntryIndex;
+    Dest->DestinationsCount = Source->DestinationsCount;
+    for (u32 i = 0; i < ArrayCount(Source->Destinations); ++i)
+    {
+        Dest->Destinations[i] = Source->Destinations[i];
+    }
+    Dest->DestinationsAreCurrent = Source->DestinationsAreCurrent;
+    for (u32 i = 0; i < ArrayCount(Source->DestinationsKeptCounts); ++i)
+    {
+        Dest->DestinationsKeptCounts[i] = Source->DestinationsKeptCounts[i];
+        Dest->DestinationsBoardSquares[0][i] = Source->DestinationsBoardSquares[0][i];
+        Dest->DestinationsBoardSquares[1][i] = Source->DestinationsBoardSquares[1][i];
+        Dest->DestinationsBoardTypes[0][i] = Source->DestinationsBoardTypes[0][i];
+        Dest->DestinationsBoardTypes[1][i] = Source->DestinationsBoardTypes[1][i];
+    }
+    for (u32 i = 0; i < 2; ++i)
+    {
+        Dest->DestinationsBoardIsValid[i] = Source->DestinationsBoardIsValid[i];
+        Dest->DestinationsBoardChecks[i] = Source->DestinationsBoardChecks[i];
+    }
+}
+
+internal void
+CopyGameRelocated(chess_game_state *Source, chess_game_state *Dest)
+{
+    // NOTE(vincent): Full copy of a game, with its internal pointers made to point
+    // inside Dest instead of Source.
+    *Dest = *Source;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        if (Dest->Blacks[i].Destinations)
+        {
+            Dest->Blacks[i].Destinations = 
+                (destination *)((u8 *)Dest + 
+                                ((u8 *)Source->Blacks[i].Destinations - (u8 *)Source));
+        }
+        if (Dest->Whites[i].Destinations)
+        {
+            Dest->Whites[i].Destinations = 
+                (destination *)((u8 *)Dest + 
+                                ((u8 *)Source->Whites[i].Destinations - (u8 *)Source));
+        }
+    }
+    Dest->SelectedPiece.Piece =
+        (chess_piece *)((u8 *)Dest + ((u8 *)Source->SelectedPiece.Piece - (u8 *)Source));
+    Dest->PieceOnCursor.Piece = 
+        (chess_piece *)((u8 *)Dest + ((u8 *)Source->PieceOnCursor.Piece - (u8 *)Source));
+}
+
+internal b32
+LookUpLearnedDecision(get_good_decision_params *Params, chess_game_state *Game, 
+                      good_decision_result *Result)
+{
+    // NOTE(vincent): Only a full search of this position, at least as deep as the one
+    // we're asked for, will do. Decision points into Game.
+    b32 Found = false;
+    transposition_table *Learning = Params->Learning;
+    if (Learning && Learning->Entries && Params->RootMoveCount == 0 &&
+        Params->RootAlpha <= -10000.0f && Params->RootBeta >= 10000.0f)
+    {
+        chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+        transposition_probe Probe = {};
+        u64 Key = ComputePositionKey(&Learning->Keys, Game);
+        if (ProbeTransposition(Learning, Key, &Probe) && Probe.Depth >= Params->MaxDepth &&
+            Probe.Bound == TranspositionBound_Exact && Probe.HasMove &&
+            FindDecision(Pieces, Probe.FromSquare, Probe.DestCode, &Result->Decision))
+        {
+            Result->ExpectedReply.Piece = 0;
+            Result->Value = Probe.Value;
+            Found = true;
+        }
+    }
+    return Found;
+}
+
+internal void
+LearnDecision(get_good_decision_params *Params, chess_game_state *Game, 
+              good_decision_result *Result)
+{
+    // NOTE(vincent): Game is the root position, and Result a finished search of it.
+    // The learning table's generation never changes, so an entry only gets replaced by a
+    // deeper search of the same position, or by another position that lands on its index.
+    transposition_table *Learning = Params->Learning;
+    if (Learning && Learning->Entries && Params->RootMoveCount == 0 && 
+        Params->RootAlpha <= -10000.0f && Params->RootBeta >= 10000.0f &&
+        Result->Decision.Piece && !WorkIsCancelled(&Params->CancelToken))
+    {
+        u64 Key = ComputePositionKey(&Learning->Keys, Game);
+        StoreTransposition(Learning, Key, Params->MaxDepth, TranspositionBound_Exact,
+                           Result->Value, &Result->Decision);
+    }
+}
+
+internal void
+BeginGoodDecision(get_good_decision_params *Params)
+{
+    // NOTE(vincent): Sets up the state of a search in Params->Arena.
+    // The search itself is run by ContinueGoodDecision(), possibly over several calls.
+    // Params->Game must have its destinations up to date (UpdateDestinations()) before the
+    // search is submitted: the search may run on another thread and only reads it, and the
+    // decision it returns points at its pieces.
+    chess_game_state *Game_ = Params->Game;
+    memory_arena *Arena = Params->Arena;
+    u32 MaxDepth = Params->MaxDepth;
+    good_decision_result *Result = &Params->Result;
+    
+    Assert(MaxDepth > 0);
+    
+    temporary_memory StagesMemory = BeginTemporaryMemory(Arena);
+    minimax_search *Search = PushStruct(Arena, minimax_search);
+    Search->StagesMemory = StagesMemory;
+    Params->Search = Search;
+    
+    chess_game_state *Game = &Search->Game;
+    Assert(Game_->DestinationsAreCurrent);
+    CopyGameRelocated(Game_, Game);
+    
+    Search->RootPlayerIsBlack = Game->BlackIsPlaying;
+    Assert(Game->DestinationsCount > 0);
+    
+    minimax_context *Context = &Search->Context;
+    Context->CurrentDepth = 0;
+    Context->Stages = PushArray(Arena, MaxDepth, minimax_stage);
+    
+    ZeroBytes((u8 *)Context->Stages, sizeof(minimax_stage) * MaxDepth);
+    
+    for (u32 DepthIndex = 0; DepthIndex < MaxDepth; ++DepthIndex)
+    {
+        Context->Stages[DepthIndex].Decisions = PushArray(Arena, MAX_STAGE_DECISIONS, decision);
+        Context->Stages[DepthIndex].DecisionScores = PushArray(Arena, MAX_STAGE_DECISIONS, u16);
+        Context->Stages[DepthIndex].DecisionsCount = 0;
+    }
+    
+    Assert(Params->RootAlpha < Params->RootBeta);
+    Context->Stages[0].Alpha = Params->RootAlpha;
+    Context->Stages[0].Beta = Params->RootBeta;
+    Context->Stages[0].Horizon = MaxDepth;
+    CopyGame(Game, &Context->Stages[0].GameCopy);
+    
+    // NOTE(vincent): Result->Decision stays 0 if no root move beats the window.
+    Result->Decision.Piece = 0;
+    Result->ExpectedReply.Piece = 0;
+    Result->Value = Game->BlackIsPlaying ? Params->RootBeta : Params->RootAlpha;
+    
+    if (Params->Table)
+        Params->Table->Generation++;
+    
+    Search->AnsweredFromLearning = LookUpLearnedDecision(Params, Game, Result);
+}
+
+internal b32
+ContinueGoodDecision(get_good_decision_params *Params, u32 NodeBudget)
 {
     // NOTE(vincent): Minimax algorithm implementation with alpha-beta pruning.
     // Some known issues:
@@ -2077,11 +5044,10 @@ PLATFORM_WORK_QUEUE_CALLBACK(GetGoodDecision)
     // and some of the reused code for game simulation involves unnecessary work.
     // - This is single-threaded scalar code, 
     // yet it's the most performance critical part of the program.
-    // - Behavioral problems: Although a higher MaxDepth will always win against a lower one,
-    // sometimes a higher MaxDepth leads to more strange "conservative" plays, 
-    // when you could in fact win in one move or a few moves. 
-    // This means the code is busted in some way, as I don't think that's supposed to happen.
-    // Additionally, AI vs AI games can often get stuck in a loop, or have little variety
+    // - Behavioral problems: checkmate values are adjusted by the ply at which they happen
+    // (see CheckmateValue()), otherwise a mate in 5 looks as good as a mate in 1 and deeper
+    // AIs end up playing strange "conservative" moves instead of winning right away.
+    // AI vs AI games can often get stuck in a loop, or have little variety
     // in them (we avoid exploring nodes that we know are going to have equal values or worse,
     // but it becomes impossible to properly choose a random decision 
     // among several ones that are in a tie).
@@ -2090,158 +5056,284 @@ PLATFORM_WORK_QUEUE_CALLBACK(GetGoodDecision)
     // but the behavior is still not great; there is a strong bias for the AI to move pieces 
     // on the left side of the board at the beginning of the game because of pruning order.
     
-    get_good_decision_params *Params = (get_good_decision_params *)Data;
+    // The exploration stops and returns false once NodeBudget moves have been played
+    // (0 means no budget). Everything needed to resume lives in Params->Search, so that
+    // the search can be spread over several frames when there is no worker thread to run it.
+    // Returns true once the search is over and Params->Result is set.
+    
+    minimax_search *Search = Params->Search;
     chess_game_state *Game_ = Params->Game;
-    memory_arena *Arena = Params->Arena;
-    CheckArena(Arena);
+    chess_game_state *Game = &Search->Game;
+    minimax_context *Context = &Search->Context;
     random_series *Series = Params->Series;
     u32 MaxDepth = Params->MaxDepth;
     good_decision_result *Result = &Params->Result;
-    
-    Assert(MaxDepth > 0);
-    
-    chess_game_state Game = *Game_;
-    for (u32 i = 0; i < 16; ++i)
-    {
-        if (Game.Blacks[i].Destinations)
-        {
-            Game.Blacks[i].Destinations = 
-                (destination *)((u8 *)&Game + 
-                                ((u8 *)Game_->Blacks[i].Destinations - (u8 *)Game_));
-        }
-        if (Game.Whites[i].Destinations)
-        {
-            Game.Whites[i].Destinations = 
-                (destination *)((u8 *)&Game + 
-                                ((u8 *)Game_->Whites[i].Destinations - (u8 *)Game_));
-        }
-    }
-    Game.SelectedPiece.Piece =
-        (chess_piece *)((u8 *)&Game + ((u8 *)Game_->SelectedPiece.Piece - (u8 *)Game_));
-    Game.PieceOnCursor.Piece = 
-        (chess_piece *)((u8 *)&Game + ((u8 *)Game_->PieceOnCursor.Piece - (u8 *)Game_));
-    
-    
-    
-    
-#if DEBUG
-    b32 RootPlayerIsBlack = Game.BlackIsPlaying;
-#endif
-    Assert(Game.DestinationsCount > 0);
-    
-    temporary_memory StagesMemory = BeginTemporaryMemory(Arena);
-    
-    decision LastTopDecision;
-    
-    minimax_context Context;
-    Context.CurrentDepth = 0;
-    Context.Stages = PushArray(Arena, MaxDepth, minimax_stage);
-    
-    ZeroBytes((u8 *)Context.Stages, sizeof(minimax_stage) * MaxDepth);
-    
-    for (u32 DepthIndex = 0; DepthIndex < MaxDepth; ++DepthIndex)
-    {
-        Context.Stages[DepthIndex].Decisions = PushArray(Arena, 500, decision);
-        Context.Stages[DepthIndex].DecisionsCount = 0;
-    }
-    
-    Context.Stages[0].Alpha = -10000;
-    Context.Stages[0].Beta = 10000;
-    CopyGame(&Game, &Context.Stages[0].GameCopy);
-    
-    Result->Value = Game.BlackIsPlaying ? 10000.0f : -10000.0f;
+    transposition_table *Table = (Params->Table && Params->Table->Entries) ? Params->Table : 0;
+    pawn_table *PawnTable = 
+        (Params->PawnTable && Params->PawnTable->Entries) ? Params->PawnTable : 0;
+    endgame_tables *Endgame = 
+        (Params->Endgame && Params->Endgame->MaxPieceCount) ? Params->Endgame : 0;
+    u32 NodeCount = 0;
+    
+    if (Search->AnsweredFromLearning)
+        goto Goto_EndExploration;
     
     Goto_StageExploration:
     
-    if (!Params->ShouldContinue)
+    if (WorkIsCancelled(&Params->CancelToken))
         goto Goto_EndExploration;
     
     {
-        Assert(Context.CurrentDepth < MaxDepth);
-        minimax_stage *Stage = Context.Stages + Context.CurrentDepth;
-        chess_piece *Pieces = Game.BlackIsPlaying ? Game.Blacks : Game.Whites;
+        Assert(Context->CurrentDepth < MaxDepth);
+        minimax_stage *Stage = Context->Stages + Context->CurrentDepth;
+        chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
         
-        if (Stage->DecisionsCount == 0)
+        if (Stage->Phase == MovePickerPhase_Start)
         {
-            // NOTE(vincent): Push decisions in two passes: those that involve a capture on
-            // the first pass, and then those that don't on the second pass.
-            // This is the cheapest/simplest way to reorder nodes to get some decent pruning.
+            Stage->OriginalAlpha = Stage->Alpha;
+            Stage->OriginalBeta = Stage->Beta;
+            Stage->SearchedCount = 0;
+            FillSearchBoard(Game, Stage->Board);
             
-            for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+            transposition_probe Probe = {};
+            b32 ProbeHit = false;
+            if (Table)
+            {
+                Stage->Key = ComputePositionKey(&Table->Keys, Game);
+                ProbeHit = ProbeTransposition(Table, Stage->Key, &Probe);
+            }
+            
+            if (Context->CurrentDepth > 0)
             {
-                chess_piece *Piece = Pieces + PieceIndex;
-                u32 PieceDestCount = Piece->DestinationsCount;
-                for (u32 DestIndex = 0; DestIndex < PieceDestCount; ++DestIndex)
+                // NOTE(vincent): Mate distance pruning. From this stage, the best the player
+                // can do is to checkmate with its next move, and the worst is to be checkmated
+                // by the opponent right after. If a shorter mate is already known higher up
+                // in the tree, the window becomes empty and there is nothing to explore here.
+                f32 Low, High;
+                if (Game->BlackIsPlaying)
+                {
+                    Low = CheckmateValue(Context->CurrentDepth + 1, false);
+                    High = CheckmateValue(Context->CurrentDepth + 2, true);
+                }
+                else
                 {
-                    if (Piece->Destinations[DestIndex].DestCode >> 6)
+                    Low = CheckmateValue(Context->CurrentDepth + 2, false);
+                    High = CheckmateValue(Context->CurrentDepth + 1, true);
+                }
+                
+                if (High <= Stage->Alpha || Low >= Stage->Beta)
+                {
+                    // NOTE(vincent): Report the window bound on the side the value falls,
+                    // like a regular fail-low or fail-high would.
+                    f32 Bound = (High <= Stage->Alpha) ? Stage->Alpha : Stage->Beta;
+                    Stage->Alpha = Bound;
+                    Stage->Beta = Bound;
+                    goto Goto_PruningParent;
+                }
+                Stage->Alpha = Maximum(Stage->Alpha, Low);
+                Stage->Beta = Minimum(Stage->Beta, High);
+                
+                // NOTE(vincent): A result from the transposition table that was searched
+                // at least as deep settles the stage if it is exact, or if its bound falls
+                // outside the window. Mate values and endgame table wins are never stored
+                // with a depth (they depend on the ply), so they don't come through here.
+                if (ProbeHit && Probe.Depth >= Stage->Horizon - Context->CurrentDepth)
+                {
+                    f32 Value = (f32)Probe.Value;
+                    if (Probe.Bound == TranspositionBound_Exact ||
+                        (Probe.Bound == TranspositionBound_Lower && Value >= Stage->Beta) ||
+                        (Probe.Bound == TranspositionBound_Upper && Value <= Stage->Alpha))
                     {
-                        decision *Dec = Stage->Decisions + Stage->DecisionsCount;
-                        Dec->Piece = Piece;
-                        Dec->Destination.DestCode = Piece->Destinations[DestIndex].DestCode;
-                        ++Stage->DecisionsCount;
+                        Value = Clamp(Value, Stage->Alpha, Stage->Beta);
+                        Stage->Alpha = Value;
+                        Stage->Beta = Value;
+                        if (!Probe.HasMove || 
+                            !FindSearchDecision(Game, Stage->Board, Probe.FromSquare, 
+                                                Probe.DestCode, SearchDecisionKind_Captures |
+                                                SearchDecisionKind_Quiets, &Stage->BestDecision))
+                        {
+                            Stage->BestDecision.Piece = 0;
+                        }
+                        goto Goto_PruningParent;
                     }
                 }
+                
+                // NOTE(vincent): Few enough pieces left for the endgame tables to know
+                // the outcome.
+                endgame_probe EndgameProbe;
+                if (Endgame && ProbeEndgameTables(Endgame, Game, &EndgameProbe))
+                {
+                    f32 Value = EndgameProbeValue(&EndgameProbe, Game->BlackIsPlaying,
+                                                  Context->CurrentDepth);
+                    Value = Clamp(Value, Stage->Alpha, Stage->Beta);
+                    Stage->Alpha = Value;
+                    Stage->Beta = Value;
+                    Stage->BestDecision.Piece = 0;
+                    goto Goto_PruningParent;
+                }
             }
             
-            for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+            Stage->DecisionIndex = 0;
+            Stage->DecisionsCount = 0;
+            if (Context->CurrentDepth > 0)
             {
-                chess_piece *Piece = Pieces + PieceIndex;
-                u32 PieceDestCount = Piece->DestinationsCount;
-                for (u32 DestIndex = 0; DestIndex < PieceDestCount; ++DestIndex)
+                Stage->HashDecision.Piece = 0;
+                if (ProbeHit && Probe.HasMove)
+                {
+                    FindSearchDecision(Game, Stage->Board, Probe.FromSquare, Probe.DestCode,
+                                       SearchDecisionKind_Captures | SearchDecisionKind_Quiets,
+                                       &Stage->HashDecision);
+                }
+                Stage->Phase = MovePickerPhase_HashDecision;
+            }
+            else
+            {
+                // NOTE(vincent): Push decisions in three passes: the captures that don't lose
+                // material first, best exchange first, then those that don't capture, then
+                // the captures that lose material.
+                // This is the cheapest/simplest way to reorder nodes to get some decent pruning.
+                
+                for (u32 Pass = 0; Pass < 3; ++Pass)
+                {
+                    u32 PassStart = Stage->DecisionsCount;
+                    for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+                    {
+                        chess_piece *Piece = Pieces + PieceIndex;
+                        u32 PieceDestCount = Piece->DestinationsCount;
+                        for (u32 DestIndex = 0; DestIndex < PieceDestCount; ++DestIndex)
+                        {
+                            decision Dec;
+                            Dec.Piece = Piece;
+                            Dec.Destination.DestCode = Piece->Destinations[DestIndex].DestCode;
+                            Dec.PromotionType = ChessPieceType_Empty;
+                            s32 Exchange = 0;
+                            if (Pass != 1 && (Dec.Destination.DestCode >> 6))
+                                Exchange = StaticExchangeEvaluation(Game, Stage->Board, Dec);
+                            b32 InPass = (Pass == 1) ? !(Dec.Destination.DestCode >> 6) :
+                                         ((Dec.Destination.DestCode >> 6) && 
+                                          (Pass == 0) == (Exchange >= 0));
+                            if (InPass)
+                            {
+                                // NOTE(vincent): Insertion by exchange value, stable.
+                                u32 Index = Stage->DecisionsCount++;
+                                for (; Pass == 0 && Index > PassStart && 
+                                     Stage->DecisionScores[Index-1] < (u16)Exchange; --Index)
+                                {
+                                    Stage->Decisions[Index] = Stage->Decisions[Index-1];
+                                    Stage->DecisionScores[Index] = Stage->DecisionScores[Index-1];
+                                }
+                                Stage->Decisions[Index] = Dec;
+                                Stage->DecisionScores[Index] = (u16)Exchange;
+                            }
+                        }
+                    }
+                }
+                
+                if (Params->RootMoveCount)
+                {
+                    u32 KeptCount = 0;
+                    for (u32 DecisionIndex = 0; DecisionIndex < Stage->DecisionsCount; ++DecisionIndex)
+                    {
+                        decision Dec = Stage->Decisions[DecisionIndex];
+                        for (u32 MoveIndex = 0; MoveIndex < Params->RootMoveCount; ++MoveIndex)
+                        {
+                            root_move Move = Params->RootMoves[MoveIndex];
+                            if (Dec.Piece->Row*8 + Dec.Piece->Column == Move.FromSquare &&
+                                Dec.Destination.DestCode == Move.DestCode)
+                            {
+                                Stage->Decisions[KeptCount++] = Dec;
+                                break;
+                            }
+                        }
+                    }
+                    Stage->DecisionsCount = KeptCount;
+                }
+                
+                if (ProbeHit && Probe.HasMove)
                 {
-                    if ((Piece->Destinations[DestIndex].DestCode >> 6) == 0)
+                    // NOTE(vincent): The best move found last time this position was searched
+                    // goes first, the rest keep their order.
+                    for (u32 DecisionIndex = 0; DecisionIndex < Stage->DecisionsCount; ++DecisionIndex)
                     {
-                        decision *Dec = Stage->Decisions + Stage->DecisionsCount;
-                        Dec->Piece = Piece;
-                        Dec->Destination.DestCode = Piece->Destinations[DestIndex].DestCode;
-                        ++Stage->DecisionsCount;
+                        decision Dec = Stage->Decisions[DecisionIndex];
+                        if (Dec.Piece->Row*8 + Dec.Piece->Column == Probe.FromSquare &&
+                            (u32)(Dec.Destination.DestCode & 63) == Probe.DestCode)
+                        {
+                            for (u32 i = DecisionIndex; i > 0; --i)
+                                Stage->Decisions[i] = Stage->Decisions[i-1];
+                            Stage->Decisions[0] = Dec;
+                            break;
+                        }
                     }
                 }
+                Stage->Phase = MovePickerPhase_List;
             }
         }
         
-        for (; Stage->DecisionIndex < Stage->DecisionsCount; ++Stage->DecisionIndex)
+        for (;;)
         {
-            Assert(Game.BlackIsPlaying == (b32)(RootPlayerIsBlack ^ (Context.CurrentDepth & 1)));
+            if (NodeBudget && NodeCount == NodeBudget)
+            {
+                // NOTE(vincent): Game is at this stage's position and the move picker at
+                // the next decision to explore, so the next call can simply resume
+                // from Goto_StageExploration.
+                return false;
+            }
+            
+            decision Decision;
+            if (!PickNextDecision(Game, Stage, &Decision))
+                break;
+            if (Stage->Phase == MovePickerPhase_BadCaptures && Stage->SearchedCount &&
+                Context->CurrentDepth == Stage->Horizon - 1)
+            {
+                // NOTE(vincent): Right before the horizon, a capture that loses material
+                // only looks good because the recapture is never seen. Leave them out,
+                // unless they are all there is.
+                break;
+            }
+            if (!DecisionIsLegal(Game, Stage->Board, Decision))
+                continue;
+            ++Stage->SearchedCount;
+            ++NodeCount;
+            
+            Assert(Game->BlackIsPlaying == (b32)(Search->RootPlayerIsBlack ^ (Context->CurrentDepth & 1)));
             
             // NOTE(vincent): Apply move
-            decision Decision = Stage->Decisions[Stage->DecisionIndex];
             s32 DestRow = Decision.Destination.DestCode & 7;
             s32 DestCol = (Decision.Destination.DestCode >> 3) & 7;
-            Game.Cursor.Row = DestRow;
-            Game.Cursor.Column = DestCol;
-            Game.PieceOnCursor = GetPiece(Game.Blacks, Game.Whites,
-                                          Game.Cursor.Row, Game.Cursor.Column);
-            Assert(!Game.GameIsOver);
-            MovePieceToCursor(&Game, Decision.Piece, Decision.Destination.DestCode);
-            if (Game.PromotingPawn)
-            {
-                Game.PromotingPawn = false;
+            Game->Cursor.Row = DestRow;
+            Game->Cursor.Column = DestCol;
+            Game->PieceOnCursor = GetPiece(Game->Blacks, Game->Whites,
+                                          Game->Cursor.Row, Game->Cursor.Column);
+            Assert(!Game->GameIsOver);
+            MovePieceToCursor(Game, Decision.Piece, Decision.Destination.DestCode);
+            if (Game->PromotingPawn)
+            {
+                Game->PromotingPawn = false;
                 Decision.Piece->Type = ChessPieceType_Queen;
-                history_entry *Entry = Game.History.Entries + Game.History.EntryCount-1;
+                history_entry *Entry = Game->History.Entries + Game->History.EntryCount-1;
                 Decision.PromotionType = ChessPieceType_Queen;
                 Entry->Special |= 7;
-                MovePieceAfterwork(&Game);
+                MovePieceAfterwork(Game);
             }
             else
                 Decision.PromotionType = ChessPieceType_Empty;
-            Assert(!Game.BlackIsPlaying == (b32)(RootPlayerIsBlack ^ (Context.CurrentDepth & 1)));
+            Assert(!Game->BlackIsPlaying == (b32)(Search->RootPlayerIsBlack ^ (Context->CurrentDepth & 1)));
             
-            if (Context.CurrentDepth == 0)
-                LastTopDecision = Decision;
+            Stage->LastDecision = Decision;
             
             f32 Value = 99999.0f;
             
-            if (Game.RunningState == ChessGameRunningState_Checkmate)
-                Value = Game.BlackIsPlaying ? 5000 : -5000;
-            else if (Game.RunningState == ChessGameRunningState_Stalemate)
+            if (Game->RunningState == ChessGameRunningState_Checkmate)
+                Value = CheckmateValue(Context->CurrentDepth + 1, Game->BlackIsPlaying);
+            else if (Game->RunningState == ChessGameRunningState_Stalemate)
                 Value = 0;
-            else if (Context.CurrentDepth == MaxDepth - 1)
-                Value = HeuristicEvaluation(&Game, Series);
+            else if (Context->CurrentDepth == Stage->Horizon - 1)
+                Value = HeuristicEvaluation(Game, PawnTable, Series);
             
             if (Value != 99999.0f)
             {
-                if (Game.BlackIsPlaying && Value > Stage->Alpha)
+                if (Game->BlackIsPlaying && Value > Stage->Alpha)
                 {
                     if (Value >= Stage->Beta)
                     {
@@ -2251,137 +5343,756 @@ PLATFORM_WORK_QUEUE_CALLBACK(GetGoodDecision)
                         // But from the current node, MAX (white) can get more than that
                         // (at least Value, which a candidate for the new alpha here).
                         // This means that MIN's last decision is not rational and we should
-                        // stop exploring the current node. We do not propagate the alpha.
-                        Assert(Context.CurrentDepth > 0);
-                        Stage[-1].DecisionIndex++;
-                        Context.CurrentDepth--;
-                        CopyGame(&Stage[-1].GameCopy, &Game);
-                        goto Goto_StageExploration;
+                        // stop exploring the current node.
+                        // The stage is worth Stage->Beta as far as the parent is concerned.
+                        // That's usually no news to the parent, but it is when mate distance
+                        // pruning lowered Stage->Beta, so let Goto_PruningParent decide.
+                        Assert(Context->CurrentDepth > 0);
+                        Stage->Alpha = Stage->Beta;
+                        Stage->BestDecision = Decision;
+                        StoreKiller(Stage, Decision);
+                        CopyGame(&Stage->GameCopy, Game);
+                        goto Goto_PruningParent;
                     }
                     Stage->Alpha = Value;
-                    if (Context.CurrentDepth == 0)
+                    Stage->BestDecision = Decision;
+                    if (Context->CurrentDepth == 0)
                     {
                         Result->Decision = Decision;
-                        Assert(AbsoluteValue(Result->Value) != 5000);
+                        Result->ExpectedReply.Piece = 0;
                         Assert(Result->Value < Value);
                         Result->Value = Value;
                     }
                 }
-                else if (!Game.BlackIsPlaying && Value < Stage->Beta)
+                else if (!Game->BlackIsPlaying && Value < Stage->Beta)
                 {
                     if (Stage->Alpha >= Value)
                     {
                         // Pruning.
-                        Assert(Context.CurrentDepth > 0);
-                        Stage[-1].DecisionIndex++;
-                        Context.CurrentDepth--;
-                        CopyGame(&Stage[-1].GameCopy, &Game);
-                        goto Goto_StageExploration;
+                        Assert(Context->CurrentDepth > 0);
+                        Stage->Beta = Stage->Alpha;
+                        Stage->BestDecision = Decision;
+                        StoreKiller(Stage, Decision);
+                        CopyGame(&Stage->GameCopy, Game);
+                        goto Goto_PruningParent;
                     }
                     Stage->Beta = Value;
-                    if (Context.CurrentDepth == 0)
+                    Stage->BestDecision = Decision;
+                    if (Context->CurrentDepth == 0)
                     {
                         Result->Decision = Decision;
-                        Assert(AbsoluteValue(Result->Value) != 5000);
+                        Result->ExpectedReply.Piece = 0;
                         Assert(Result->Value > Value);
                         Result->Value = Value;
                     }
                 }
             }
-            else
+            else
+            {
+                Context->CurrentDepth++;
+                Stage[1].Phase = MovePickerPhase_Start;
+                Stage[1].Horizon = Stage->Horizon;
+                if (Stage->Phase == MovePickerPhase_BadCaptures && 
+                    Context->CurrentDepth + 2 < Stage->Horizon)
+                {
+                    // NOTE(vincent): Captures that lose material are searched one ply
+                    // shallower, and again at full depth if they turn out better than
+                    // expected (see Goto_PruningParent).
+                    Stage[1].Horizon--;
+                }
+                Stage[1].Alpha = Stage[0].Alpha;
+                Stage[1].Beta = Stage[0].Beta;
+                Stage[1].BestDecision.Piece = 0;
+                CopyGame(Game, &Stage[1].GameCopy);
+                //Stage[1].GameCopy = *Game;
+                goto Goto_StageExploration;
+            }
+            
+            CopyGame(&Stage->GameCopy, Game);
+        }
+        
+        Goto_PruningParent:
+        
+        
+        // NOTE(vincent): Value of current stage has been fully evaluated...
+        Assert(Stage->Alpha <= Stage->Beta);
+        if (Table)
+        {
+            // NOTE(vincent): Game is at this stage's position here, whichever way we came.
+            f32 Value = Game->BlackIsPlaying ? Stage->Beta : Stage->Alpha;
+            transposition_bound Bound = TranspositionBound_Exact;
+            if (Value <= Stage->OriginalAlpha)
+                Bound = TranspositionBound_Upper;
+            else if (Value >= Stage->OriginalBeta)
+                Bound = TranspositionBound_Lower;
+            u32 Depth = IsPlyDependentValue(Value) ? 0 : Stage->Horizon - Context->CurrentDepth;
+            StoreTransposition(Table, Stage->Key, Depth, Bound, (s32)Value, &Stage->BestDecision);
+        }
+        if (Context->CurrentDepth > 0 && Stage->Horizon < Stage[-1].Horizon)
+        {
+            // NOTE(vincent): The decision leading here was reduced. If it's still better
+            // for the parent than what the parent has, search it again at full depth
+            // before believing it.
+            f32 Value = Game->BlackIsPlaying ? Stage->Beta : Stage->Alpha;
+            if (Game->BlackIsPlaying ? (Value > Stage[-1].Alpha) : (Value < Stage[-1].Beta))
+            {
+                Stage->Horizon = Stage[-1].Horizon;
+                Stage->Phase = MovePickerPhase_Start;
+                Stage->Alpha = Stage[-1].Alpha;
+                Stage->Beta = Stage[-1].Beta;
+                Stage->BestDecision.Piece = 0;
+                goto Goto_StageExploration;
+            }
+        }
+        if (Context->CurrentDepth > 0)
+        {
+            // ...propagate it up to the parent stage if it's better.
+            CopyGame(&Stage[-1].GameCopy, Game);
+            
+            if (Game->BlackIsPlaying && (Stage->Alpha < Stage[-1].Beta))
+            {
+                Stage[-1].Beta = Stage->Alpha;
+                Stage[-1].BestDecision = Stage[-1].LastDecision;
+                if (Context->CurrentDepth == 1)
+                {
+                    Result->Decision = Stage[-1].LastDecision;
+                    Result->ExpectedReply = Stage->BestDecision;
+                    Assert(Result->Value > Stage->Alpha);
+                    Result->Value = Stage->Alpha;
+                }
+                else if (Stage[-1].Beta == Stage[-1].Alpha)
+                {
+                    Context->CurrentDepth--;
+                    Stage--;
+                    StoreKiller(Stage, Stage->LastDecision);
+                    goto Goto_PruningParent;
+                }
+                
+            }
+            else if (!Game->BlackIsPlaying && (Stage->Beta > Stage[-1].Alpha))
+            {
+                Stage[-1].Alpha = Stage->Beta;
+                Stage[-1].BestDecision = Stage[-1].LastDecision;
+                if (Context->CurrentDepth == 1)
+                {
+                    Result->Decision = Stage[-1].LastDecision;
+                    Result->ExpectedReply = Stage->BestDecision;
+                    Assert(Result->Value < Stage->Beta);
+                    Result->Value = Stage->Beta;
+                }
+                else if (Stage[-1].Beta == Stage[-1].Alpha)
+                {
+                    Context->CurrentDepth--;
+                    Stage--;
+                    StoreKiller(Stage, Stage->LastDecision);
+                    goto Goto_PruningParent;
+                }
+            }
+            
+            Context->CurrentDepth--;
+            
+            goto Goto_StageExploration;
+        }
+    }
+    Goto_EndExploration:
+    
+    CopyGame(&Context->Stages[0].GameCopy, Game);
+    if (!Search->AnsweredFromLearning)
+        LearnDecision(Params, Game, Result);
+    if (Result->Decision.Piece)
+    {
+        Assert(Result->Decision.Piece->Destinations && 
+               Result->Decision.Piece->DestinationsCount);
+        Result->Decision.Piece =
+            (chess_piece *)((u8 *)Game_ + ((u8 *)Result->Decision.Piece - (u8 *)Game));
+        Assert(Result->Decision.Piece->Destinations && 
+               Result->Decision.Piece->DestinationsCount);
+    }
+    if (Result->ExpectedReply.Piece)
+    {
+        Result->ExpectedReply.Piece =
+            (chess_piece *)((u8 *)Game_ + ((u8 *)Result->ExpectedReply.Piece - (u8 *)Game));
+    }
+    EndTemporaryMemory(Search->StagesMemory);
+    Params->Search = 0;
+    
+    CompilerWriteBarrier;
+    Params->Finished = true;
+    return true;
+}
+
+PLATFORM_WORK_QUEUE_CALLBACK(GetGoodDecision)
+{
+    // NOTE(vincent): Searches on the queue live in the worker's scratch arena. The slot
+    // arena is only used by time-sliced searches, which outlive a single call.
+    get_good_decision_params *Params = (get_good_decision_params *)Data;
+    Params->Arena = ScratchArena;
+    BeginGoodDecision(Params);
+    ContinueGoodDecision(Params, 0);
+}
+
+// NOTE(vincent): Distributed root split. The game (coordinator) deals the root moves
+// round robin between the search worker processes, and each worker searches its moves
+// one by one with the regular search, reporting the value of each. Whenever a move improves
+// on the best value so far, the coordinator sends the tighter root window to all the workers,
+// so that they start their next move with it.
+
+enum search_message_type
+{
+    SearchMessage_Job,         // coordinator to worker
+    SearchMessage_Window,      // coordinator to worker
+    SearchMessage_Stop,        // coordinator to worker
+    SearchMessage_MoveResult,  // worker to coordinator
+    SearchMessage_Done,        // worker to coordinator
+};
+
+#define MAX_ROOT_MOVES 256
+
+struct search_job_message
+{
+    u32 Type;
+    u32 SearchID;
+    u32 MaxDepth;
+    s32 Alpha;
+    s32 Beta;
+    u32 RootMoveCount;
+    root_move RootMoves[MAX_ROOT_MOVES];
+    u64 GameAddress;  // where Game was in the coordinator, to relocate its pointers
+    chess_game_state Game;
+};
+
+// NOTE(vincent): Used for Window, Stop and Done.
+struct search_control_message
+{
+    u32 Type;
+    u32 SearchID;
+    s32 Alpha;
+    s32 Beta;
+};
+
+struct search_result_message
+{
+    u32 Type;
+    u32 SearchID;
+    root_move Move;
+    b32 Improved;  // Value is exact, otherwise the move doesn't beat the window it was given
+    s32 Value;
+    b32 HasReply;
+    root_move Reply;
+};
+
+internal void
+RelocateGamePointers(chess_game_state *Game, u8 *OldAddress)
+{
+    // NOTE(vincent): Like CopyGameRelocated(), for a game that was copied as bytes from
+    // OldAddress (which may not even be in this process).
+    for (u32 i = 0; i < 16; ++i)
+    {
+        if (Game->Blacks[i].Destinations)
+        {
+            Game->Blacks[i].Destinations = 
+                (destination *)((u8 *)Game + ((u8 *)Game->Blacks[i].Destinations - OldAddress));
+        }
+        if (Game->Whites[i].Destinations)
+        {
+            Game->Whites[i].Destinations = 
+                (destination *)((u8 *)Game + ((u8 *)Game->Whites[i].Destinations - OldAddress));
+        }
+    }
+    if (Game->SelectedPiece.Piece)
+    {
+        Game->SelectedPiece.Piece =
+            (chess_piece *)((u8 *)Game + ((u8 *)Game->SelectedPiece.Piece - OldAddress));
+    }
+    if (Game->PieceOnCursor.Piece)
+    {
+        Game->PieceOnCursor.Piece =
+            (chess_piece *)((u8 *)Game + ((u8 *)Game->PieceOnCursor.Piece - OldAddress));
+    }
+}
+
+internal root_move
+RootMoveFromDecision(decision Decision)
+{
+    root_move Result;
+    Result.FromSquare = (u8)(Decision.Piece->Row*8 + Decision.Piece->Column);
+    Result.DestCode = Decision.Destination.DestCode;
+    return Result;
+}
+
+internal decision
+DecisionFromRootMove(chess_piece *Pieces, root_move Move)
+{
+    // NOTE(vincent): The piece doesn't need to be able to play Move in this position.
+    // Expected replies are named from the position before our own move.
+    decision Result = {};
+    for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+    {
+        chess_piece *Piece = Pieces + PieceIndex;
+        if (Piece->Type != ChessPieceType_Empty && 
+            Piece->Row*8 + Piece->Column == Move.FromSquare)
+        {
+            Result.Piece = Piece;
+            Result.Destination.DestCode = Move.DestCode;
+            u32 DestRow = Move.DestCode & 7;
+            if (Piece->Type == ChessPieceType_Pawn && (DestRow == 0 || DestRow == 7))
+                Result.PromotionType = ChessPieceType_Queen;
+            break;
+        }
+    }
+    return Result;
+}
+
+internal void
+SendSearchControl(search_cluster *Cluster, u32 WorkerIndex, search_message_type Type, 
+                  s32 Alpha, s32 Beta)
+{
+    search_control_message Message = {(u32)Type, Cluster->SearchID, Alpha, Beta};
+    GlobalPlatform->SendChannelMessage(Cluster->Workers[WorkerIndex], &Message, sizeof(Message));
+}
+
+PLATFORM_WORK_QUEUE_CALLBACK(GetDistributedDecision)
+{
+    get_good_decision_params *Params = (get_good_decision_params *)Data;
+    search_cluster *Cluster = Params->Cluster;
+    chess_game_state *Game = Params->Game;
+    chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+    chess_piece *Opponents = Game->BlackIsPlaying ? Game->Whites : Game->Blacks;
+    Assert(Game->DestinationsAreCurrent);
+    
+    if (LookUpLearnedDecision(Params, Game, &Params->Result))
+    {
+        CompilerWriteBarrier;
+        Params->Finished = true;
+        return;
+    }
+    
+    if (AtomicCompareExchangeU32(&Cluster->Busy, 1, 0) != 0)
+    {
+        // NOTE(vincent): Another search has the workers.
+        GetGoodDecision(Queue, Data, ScratchArena);
+        return;
+    }
+    Cluster->SearchID++;
+    
+    // NOTE(vincent): Root moves in the order the regular search would try them,
+    // captures first.
+    root_move *Moves = PushArray(ScratchArena, MAX_ROOT_MOVES, root_move);
+    u32 MoveCount = 0;
+    for (u32 Pass = 0; Pass < 2; ++Pass)
+    {
+        for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+        {
+            chess_piece *Piece = Pieces + PieceIndex;
+            for (u32 DestIndex = 0; DestIndex < Piece->DestinationsCount; ++DestIndex)
+            {
+                b32 IsCapture = (Piece->Destinations[DestIndex].DestCode >> 6);
+                if (IsCapture == (Pass == 0) && MoveCount < MAX_ROOT_MOVES)
+                {
+                    Moves[MoveCount].FromSquare = (u8)(Piece->Row*8 + Piece->Column);
+                    Moves[MoveCount].DestCode = Piece->Destinations[DestIndex].DestCode;
+                    ++MoveCount;
+                }
+            }
+        }
+    }
+    
+    s32 Alpha = (s32)Params->RootAlpha;
+    s32 Beta = (s32)Params->RootBeta;
+    u32 WorkerCount = Minimum(Cluster->WorkerCount, MoveCount);
+    b32 WorkerIsRunning[MAX_SEARCH_WORKER_COUNT] = {};
+    u32 RunningCount = 0;
+    b32 WorkerFailed = false;
+    
+    Assert(sizeof(search_job_message) <= SEARCH_MESSAGE_MAX_SIZE);
+    search_job_message *Job = PushStruct(ScratchArena, search_job_message);
+    for (u32 WorkerIndex = 0; WorkerIndex < WorkerCount; ++WorkerIndex)
+    {
+        Job->Type = SearchMessage_Job;
+        Job->SearchID = Cluster->SearchID;
+        Job->MaxDepth = Params->MaxDepth;
+        Job->Alpha = Alpha;
+        Job->Beta = Beta;
+        Job->RootMoveCount = 0;
+        for (u32 MoveIndex = WorkerIndex; MoveIndex < MoveCount; MoveIndex += WorkerCount)
+            Job->RootMoves[Job->RootMoveCount++] = Moves[MoveIndex];
+        Job->GameAddress = (u64)(uintptr_t)Game;
+        Job->Game = *Game;
+        if (GlobalPlatform->SendChannelMessage(Cluster->Workers[WorkerIndex], Job, sizeof(*Job)))
+        {
+            WorkerIsRunning[WorkerIndex] = true;
+            ++RunningCount;
+        }
+        else
+            WorkerFailed = true;
+    }
+    
+    b32 Improved = false;
+    search_result_message Best = {};
+    b32 StopSent = false;
+    u8 *Message = PushArray(ScratchArena, SEARCH_MESSAGE_MAX_SIZE, u8);
+    while (RunningCount)
+    {
+        if (!StopSent && WorkIsCancelled(&Params->CancelToken))
+        {
+            for (u32 WorkerIndex = 0; WorkerIndex < WorkerCount; ++WorkerIndex)
             {
-                Assert(AbsoluteValue(Value) != 5000);
-                Context.CurrentDepth++;
-                Stage[1].DecisionIndex = 0;
-                Stage[1].DecisionsCount = 0;
-                Stage[1].Alpha = Stage[0].Alpha;
-                Stage[1].Beta = Stage[0].Beta;
-                CopyGame(&Game, &Stage[1].GameCopy);
-                //Stage[1].GameCopy = *Game;
-                goto Goto_StageExploration;
+                if (WorkerIsRunning[WorkerIndex])
+                    SendSearchControl(Cluster, WorkerIndex, SearchMessage_Stop, Alpha, Beta);
             }
-            
-            CopyGame(&Stage->GameCopy, &Game);
+            StopSent = true;
         }
         
-        Goto_PruningParent:
-        
-        
-        // NOTE(vincent): Value of current stage has been fully evaluated...
-        Assert(Stage->Alpha <= Stage->Beta);
-        if (Context.CurrentDepth > 0)
+        platform_channel *Running[MAX_SEARCH_WORKER_COUNT];
+        u32 RunningIndices[MAX_SEARCH_WORKER_COUNT];
+        u32 Count = 0;
+        for (u32 WorkerIndex = 0; WorkerIndex < WorkerCount; ++WorkerIndex)
         {
-            // ...propagate it up to the parent stage if it's better.
-            CopyGame(&Stage[-1].GameCopy, &Game);
-            
-            if (Game.BlackIsPlaying && (Stage->Alpha < Stage[-1].Beta))
+            if (WorkerIsRunning[WorkerIndex])
             {
-                Stage[-1].Beta = Stage->Alpha;
-                if (Context.CurrentDepth == 1)
-                {
-                    Result->Decision = LastTopDecision;
-                    Assert(Result->Value > Stage->Alpha);
-                    Result->Value = Stage->Alpha;
-                }
-                else if (Stage[-1].Beta == Stage[-1].Alpha)
-                {
-                    Context.CurrentDepth--;
-                    Stage--;
-                    goto Goto_PruningParent;
-                }
-                
+                Running[Count] = Cluster->Workers[WorkerIndex];
+                RunningIndices[Count++] = WorkerIndex;
             }
-            else if (!Game.BlackIsPlaying && (Stage->Beta > Stage[-1].Alpha))
+        }
+        s32 Ready = GlobalPlatform->WaitForChannelMessage(Running, Count, 10);
+        if (Ready < 0)
+            continue;
+        
+        u32 WorkerIndex = RunningIndices[Ready];
+        u32 MessageSize = GlobalPlatform->ReceiveChannelMessage(Cluster->Workers[WorkerIndex], 
+                                                                Message, SEARCH_MESSAGE_MAX_SIZE,
+                                                                true);
+        u32 Type = MessageSize >= sizeof(u32) ? *(u32 *)Message : (u32)SearchMessage_Done;
+        if (!MessageSize)
+        {
+            WorkerFailed = true;
+            WorkerIsRunning[WorkerIndex] = false;
+            --RunningCount;
+        }
+        else if (Type == SearchMessage_Done && MessageSize == sizeof(search_control_message) &&
+                 ((search_control_message *)Message)->SearchID == Cluster->SearchID)
+        {
+            WorkerIsRunning[WorkerIndex] = false;
+            --RunningCount;
+        }
+        else if (Type == SearchMessage_MoveResult && 
+                 MessageSize == sizeof(search_result_message) &&
+                 ((search_result_message *)Message)->SearchID == Cluster->SearchID)
+        {
+            search_result_message *Result = (search_result_message *)Message;
+            b32 IsBetter = Game->BlackIsPlaying ? (Result->Value < Beta) : (Result->Value > Alpha);
+            if (Result->Improved && IsBetter)
             {
-                Stage[-1].Alpha = Stage->Beta;
-                if (Context.CurrentDepth == 1)
-                {
-                    Result->Decision = LastTopDecision;
-                    Assert(Result->Value < Stage->Beta);
-                    Result->Value = Stage->Beta;
-                }
-                else if (Stage[-1].Beta == Stage[-1].Alpha)
+                Improved = true;
+                Best = *Result;
+                if (Game->BlackIsPlaying)
+                    Beta = Result->Value;
+                else
+                    Alpha = Result->Value;
+                for (u32 Other = 0; Other < WorkerCount; ++Other)
                 {
-                    Context.CurrentDepth--;
-                    Stage--;
-                    goto Goto_PruningParent;
+                    if (WorkerIsRunning[Other] && Other != WorkerIndex)
+                        SendSearchControl(Cluster, Other, SearchMessage_Window, Alpha, Beta);
                 }
             }
-            
-            Stage[-1].DecisionIndex++;
-            Context.CurrentDepth--;
-            
-            goto Goto_StageExploration;
         }
     }
-    Goto_EndExploration:
     
-    EndTemporaryMemory(StagesMemory);
-    CheckArena(Arena);
-    CopyGame(&Context.Stages[0].GameCopy, &Game);
-    Assert(Result->Decision.Piece->Destinations && 
-           Result->Decision.Piece->DestinationsCount);
-    Result->Decision.Piece =
-        (chess_piece *)((u8 *)Game_ + ((u8 *)Result->Decision.Piece - (u8 *)&Game));
-    Assert(Result->Decision.Piece->Destinations && 
-           Result->Decision.Piece->DestinationsCount);
+    CompilerWriteBarrier;
+    Cluster->Busy = 0;
+    
+    if (WorkerFailed && !StopSent)
+    {
+        // NOTE(vincent): Some root moves may not have been searched at all.
+        GetGoodDecision(Queue, Data, ScratchArena);
+        return;
+    }
+    
+    good_decision_result *Result = &Params->Result;
+    Result->Decision.Piece = 0;
+    Result->ExpectedReply.Piece = 0;
+    Result->Value = Game->BlackIsPlaying ? Params->RootBeta : Params->RootAlpha;
+    if (Improved)
+    {
+        Result->Decision = DecisionFromRootMove(Pieces, Best.Move);
+        if (Best.HasReply)
+            Result->ExpectedReply = DecisionFromRootMove(Opponents, Best.Reply);
+        Result->Value = (f32)Best.Value;
+        LearnDecision(Params, Game, Result);
+    }
     
     CompilerWriteBarrier;
     Params->Finished = true;
 }
 
+// NOTE(vincent): State of a search worker process, at the start of its game memory.
+struct search_worker_state
+{
+    b32 IsInitialized;
+    memory_arena Arena;
+    random_series Series;
+    transposition_table Table;
+    pawn_table PawnTable;
+    endgame_tables *Endgame;
+};
+
+extern "C"
+GAME_SERVE_SEARCH_JOB(GameServeSearchJob)
+{
+    GlobalPlatform = &Memory->Platform;
+    search_worker_state *Worker = (search_worker_state *)Memory->Storage;
+    if (!Worker->IsInitialized)
+    {
+        InitializeArena(&Worker->Arena, Memory->StorageSize - sizeof(search_worker_state),
+                        (u8 *)Memory->Storage + sizeof(search_worker_state));
+        Worker->Series = RandomSeries(43);
+        
+        // NOTE(vincent): With CHESS_SHARED_TABLE, the workers and the game all share one table.
+        platform_page_kind PageKind = PlatformPageKind_Default;
+        void *TableMemory = 0;
+        if (Memory->SharedTableName)
+        {
+            TableMemory = OpenSharedTranspositionEntries(Memory->SharedTableName,
+                                                         TRANSPOSITION_TABLE_ENTRY_COUNT,
+                                                         &PageKind);
+        }
+        if (!TableMemory)
+        {
+            TableMemory = 
+                GlobalPlatform->AllocateLargeMemory(TRANSPOSITION_TABLE_ENTRY_COUNT * 
+                                                    sizeof(transposition_entry), &PageKind);
+        }
+        InitializeTranspositionTable(&Worker->Table, TableMemory, 
+                                     TRANSPOSITION_TABLE_ENTRY_COUNT, PageKind);
+        
+        platform_page_kind PawnPageKind;
+        void *PawnMemory = 
+            GlobalPlatform->AllocateLargeMemory(PAWN_TABLE_ENTRY_COUNT * sizeof(pawn_entry),
+                                                &PawnPageKind);
+        InitializePawnTable(&Worker->PawnTable, PawnMemory, PAWN_TABLE_ENTRY_COUNT);
+        
+        // NOTE(vincent): Workers use the bitbase file if it's there, but leave generating 
+        // it to the game.
+        Worker->Endgame = PushStruct(&Worker->Arena, endgame_tables);
+        InitializeEndgameTables(Worker->Endgame);
+        memory_index BitbaseFileSize = 0;
+        u8 *BitbaseFile = (u8 *)GlobalPlatform->MapReadOnlyFile(BITBASE_FILENAME, &BitbaseFileSize);
+        LoadBitbases(Worker->Endgame, BitbaseFile, BitbaseFileSize);
+        Worker->IsInitialized = true;
+    }
+    
+    search_job_message *Job = (search_job_message *)Message;
+    if (MessageSize != sizeof(search_job_message) || Job->Type != SearchMessage_Job)
+        return;
+    
+    chess_game_state *Game = &Job->Game;
+    RelocateGamePointers(Game, (u8 *)(uintptr_t)Job->GameAddress);
+    s32 Alpha = Job->Alpha;
+    s32 Beta = Job->Beta;
+    b32 Stopped = false;
+    for (u32 MoveIndex = 0; MoveIndex < Job->RootMoveCount && !Stopped; ++MoveIndex)
+    {
+        search_control_message Control;
+        while (GlobalPlatform->ReceiveChannelMessage(Channel, &Control, sizeof(Control), false))
+        {
+            if (Control.SearchID != Job->SearchID)
+                continue;
+            if (Control.Type == SearchMessage_Stop)
+                Stopped = true;
+            else if (Control.Type == SearchMessage_Window)
+            {
+                Alpha = Maximum(Alpha, Control.Alpha);
+                Beta = Minimum(Beta, Control.Beta);
+            }
+        }
+        if (Stopped || Alpha >= Beta)
+            break;
+        
+        get_good_decision_params Params = {};
+        Params.Game = Game;
+        Params.Arena = &Worker->Arena;
+        Params.Series = &Worker->Series;
+        Params.MaxDepth = Job->MaxDepth;
+        Params.Table = &Worker->Table;
+        Params.PawnTable = &Worker->PawnTable;
+        Params.Endgame = Worker->Endgame;
+        Params.RootAlpha = (f32)Alpha;
+        Params.RootBeta = (f32)Beta;
+        Params.RootMoves = Job->RootMoves + MoveIndex;
+        Params.RootMoveCount = 1;
+        BeginGoodDecision(&Params);
+        ContinueGoodDecision(&Params, 0);
+        
+        search_result_message Result = {};
+        Result.Type = SearchMessage_MoveResult;
+        Result.SearchID = Job->SearchID;
+        Result.Move = Job->RootMoves[MoveIndex];
+        Result.Improved = (Params.Result.Decision.Piece != 0);
+        Result.Value = (s32)Params.Result.Value;
+        if (Params.Result.ExpectedReply.Piece)
+        {
+            Result.HasReply = true;
+            Result.Reply = RootMoveFromDecision(Params.Result.ExpectedReply);
+        }
+        if (Result.Improved)
+        {
+            if (Game->BlackIsPlaying)
+                Beta = Result.Value;
+            else
+                Alpha = Result.Value;
+        }
+        GlobalPlatform->SendChannelMessage(Channel, &Result, sizeof(Result));
+    }
+    
+    search_control_message Done = {SearchMessage_Done, Job->SearchID, Alpha, Beta};
+    GlobalPlatform->SendChannelMessage(Channel, &Done, sizeof(Done));
+}
+
+internal void
+ApplyDecision(chess_game_state *Game, decision Decision)
+{
+    // NOTE(vincent): Plays a decision without any of the animation work.
+    Game->Cursor.Row = Decision.Destination.DestCode & 7;
+    Game->Cursor.Column = (Decision.Destination.DestCode >> 3) & 7;
+    Game->PieceOnCursor = GetPiece(Game->Blacks, Game->Whites,
+                                   Game->Cursor.Row, Game->Cursor.Column);
+    MovePieceToCursor(Game, Decision.Piece, Decision.Destination.DestCode);
+    if (Game->PromotingPawn)
+    {
+        Game->PromotingPawn = false;
+        chess_piece_type PromotionType = Decision.PromotionType;
+        if (PromotionType == ChessPieceType_Empty)
+            PromotionType = ChessPieceType_Queen;
+        Decision.Piece->Type = PromotionType;
+        history_entry *Entry = Game->History.Entries + Game->History.EntryCount-1;
+        SetPromotionBits(Entry, PromotionType);
+        MovePieceAfterwork(Game);
+    }
+}
+
+internal b32
+GamesHaveSamePosition(chess_game_state *A, chess_game_state *B)
+{
+    // NOTE(vincent): Same player to move and same pieces on the same squares, having
+    // moved the same number of times (castling rights and en passant follow from that,
+    // since both games come from the same history).
+    b32 Result = (A->BlackIsPlaying == B->BlackIsPlaying);
+    for (u32 i = 0; Result && i < 32; ++i)
+    {
+        chess_piece *PieceA = A->Blacks + i;
+        chess_piece *PieceB = B->Blacks + i;
+        Result = (PieceA->Type == PieceB->Type &&
+                  PieceA->Row == PieceB->Row &&
+                  PieceA->Column == PieceB->Column &&
+                  PieceA->MoveCount == PieceB->MoveCount);
+    }
+    return Result;
+}
+
+// NOTE(vincent): Without worker threads, the search is spread over frames.
+// This is the number of moves it gets to play each frame.
+#define AI_NODES_PER_FRAME 500
+
+internal void
+SubmitAISearch(ai_state *AIState, chess_game_state *Game, u32 MaxDepth, ai_slot *Slot,
+               platform_work_queue *Queue, b32 TimeSliceSearch, platform_work_priority Priority)
+{
+    Assert(!AIState->SearchIsInFlight);
+    UpdateDestinations(Game);
+    AIState->WorkParams.Game = Game;
+    AIState->WorkParams.Arena = &Slot->Arena;
+    AIState->WorkParams.Series = &Slot->Series;
+    AIState->WorkParams.Table = Slot->Table;
+    AIState->WorkParams.Learning = Slot->Learning;
+    AIState->WorkParams.PawnTable = Slot->PawnTable;
+    AIState->WorkParams.Endgame = Slot->Endgame;
+    AIState->WorkParams.RootAlpha = -10000.0f;
+    AIState->WorkParams.RootBeta = 10000.0f;
+    AIState->WorkParams.RootMoves = 0;
+    AIState->WorkParams.RootMoveCount = 0;
+    
+    // NOTE(vincent): Only the searches someone is waiting for go to the worker processes.
+    b32 UseCluster = (Slot->Cluster && Slot->Cluster->WorkerCount && 
+                      Priority == PlatformWorkPriority_Interactive);
+    AIState->WorkParams.Cluster = UseCluster ? Slot->Cluster : 0;
+    AIState->WorkParams.MaxDepth = MaxDepth;
+    AIState->WorkParams.Finished = false;
+    AIState->WorkParams.CancelToken.Cancelled = false;
+    AIState->SearchIsTimeSliced = TimeSliceSearch;
+    AIState->SearchIsInFlight = true;
+    
+    good_decision_result *Result = &AIState->WorkParams.Result;
+    if (LookUpBookDecision(Slot->Book, Game, MaxDepth, &Slot->Series, &Result->Decision))
+    {
+        // NOTE(vincent): Nothing to search, the search is "done" as soon as submitted.
+        Result->ExpectedReply.Piece = 0;
+        Result->Value = 0;
+        AIState->WorkParams.Finished = true;
+    }
+    else if (TimeSliceSearch)
+        BeginGoodDecision(&AIState->WorkParams);
+    else
+        GlobalPlatform->AddEntry(Queue, UseCluster ? GetDistributedDecision : GetGoodDecision,
+                                 &AIState->WorkParams,
+                                 &AIState->SearchHandle, Priority, 
+                                 &AIState->WorkParams.CancelToken);
+}
 
 internal void
-AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series *Series,
-                memory_arena *Arena, platform_work_queue *Queue)
+AdvanceAIAction(game_state *State, chess_game_state *Game, ai_slot *Slot, f32 dt,
+                platform_work_queue *Queue, u32 NodesPerFrame, b32 Animate)
 {
+    // NOTE(vincent): NodesPerFrame is 0 when searches go to the work queue, otherwise
+    // they are time-sliced on this thread. Without Animate, the move is played as soon
+    // as the decision is known.
     cursor *Cursor = &Game->Cursor;
     ai_state *AIState = &Game->AIState;
+    memory_arena *Arena = &Slot->Arena;
+    random_series *Series = &Slot->Series;
+    b32 TimeSliceSearch = (NodesPerFrame != 0);
+    platform_work_priority Priority = (Animate ? PlatformWorkPriority_Interactive : 
+                                       PlatformWorkPriority_Background);
     
     switch(AIState->Stage)
     {
         case 0:
         {
+            if (AIState->SearchIsPondering)
+            {
+                AIState->SearchIsPondering = false;
+                if (GamesHaveSamePosition(AIState->WorkParams.Game, Game))
+                {
+                    // NOTE(vincent): Ponder hit, the search is already running (or done)
+                    // on the position we're in. It went in as background work, which
+                    // never goes to the worker processes (and the queue can't change the
+                    // priority of an entry), so when there are workers to use a search
+                    // that isn't done gets cancelled and submitted again as interactive.
+                    // It only keeps what it left in the transposition table.
+                    b32 WantsCluster = (Slot->Cluster && Slot->Cluster->WorkerCount &&
+                                        Priority == PlatformWorkPriority_Interactive &&
+                                        !AIState->SearchIsTimeSliced);
+                    if (AIState->WorkParams.Finished || !WantsCluster)
+                    {
+                        AIState->Stage = 1;
+                        break;
+                    }
+                }
+                CancelWork(&AIState->WorkParams.CancelToken);
+            }
+            
+            if (AIState->SearchIsInFlight)
+            {
+                // NOTE(vincent): A cancelled search may still be running on a worker thread
+                // and using Arena and WorkParams. Wait for it before submitting a new one.
+                // (If it was cancelled before it started, it never sets Finished, but its
+                // handle still completes.)
+                if (AIState->SearchIsTimeSliced && !AIState->WorkParams.Finished)
+                    ContinueGoodDecision(&AIState->WorkParams, 0);
+                if (AIState->SearchHandle.PendingCount)
+                    break;
+                AIState->SearchIsInFlight = false;
+            }
+            
             u32 AIType = Game->BlackIsPlaying ? Game->BlackAI : Game->WhiteAI;
             if (AIType == 1)
             {
@@ -2397,18 +6108,12 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
                     good_decision_result DecResult = 
                         GetGoodDecisionTEST(Game, Arena, Series, Depth); 
                     Decision = DecResult.Decision;
-                    if (AbsoluteValue(DecResult.Value) == 5000)
+                    if (IsCheckmateValue(DecResult.Value))
                         break;
                 }
 #else
                 // fixed max depth
-                AIState->WorkParams.Game = Game;
-                AIState->WorkParams.Arena = Arena;
-                AIState->WorkParams.Series = Series;
-                AIState->WorkParams.MaxDepth = AIType - 1;
-                AIState->WorkParams.Finished = false;
-                AIState->WorkParams.ShouldContinue = true;
-                GlobalPlatform->AddEntry(Queue, GetGoodDecision, &AIState->WorkParams);
+                SubmitAISearch(AIState, Game, AIType - 1, Slot, Queue, TimeSliceSearch, Priority);
                 //GetGoodDecision(Queue, &AIState->WorkParams);
 #endif
             }
@@ -2418,8 +6123,32 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
         
         case 1:
         {
+            if (AIState->SearchIsTimeSliced && !AIState->WorkParams.Finished)
+                ContinueGoodDecision(&AIState->WorkParams, NodesPerFrame);
+            
             if (AIState->WorkParams.Finished)
             {
+                AIState->SearchIsInFlight = false;
+                AIState->SearchIsPipelined = false;
+                if (AIState->WorkParams.Game != Game)
+                {
+                    // NOTE(vincent): The search ran on the snapshot (pipelined or pondering),
+                    // so the decisions refer to pieces of the snapshot.
+                    chess_game_state *Snapshot = AIState->WorkParams.Game;
+                    Assert(Snapshot == Slot->Snapshot);
+                    good_decision_result *Result = &AIState->WorkParams.Result;
+                    Result->Decision.Piece = 
+                        (chess_piece *)((u8 *)Game + ((u8 *)Result->Decision.Piece - 
+                                                      (u8 *)Snapshot));
+                    if (Result->ExpectedReply.Piece)
+                    {
+                        Result->ExpectedReply.Piece = 
+                            (chess_piece *)((u8 *)Game + ((u8 *)Result->ExpectedReply.Piece - 
+                                                          (u8 *)Snapshot));
+                    }
+                    AIState->WorkParams.Game = Game;
+                }
+                UpdateDestinations(Game);
                 Assert(AIState->WorkParams.Result.Decision.Piece->Destinations &&
                        AIState->WorkParams.Result.Decision.Piece->DestinationsCount);
                 AIState->OldCursorRow = Cursor->Row;
@@ -2439,7 +6168,7 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
         
         case 2:
         {
-            if (AIState->t > MOVE_CURSOR_DURATION)
+            if (!Animate || AIState->t > MOVE_CURSOR_DURATION)
             {
                 decision Decision = AIState->WorkParams.Result.Decision;
                 // NOTE(vincent): Select the piece
@@ -2482,6 +6211,55 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
                 }
                 else
                 {
+                    // NOTE(vincent): When the other player is an AI too, the position it
+                    // will search is known now, so start its search on a snapshot instead
+                    // of leaving the workers idle during the stage 3 animation.
+                    u32 NextAIType = Game->BlackIsPlaying ? Game->BlackAI : Game->WhiteAI;
+                    u32 AIType = Game->BlackIsPlaying ? Game->WhiteAI : Game->BlackAI;
+                    if (Game->WhiteAI && Game->BlackAI && NextAIType >= 2 &&
+                        !AIState->SearchIsInFlight)
+                    {
+                        chess_game_state *Snapshot = Slot->Snapshot;
+                        CopyGameRelocated(Game, Snapshot);
+                        SubmitAISearch(AIState, Snapshot, NextAIType - 1, Slot, Queue,
+                                       TimeSliceSearch, Priority);
+                        AIState->SearchIsPipelined = true;
+                    }
+                    else if (!NextAIType && AIType >= 2 &&
+                             AIState->WorkParams.Result.ExpectedReply.Piece &&
+                             !AIState->SearchIsInFlight)
+                    {
+                        // NOTE(vincent): Pondering. While the human thinks, search the position
+                        // after the reply our own search expected from them. If they play it,
+                        // stage 0 picks up that search instead of starting from scratch.
+                        chess_game_state *Snapshot = Slot->Snapshot;
+                        CopyGameRelocated(Game, Snapshot);
+                        UpdateDestinations(Snapshot);
+                        decision Reply = AIState->WorkParams.Result.ExpectedReply;
+                        Reply.Piece = (chess_piece *)((u8 *)Snapshot + 
+                                                      ((u8 *)Reply.Piece - (u8 *)Game));
+                        b32 ReplyIsLegal = false;
+                        for (u32 DestIndex = 0; DestIndex < Reply.Piece->DestinationsCount; ++DestIndex)
+                        {
+                            if (Reply.Piece->Destinations[DestIndex].DestCode == 
+                                Reply.Destination.DestCode)
+                            {
+                                ReplyIsLegal = true;
+                            }
+                        }
+                        
+                        if (ReplyIsLegal)
+                        {
+                            ApplyDecision(Snapshot, Reply);
+                            if (!Snapshot->GameIsOver)
+                            {
+                                SubmitAISearch(AIState, Snapshot, AIType - 1, Slot, Queue,
+                                               TimeSliceSearch, PlatformWorkPriority_Background);
+                                AIState->SearchIsPondering = true;
+                            }
+                        }
+                    }
+                    
                     Game->BlackIsPlaying = !Game->BlackIsPlaying;
                     AIState->Stage++;
                 }
@@ -2494,7 +6272,13 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
         
         case 3:
         {
-            if (AIState->t > MOVE_PIECE_DURATION)
+            if (AIState->SearchIsPipelined && AIState->SearchIsTimeSliced &&
+                !AIState->WorkParams.Finished)
+            {
+                ContinueGoodDecision(&AIState->WorkParams, NodesPerFrame);
+            }
+            
+            if (!Animate || AIState->t > MOVE_PIECE_DURATION)
             {
                 // NOTE(vincent): reestablish older cursor position for the other player
                 // if the other player is human. When the other player is also an AI,
@@ -2507,7 +6291,7 @@ AdvanceAIAction(game_state *State, chess_game_state *Game, f32 dt, random_series
                     v2 NewCursorP = GetBoardSpaceV2(Cursor->Row, Cursor->Column);
                     InitMovingV2FromCurrent(&Cursor->P, NewCursorP, MOVE_CURSOR_DURATION);
                 }
-                AIState->Stage = 0;
+                AIState->Stage = AIState->SearchIsPipelined ? 1 : 0;
                 State->ShouldSave = true;
                 Game->BlackIsPlaying = !Game->BlackIsPlaying;
             }
@@ -2588,6 +6372,110 @@ LoadSaveFile(game_state *State, memory_arena *FileArena)
     EndTemporaryMemory(FileTempMemory);
 }
 
+internal void
+CancelAISearch(ai_state *AIState)
+{
+    CancelWork(&AIState->WorkParams.CancelToken);
+    if (AIState->SearchIsInFlight && AIState->SearchIsTimeSliced && 
+        !AIState->WorkParams.Finished)
+    {
+        // NOTE(vincent): Nobody else is going to run it; let it see the cancellation now
+        // so that it releases its memory.
+        ContinueGoodDecision(&AIState->WorkParams, 0);
+    }
+    if (AIState->Stage == 1)
+        AIState->Stage = 0;
+    AIState->SearchIsPipelined = false;
+    AIState->SearchIsPondering = false;
+}
+
+internal b32
+GameRunsInBackground(game_state *State, chess_game_state *Game)
+{
+    b32 Result = (State->SimulateBackgroundGames && Game->WhiteAI && Game->BlackAI &&
+                  !Game->GameIsOver);
+    return Result;
+}
+
+// NOTE(vincent): Background games save the state at most this often (in seconds),
+// instead of after every move.
+#define BACKGROUND_SAVE_PERIOD 5.0f
+
+internal void
+AdvanceBackgroundGames(game_state *State, platform_work_queue *Queue, f32 dt, 
+                       b32 TimeSliceSearch)
+{
+    u32 VisibleGameIndex = (State->GameMode == GameMode_StartScreen ? 
+                            State->GamesCount : State->CurrentGameIndex);
+    u32 BackgroundCount = 0;
+    for (u32 GameIndex = 0; GameIndex < State->GamesCount; ++GameIndex)
+    {
+        if (GameIndex != VisibleGameIndex && GameRunsInBackground(State, State->Games + GameIndex))
+            ++BackgroundCount;
+    }
+    
+    if (BackgroundCount)
+    {
+        // NOTE(vincent): Without worker threads, the games share the frame's budget.
+        u32 NodesPerFrame = 0;
+        if (TimeSliceSearch)
+            NodesPerFrame = Maximum(AI_NODES_PER_FRAME / BackgroundCount, (u32)1);
+        
+        b32 ShouldSave = State->ShouldSave;
+        for (u32 GameIndex = 0; GameIndex < State->GamesCount; ++GameIndex)
+        {
+            chess_game_state *Game = State->Games + GameIndex;
+            if (GameIndex != VisibleGameIndex && GameRunsInBackground(State, Game))
+            {
+                // NOTE(vincent): Without animations, the stages only wait on the search,
+                // so a game can go through several of them in one frame.
+                u32 EntryCount = Game->History.EntryCount;
+                for (u32 Step = 0; Step < 4 && !Game->GameIsOver; ++Step)
+                {
+                    u32 OldStage = Game->AIState.Stage;
+                    AdvanceAIAction(State, Game, State->AISlots + GameIndex, dt, Queue,
+                                    NodesPerFrame, false);
+                    if (Game->AIState.Stage == OldStage)
+                        break;
+                }
+                if (Game->History.EntryCount != EntryCount)
+                    State->BackgroundGamesMoved = true;
+            }
+        }
+        State->ShouldSave = ShouldSave;
+    }
+    
+    State->BackgroundSaveT += dt;
+    if (State->BackgroundSaveT > BACKGROUND_SAVE_PERIOD)
+    {
+        State->BackgroundSaveT = 0.0f;
+        if (State->BackgroundGamesMoved)
+        {
+            State->BackgroundGamesMoved = false;
+            State->ShouldSave = true;
+        }
+    }
+}
+
+internal void
+WaitForAISearches(game_state *State, platform_work_queue *Queue)
+{
+    // NOTE(vincent): Searches hold pointers to their game and to its AI slot, which are
+    // both found by game index. Stop them all before games get shifted around.
+    for (u32 GameIndex = 0; GameIndex < State->GamesCount; ++GameIndex)
+        CancelAISearch(&State->Games[GameIndex].AIState);
+    
+    for (u32 GameIndex = 0; GameIndex < State->GamesCount; ++GameIndex)
+    {
+        ai_state *AIState = &State->Games[GameIndex].AIState;
+        GlobalPlatform->CompleteWork(Queue, &AIState->SearchHandle);
+        Assert(AIState->SearchHandle.PendingCount == 0);
+        AIState->SearchIsInFlight = false;
+        if (AIState->Stage == 2)
+            AIState->Stage = 0;
+    }
+}
+
 internal void
 TransitionToStartScreen(game_state *State)
 {
@@ -2598,10 +6486,10 @@ TransitionToStartScreen(game_state *State)
     State->ShouldUpdateBoardMovingVectors = true;
     
     Assert(State->GamesCount > 0);
-    State->Games[State->CurrentGameIndex].AIState.WorkParams.ShouldContinue = false;
-    if (State->Games[State->CurrentGameIndex].AIState.Stage == 1)
-        State->Games[State->CurrentGameIndex].AIState.Stage = 0;
-    State->Games[State->CurrentGameIndex].AIState.t = 0.0f;
+    chess_game_state *Game = State->Games + State->CurrentGameIndex;
+    if (!GameRunsInBackground(State, Game))
+        CancelAISearch(&Game->AIState);
+    Game->AIState.t = 0.0f;
 }
 
 internal void
@@ -2865,9 +6753,30 @@ DrawGameBoard(render_group *Group, chess_game_state *Game, bitmap *BoardBitmap,
                              0.55f * (1.0f + 0.1f*RecenteredDestColorT),
                              0.95f);
         
-        for (u32 DestIndex = 0; DestIndex < SPiece->DestinationsCount; ++DestIndex)
+        // NOTE(vincent): A search may be copying Game on another thread, so this only
+        // reads it. Lists that aren't there (pieces of the side not to move, or a side to
+        // move that hasn't asked for them yet) get made on a copy of the game.
+        destination *Destinations = SPiece->Destinations;
+        u32 DestinationsCount = SPiece->DestinationsCount;
+        destination LocalDestinations[32];
+        if (Game->BlackIsPlaying != !Game->SelectedPiece.IsWhite || 
+            !Game->DestinationsAreCurrent)
+        {
+            chess_game_state Scratch = *Game;
+            chess_piece *ScratchPiece = 
+                (chess_piece *)((u8 *)&Scratch + ((u8 *)SPiece - (u8 *)Game));
+            Destinations = LocalDestinations;
+            DestinationsCount = GetDestinationsOnDemand(&Scratch, ScratchPiece, 
+                                                        Game->SelectedPiece.IsWhite,
+                                                        LocalDestinations,
+                                                        ArrayCount(LocalDestinations));
+            if (DestinationsCount > ArrayCount(LocalDestinations))
+                DestinationsCount = ArrayCount(LocalDestinations);
+        }
+        
+        for (u32 DestIndex = 0; DestIndex < DestinationsCount; ++DestIndex)
         {
-            u32 DestCode = SPiece->Destinations[DestIndex].DestCode;
+            u32 DestCode = Destinations[DestIndex].DestCode;
             u32 Row = DestCode & 7;
             u32 Column = (DestCode >> 3) & 7;
             b32 IsCapture = DestCode >> 6;
@@ -3082,6 +6991,11 @@ DrawGameStrings(render_group *Group, font *Font, chess_game_state *Game, f32 Rel
     PushNumber(Group, Game->History.EntryCount, Font, 0.0007f, V2(RelX + 0.04f, RelY), NumberColor);
 }
 
+PLATFORM_WORK_QUEUE_CALLBACK(WriteSaveFile)
+{
+    GlobalPlatform->WriteFile("chess_save", sizeof(game_state), Data);
+}
+
 extern "C"
 GAME_UPDATE(GameUpdate)
 {
@@ -3101,7 +7015,73 @@ GAME_UPDATE(GameUpdate)
         State->Assets = LoadAssetFile(&State->GlobalArena, "chess_asset_file");
         State->Series = RandomSeries(41);
         
-        SubArena(&State->AIArena, &State->GlobalArena, Megabytes(1));
+        State->SaveBuffer = PushStruct(&State->GlobalArena, game_state);
+        State->SaveHandle.PendingCount = 0;
+        
+        platform_page_kind PageKind = PlatformPageKind_Default;
+        void *TableMemory = 0;
+        if (Memory->SharedTableName)
+        {
+            TableMemory = OpenSharedTranspositionEntries(Memory->SharedTableName,
+                                                         TRANSPOSITION_TABLE_ENTRY_COUNT,
+                                                         &PageKind);
+        }
+        if (!TableMemory)
+        {
+            TableMemory = 
+                GlobalPlatform->AllocateLargeMemory(TRANSPOSITION_TABLE_ENTRY_COUNT * 
+                                                    sizeof(transposition_entry), &PageKind);
+        }
+        InitializeTranspositionTable(&State->TranspositionTable, TableMemory, 
+                                     TRANSPOSITION_TABLE_ENTRY_COUNT, PageKind);
+        
+        // NOTE(vincent): Without the file, the AI just doesn't learn anything.
+        void *LearningMemory = OpenLearningEntries(LEARNING_FILENAME, LEARNING_TABLE_ENTRY_COUNT);
+        InitializeTranspositionTable(&State->LearningTable, LearningMemory,
+                                     LEARNING_TABLE_ENTRY_COUNT, PlatformPageKind_Default);
+        
+        platform_page_kind PawnPageKind;
+        void *PawnMemory = 
+            GlobalPlatform->AllocateLargeMemory(PAWN_TABLE_ENTRY_COUNT * sizeof(pawn_entry),
+                                                &PawnPageKind);
+        InitializePawnTable(&State->PawnTable, PawnMemory, PAWN_TABLE_ENTRY_COUNT);
+        
+        LoadOpeningBook(&State->Book, BOOK_FILENAME);
+        State->EndgameTables = PushStruct(&State->GlobalArena, endgame_tables);
+        InitializeEndgameTables(State->EndgameTables);
+        
+        // NOTE(vincent): Without the bitbase file, generate it in the background. That
+        // takes long enough that it only happens with worker threads.
+        memory_index BitbaseFileSize = 0;
+        u8 *BitbaseFile = (u8 *)GlobalPlatform->MapReadOnlyFile(BITBASE_FILENAME, &BitbaseFileSize);
+        State->BitbaseGenerator = 0;
+        if (!LoadBitbases(State->EndgameTables, BitbaseFile, BitbaseFileSize) && 
+            Memory->WorkerThreadCount)
+        {
+            State->BitbaseGenerator = PushStruct(&State->GlobalArena, bitbase_generator);
+            GlobalPlatform->AddEntry(Memory->Queue, GenerateBitbases, State->BitbaseGenerator,
+                                     0, PlatformWorkPriority_Background, 0);
+        }
+        
+        search_cluster *Cluster = &State->SearchCluster;
+        Cluster->WorkerCount = Minimum(Memory->SearchWorkerCount, (u32)MAX_SEARCH_WORKER_COUNT);
+        for (u32 WorkerIndex = 0; WorkerIndex < Cluster->WorkerCount; ++WorkerIndex)
+            Cluster->Workers[WorkerIndex] = Memory->SearchWorkers[WorkerIndex];
+        Cluster->Busy = 0;
+        
+        for (u32 SlotIndex = 0; SlotIndex < ArrayCount(State->AISlots); ++SlotIndex)
+        {
+            ai_slot *Slot = State->AISlots + SlotIndex;
+            SubArena(&Slot->Arena, &State->GlobalArena, Megabytes(1));
+            Slot->Series = RandomSeries(42 + SlotIndex);
+            Slot->Snapshot = PushStruct(&State->GlobalArena, chess_game_state);
+            Slot->Table = &State->TranspositionTable;
+            Slot->Learning = &State->LearningTable;
+            Slot->PawnTable = &State->PawnTable;
+            Slot->Book = &State->Book;
+            Slot->Endgame = State->EndgameTables;
+            Slot->Cluster = &State->SearchCluster;
+        }
         
         u32 BlackSquareColor = PackPixel(V4(0,0,0,0));
         u32 WhiteSquareColor = PackPixel(V4(.8f, .8f, .8f, 1));  
@@ -3149,6 +7129,16 @@ GAME_UPDATE(GameUpdate)
                 Game->DestColorT -= DestColorTPeriod;
         }
 #endif
+        
+        AdvanceBackgroundGames(State, Memory->Queue, Input->dtForFrame, 
+                               Memory->WorkerThreadCount == 0);
+        
+        bitbase_generator *Generator = State->BitbaseGenerator;
+        if (Generator && Generator->Finished)
+        {
+            LoadBitbases(State->EndgameTables, Generator->File, Generator->FileSize);
+            State->BitbaseGenerator = 0;
+        }
     }
     
     render_group *Group = &State->RenderGroup;
@@ -3261,8 +7251,16 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
                 {
                     case 0: StartNewGame(State); break;
                     case 1: LoadGame(State, State->MenuX); break;
-                    case 2: DuplicateGame(State, State->MenuX); break;
-                    case 3: DeleteGame(State, State->MenuX); break;
+                    case 2: 
+                    {
+                        WaitForAISearches(State, Memory->Queue);
+                        DuplicateGame(State, State->MenuX);
+                    } break;
+                    case 3: 
+                    {
+                        WaitForAISearches(State, Memory->Queue);
+                        DeleteGame(State, State->MenuX);
+                    } break;
                     InvalidDefaultCase;
                 }
             }
@@ -3273,7 +7271,7 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
         
         case GameMode_Settings:
         {
-            UpdateWrappedCounterOnButtonPress(&State->MenuY, Input->Up, Input->Down, 3);
+            UpdateWrappedCounterOnButtonPress(&State->MenuY, Input->Up, Input->Down, 4);
             
             Assert(State->CurrentGameIndex < State->GamesCount);
             chess_game_state *Game = State->Games + State->CurrentGameIndex;
@@ -3296,6 +7294,14 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
                         Game->WhiteAI = WrappedIncrement(Game->WhiteAI, PlayerTypesCount);
                 } break;
                 case 2:
+                {
+                    if (NewButtonPress(Input->Left) || NewButtonPress(Input->Right) ||
+                        NewButtonPress(Input->A))
+                    {
+                        State->SimulateBackgroundGames = !State->SimulateBackgroundGames;
+                    }
+                } break;
+                case 3:
                 {
                     if (Input->A.IsPressed && !Input->A.WasPressed)
                         TransitionToGameplay(State, Game);
@@ -3333,8 +7339,10 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
                     State->MenuY = 0;
                 else if (MouseVector.y >= TopY - 0.122f)
                     State->MenuY = 1;
-                else
+                else if (MouseVector.y >= TopY - 0.172f)
                     State->MenuY = 2;
+                else
+                    State->MenuY = 3;
             }
             
             
@@ -3385,10 +7393,18 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
                      V2(MarginLeft2, 0.15f), 
                      State->MenuY == 1 ? HoveredTextColor : TextColor);
             
-            PushText(Group, "Done", &State->Assets->Font, Scale,
-                     V2(0.27f, 0.1f), 
+            PushText(Group, "Background AI games", &State->Assets->Font, Scale,
+                     V2(MarginLeft, 0.1f), 
                      State->MenuY == 2 ? HoveredTextColor : TextColor);
             
+            char *BackgroundString = State->SimulateBackgroundGames ? (char *)"On" : (char *)"Off";
+            PushText(Group, BackgroundString, &State->Assets->Font, Scale, V2(MarginLeft2, 0.1f), 
+                     State->MenuY == 2 ? HoveredTextColor : TextColor);
+            
+            PushText(Group, "Done", &State->Assets->Font, Scale,
+                     V2(0.27f, 0.05f), 
+                     State->MenuY == 3 ? HoveredTextColor : TextColor);
+            
             //AssertDestPointersWithinBounds(Game);
         } break;
         
@@ -3469,6 +7485,13 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
             
             if (PlayerIsHuman || Game->GameIsOver)
             {
+                ai_state *AIState = &Game->AIState;
+                if (AIState->SearchIsPondering && AIState->SearchIsTimeSliced && 
+                    !AIState->WorkParams.Finished)
+                {
+                    ContinueGoodDecision(&AIState->WorkParams, AI_NODES_PER_FRAME);
+                }
+                
                 if (Game->PromotingPawn)
                 {
                     UpdateWrappedCounterOnButtonPress(&State->MenuX, Input->Left,
@@ -3501,8 +7524,9 @@ PushText(Group, String, &State->Assets->Font, 0.0007f, V2(MenuStringX, MenuStrin
             }
             else
             {
-                AdvanceAIAction(State, Game, Input->dtForFrame, &State->Series, &State->AIArena,
-                                Memory->Queue);
+                AdvanceAIAction(State, Game, State->AISlots + State->CurrentGameIndex,
+                                Input->dtForFrame, Memory->Queue, 
+                                Memory->WorkerThreadCount ? 0 : AI_NODES_PER_FRAME, true);
             }
             
             chess_piece *OldSelectedPiece = Game->SelectedPiece.Piece;
@@ -3560,11 +7584,12 @@ PushNumber(Group, Number, &State->Assets->Font, 0.0007f, Vector, V4(1,1,1,1))
             // NOTE(vincent): Turn this on for visualizing joystick values, mouse values and more!
 #if 0
             u32 BlacksDestCount = 0;
+            u32 WhitesDestCount = 0;
             for (u32 i = 0; i < ArrayCount(Game->Blacks); ++i)
             {
                 BlacksDestCount += Game->Blacks[i].DestinationsCount;
+                WhitesDestCount += Game->Whites[i].DestinationsCount;
             }
-            u32 WhitesDestCount = Game->DestinationsCount - BlacksDestCount;
             PushNum(Game->DestinationsCount, V2(0.05f, 0.08f));
             PushNum(BlacksDestCount, V2(0.08f, 0.08f)); 
             PushNum(WhitesDestCount, V2(0.11f, 0.08f)); 
@@ -3613,11 +7638,12 @@ PushNumber(Group, Number, &State->Assets->Font, 0.0007f, Vector, V4(1,1,1,1))
     }
     
     
-    if (State->ShouldSave)
+    // NOTE(vincent): Saving happens on the work queue. If the previous save is still
+    // being written, this one waits for the next frame.
+    if (State->ShouldSave && State->SaveHandle.PendingCount == 0)
     {
         State->ShouldSave = false;
-        temporary_memory SaveTempMemory = BeginTemporaryMemory(&State->GlobalArena);
-        game_state *CopyGameState = PushStruct(&State->GlobalArena, game_state);
+        game_state *CopyGameState = State->SaveBuffer;
         *CopyGameState = *State;
         
         // NOTE(vincent): Transform absolute nonzero pointers to pointer offsets,
@@ -3627,7 +7653,17 @@ PushNumber(Group, Number, &State->Assets->Font, 0.0007f, Vector, V4(1,1,1,1))
         for (u32 i = 0; i < CopyGameState->GamesCount; ++i)
         {
             chess_game_state *Game = CopyGameState->Games + i;
-            Assert(Game->AIState.Stage != 1);
+            
+            // NOTE(vincent): An AI search can be in flight at this point (pipelined,
+            // pondering, or in a game running in the background). It does not survive
+            // a reload; the loaded game starts a new one. A decision that is yet to be
+            // played (stage 2) refers to pieces by address, so it is dropped too.
+            if (Game->AIState.Stage == 1 || Game->AIState.Stage == 2)
+                Game->AIState.Stage = 0;
+            Game->AIState.SearchIsInFlight = false;
+            Game->AIState.SearchHandle.PendingCount = 0;
+            Game->AIState.SearchIsPipelined = false;
+            Game->AIState.SearchIsPondering = false;
             chess_game_state *OriginalGame = State->Games + i;
             if (Game->SelectedPiece.Piece)
             {
@@ -3655,8 +7691,12 @@ PushNumber(Group, Number, &State->Assets->Font, 0.0007f, Vector, V4(1,1,1,1))
         }
         CopyGameState->IsInitialized = false;
         
-        GlobalPlatform->WriteFile("chess_save", sizeof(game_state), CopyGameState);
-        
-        EndTemporaryMemory(SaveTempMemory);
+        if (Memory->WorkerThreadCount)
+        {
+            GlobalPlatform->AddEntry(Memory->Queue, WriteSaveFile, CopyGameState, 
+                                     &State->SaveHandle, PlatformWorkPriority_IO, 0);
+        }
+        else
+            WriteSaveFile(Memory->Queue, CopyGameState, 0);
     }
 }
@@ -17,7 +17,7 @@ PLATFORM_PUSH_READ_FILE(PushReadFile)
     if (CreateFileHandle != INVALID_HANDLE_VALUE)
     {
         Result.Size = GetFileSize(CreateFileHandle, 0);
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
             Result.Base = PushArray(Arena, Result.Size, char);
@@ -36,7 +36,7 @@ PLATFORM_PUSH_READ_FILE(PushReadFile)
         fseek(File, 0, SEEK_END);
         Result.Size = ftell(File);
         fseek(File, 0, SEEK_SET);
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
             Result.Base = PushArray(Arena, (u32)Result.Size, char);
@@ -99,7 +99,7 @@ PLATFORM_PUSH_READ_FILE(PushReadFile)
         struct stat FileInfo = {};
         fstat(FileDescriptor, &FileInfo);
         Result.Size = FileInfo.st_size;
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
             Result.Base = PushArray(Arena, Result.Size, char);
@@ -0,0 +1,918 @@
+// NOTE(vincent): Builds the opening book read by the game (see LookUpBookDecision()).
+//
+// Games come from the save file, from PGN files, or from self-play. Every (position, move)
+// pair of a game's opening goes into a record, and records are aggregated with an
+// external-memory sort: records fill a fixed-size buffer, which gets sorted, aggregated and
+// written out as a run file whenever it's full. The runs are then merged (in several
+// passes if there are many of them) straight into the book file. Memory use only depends
+// on the size of the buffer, not on the number of games.
+//
+// Usage: chess_book_builder [-out file] [-plies N] [-min N] [-memory MB]
+//                           [-save file] [-pgn file]... [-selfplay games depth random_plies]
+// Without any source, it reads chess_save.
+
+#include "chess.cpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if COMPILER_MSVC
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+struct book_record
+{
+    u64 Key;
+    u32 Move;    // Polyglot encoding, see BookMove()
+    u32 Count;   // times the move was played in this position
+    u32 Points;  // for the side that played it: 2 per win, 1 per draw or unfinished game
+    u32 Reserved;
+};
+
+#define MAX_MERGE_FAN_IN 64
+#define MAX_POSITION_MOVES 256
+#define MAX_SELF_PLAY_PLIES 300
+#define MAX_RECORDED_PLIES 256
+
+struct book_builder
+{
+    char *OutputFilename;
+    u32 MaxPlies;  // positions deeper into the game than this don't go in the book
+    u32 MinCount;  // moves played fewer times than this don't go in the book
+    
+    book_record *Run;
+    book_record *SortTemp;
+    u64 RunCapacity;
+    u64 RunCount;
+    u32 RunFileCount;
+    
+    u64 GameCount;
+    u64 RecordCount;
+};
+
+// NOTE(vincent): The moves of one game, kept until we know how the game ended.
+struct game_moves
+{
+    u32 Count;
+    u64 Keys[MAX_RECORDED_PLIES];
+    u32 Moves[MAX_RECORDED_PLIES];
+    b32 BlackPlayed[MAX_RECORDED_PLIES];
+};
+
+enum game_result
+{
+    GameResult_Unknown,
+    GameResult_WhiteWins,
+    GameResult_BlackWins,
+    GameResult_Draw,
+};
+
+internal void
+RunFilename(char *Buffer, u32 BufferSize, char *OutputFilename, u32 RunIndex)
+{
+    snprintf(Buffer, BufferSize, "%s.run%u", OutputFilename, RunIndex);
+}
+
+internal u32
+RadixByte(book_record *Record, u32 Pass)
+{
+    // NOTE(vincent): Least significant byte first: the two low bytes of Move, then the
+    // eight bytes of Key, so that records end up sorted by key, and by move within a key.
+    u32 Result;
+    if (Pass < 2)
+        Result = (Record->Move >> (8*Pass)) & 0xff;
+    else
+        Result = (u32)(Record->Key >> (8*(Pass - 2))) & 0xff;
+    return Result;
+}
+
+internal void
+SortRecords(book_record *Records, book_record *Temp, u64 Count)
+{
+    // NOTE(vincent): LSD radix sort. An even number of passes leaves the result in Records.
+    book_record *Source = Records;
+    book_record *Dest = Temp;
+    for (u32 Pass = 0; Pass < 10; ++Pass)
+    {
+        u64 Offsets[256] = {};
+        for (u64 i = 0; i < Count; ++i)
+            Offsets[RadixByte(Source + i, Pass)]++;
+        u64 Total = 0;
+        for (u32 Byte = 0; Byte < 256; ++Byte)
+        {
+            u64 ByteCount = Offsets[Byte];
+            Offsets[Byte] = Total;
+            Total += ByteCount;
+        }
+        for (u64 i = 0; i < Count; ++i)
+            Dest[Offsets[RadixByte(Source + i, Pass)]++] = Source[i];
+        
+        book_record *Swap = Source;
+        Source = Dest;
+        Dest = Swap;
+    }
+}
+
+internal b32
+SameEntry(book_record *A, book_record *B)
+{
+    b32 Result = (A->Key == B->Key && A->Move == B->Move);
+    return Result;
+}
+
+internal b32
+RecordIsLess(book_record *A, book_record *B)
+{
+    b32 Result = (A->Key < B->Key || (A->Key == B->Key && A->Move < B->Move));
+    return Result;
+}
+
+internal void
+FlushRun(book_builder *Builder)
+{
+    if (Builder->RunCount)
+    {
+        SortRecords(Builder->Run, Builder->SortTemp, Builder->RunCount);
+        
+        // NOTE(vincent): Aggregate in place, the run file then has one record per entry.
+        u64 AggregatedCount = 0;
+        for (u64 i = 0; i < Builder->RunCount; ++i)
+        {
+            book_record *Record = Builder->Run + i;
+            book_record *Last = Builder->Run + AggregatedCount - 1;
+            if (AggregatedCount && SameEntry(Last, Record))
+            {
+                Last->Count += Record->Count;
+                Last->Points += Record->Points;
+            }
+            else
+                Builder->Run[AggregatedCount++] = *Record;
+        }
+        
+        char Filename[512];
+        RunFilename(Filename, sizeof(Filename), Builder->OutputFilename, Builder->RunFileCount++);
+        FILE *File = fopen(Filename, "wb");
+        if (!File || fwrite(Builder->Run, sizeof(book_record), AggregatedCount, File) !=
+            AggregatedCount)
+        {
+            printf("Could not write %s\n", Filename);
+            exit(1);
+        }
+        fclose(File);
+        Builder->RunCount = 0;
+    }
+}
+
+internal void
+AddRecord(book_builder *Builder, u64 Key, u32 Move, u32 Points)
+{
+    if (Builder->RunCount == Builder->RunCapacity)
+        FlushRun(Builder);
+    book_record *Record = Builder->Run + Builder->RunCount++;
+    Record->Key = Key;
+    Record->Move = Move;
+    Record->Count = 1;
+    Record->Points = Points;
+    Record->Reserved = 0;
+    Builder->RecordCount++;
+}
+
+internal u32
+BookMove(chess_piece *Piece, u32 ToRow, u32 ToColumn, chess_piece_type PromotionType)
+{
+    // NOTE(vincent): Polyglot's move encoding, which FindBookDecision() reads.
+    // Castling is written as the king taking its own rook.
+    if (Piece->Type == ChessPieceType_King && (s32)ToColumn - Piece->Column == 2)
+        ToColumn = 7;
+    else if (Piece->Type == ChessPieceType_King && Piece->Column - (s32)ToColumn == 2)
+        ToColumn = 0;
+    
+    u32 Promotion = 0;
+    switch (PromotionType)
+    {
+        case ChessPieceType_Knight: Promotion = 1; break;
+        case ChessPieceType_Bishop: Promotion = 2; break;
+        case ChessPieceType_Rook:   Promotion = 3; break;
+        case ChessPieceType_Queen:  Promotion = 4; break;
+    }
+    u32 Result = ToColumn | (ToRow << 3) | (Piece->Column << 6) | (Piece->Row << 9) |
+        (Promotion << 12);
+    return Result;
+}
+
+internal void
+RecordMove(book_builder *Builder, game_moves *Moves, chess_game_state *Game, u32 Move)
+{
+    if (Game->CurrentEntryIndex < Builder->MaxPlies && Moves->Count < MAX_RECORDED_PLIES)
+    {
+        Moves->Keys[Moves->Count] = ComputeBookKey(Game);
+        Moves->Moves[Moves->Count] = Move;
+        Moves->BlackPlayed[Moves->Count] = Game->BlackIsPlaying;
+        Moves->Count++;
+    }
+}
+
+internal void
+EndGame(book_builder *Builder, game_moves *Moves, game_result Result)
+{
+    for (u32 i = 0; i < Moves->Count; ++i)
+    {
+        u32 Points = 1;
+        if (Result == GameResult_WhiteWins)
+            Points = Moves->BlackPlayed[i] ? 0 : 2;
+        else if (Result == GameResult_BlackWins)
+            Points = Moves->BlackPlayed[i] ? 2 : 0;
+        AddRecord(Builder, Moves->Keys[i], Moves->Moves[i], Points);
+    }
+    Moves->Count = 0;
+    Builder->GameCount++;
+}
+
+internal game_result
+ResultOfFinishedGame(chess_game_state *Game)
+{
+    // NOTE(vincent): After the last move, BlackIsPlaying is the side that got mated.
+    game_result Result = GameResult_Unknown;
+    if (Game->RunningState == ChessGameRunningState_Checkmate)
+        Result = Game->BlackIsPlaying ? GameResult_WhiteWins : GameResult_BlackWins;
+    else if (Game->RunningState == ChessGameRunningState_Stalemate)
+        Result = GameResult_Draw;
+    return Result;
+}
+
+internal void
+StartBookGame(chess_game_state *Game)
+{
+    ZeroBytes((u8 *)Game, sizeof(chess_game_state));
+    Game->RunningState = ChessGameRunningState_Normal;
+    InitChessPieces(Game);
+    RecomputeDestinations(Game);
+}
+
+//
+// NOTE(vincent): Save file
+//
+
+internal void
+AddSaveFileGames(book_builder *Builder, memory_arena *Arena, char *Filename)
+{
+    temporary_memory TempMemory = BeginTemporaryMemory(Arena);
+    game_state *State = PushStruct(Arena, game_state);
+    chess_game_state *Game = PushStruct(Arena, chess_game_state);
+    game_moves *Moves = PushStruct(Arena, game_moves);
+    
+    FILE *File = fopen(Filename, "rb");
+    if (!File)
+    {
+        printf("Could not open %s\n", Filename);
+        exit(1);
+    }
+    b32 SizeMatches = (fread(State, 1, sizeof(game_state), File) == sizeof(game_state) &&
+                       fgetc(File) == EOF);
+    fclose(File);
+    if (!SizeMatches)
+    {
+        printf("%s is not a save file of this build\n", Filename);
+        exit(1);
+    }
+    
+    for (u32 GameIndex = 0; GameIndex < State->GamesCount && GameIndex < MAX_GAMES_COUNT;
+         ++GameIndex)
+    {
+        // NOTE(vincent): Replays the history from the start. Entries are pushed one at a
+        // time so that ComputeBookKey() sees the right last move for en passant.
+        history *History = &State->Games[GameIndex].History;
+        StartBookGame(Game);
+        for (u32 EntryIndex = 0;
+             EntryIndex < History->EntryCount && EntryIndex < ArrayCount(History->Entries) &&
+             !Game->GameIsOver;
+             ++EntryIndex)
+        {
+            history_entry Entry = History->Entries[EntryIndex];
+            decoded_history_entry Decoded;
+            DecodeHistoryEntry(&Decoded, Entry);
+            chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+            chess_piece *Piece = Pieces + Decoded.MovingPieceIndex;
+            chess_piece_type PromotionType =
+                Decoded.ThereIsPromotion ? Decoded.PromotionType : ChessPieceType_Empty;
+            RecordMove(Builder, Moves, Game,
+                       BookMove(Piece, Piece->Row + Decoded.DeltaRow,
+                                Piece->Column + Decoded.DeltaCol, PromotionType));
+            
+            Game->History.Entries[EntryIndex] = Entry;
+            Game->History.EntryCount = EntryIndex + 1;
+            GameHistoryMoveForward(Game);
+        }
+        EndGame(Builder, Moves, ResultOfFinishedGame(Game));
+    }
+    EndTemporaryMemory(TempMemory);
+}
+
+//
+// NOTE(vincent): PGN
+//
+
+internal chess_piece_type
+PieceTypeFromLetter(char Letter)
+{
+    chess_piece_type Result = ChessPieceType_Empty;
+    switch (Letter)
+    {
+        case 'N': Result = ChessPieceType_Knight; break;
+        case 'B': Result = ChessPieceType_Bishop; break;
+        case 'R': Result = ChessPieceType_Rook; break;
+        case 'Q': Result = ChessPieceType_Queen; break;
+        case 'K': Result = ChessPieceType_King; break;
+    }
+    return Result;
+}
+
+internal b32
+ParseSAN(chess_game_state *Game, char *SAN, decision *Result)
+{
+    // NOTE(vincent): Standard algebraic notation, e.g. e4, exd5, Nbd7, R1e2, e8=Q, O-O-O.
+    // Check marks and annotations are expected to be stripped already.
+    UpdateDestinations(Game);
+    chess_piece *Pieces = Game->BlackIsPlaying ? Game->Blacks : Game->Whites;
+    u32 Length = (u32)strlen(SAN);
+    chess_piece_type Type = ChessPieceType_Pawn;
+    chess_piece_type PromotionType = ChessPieceType_Empty;
+    s32 FromRow = -1;
+    s32 FromColumn = -1;
+    s32 ToRow, ToColumn;
+    
+    if (strcmp(SAN, "O-O") == 0 || strcmp(SAN, "0-0") == 0 ||
+        strcmp(SAN, "O-O-O") == 0 || strcmp(SAN, "0-0-0") == 0)
+    {
+        Type = ChessPieceType_King;
+        ToRow = Game->BlackIsPlaying ? 7 : 0;
+        ToColumn = (Length == 3) ? 6 : 2;
+    }
+    else
+    {
+        if (Length >= 2 && SAN[Length-2] == '=')
+        {
+            PromotionType = PieceTypeFromLetter(SAN[Length-1]);
+            Length -= 2;
+        }
+        else if (Length >= 3 && PieceTypeFromLetter(SAN[Length-1]) != ChessPieceType_Empty &&
+                 SAN[Length-2] >= '1' && SAN[Length-2] <= '8')
+        {
+            // NOTE(vincent): Promotion without the '=', e.g. e8Q.
+            PromotionType = PieceTypeFromLetter(SAN[Length-1]);
+            Length -= 1;
+        }
+        if (Length < 2)
+            return false;
+        
+        ToColumn = SAN[Length-2] - 'a';
+        ToRow = SAN[Length-1] - '1';
+        if (ToColumn < 0 || ToColumn > 7 || ToRow < 0 || ToRow > 7)
+            return false;
+        
+        u32 At = 0;
+        if (PieceTypeFromLetter(SAN[0]) != ChessPieceType_Empty)
+            Type = PieceTypeFromLetter(SAN[At++]);
+        for (; At < Length-2; ++At)
+        {
+            if (SAN[At] >= 'a' && SAN[At] <= 'h')
+                FromColumn = SAN[At] - 'a';
+            else if (SAN[At] >= '1' && SAN[At] <= '8')
+                FromRow = SAN[At] - '1';
+            else if (SAN[At] != 'x' && SAN[At] != '-')
+                return false;
+        }
+    }
+    
+    u32 MatchCount = 0;
+    u32 DestCode = ToRow | (ToColumn << 3);
+    for (u32 PieceIndex = 0; PieceIndex < 16; ++PieceIndex)
+    {
+        chess_piece *Piece = Pieces + PieceIndex;
+        if (Piece->Type != Type || (FromRow >= 0 && (s32)Piece->Row != FromRow) ||
+            (FromColumn >= 0 && (s32)Piece->Column != FromColumn))
+        {
+            continue;
+        }
+        for (u32 DestIndex = 0; DestIndex < Piece->DestinationsCount; ++DestIndex)
+        {
+            if ((Piece->Destinations[DestIndex].DestCode & 63) == DestCode)
+            {
+                Result->Piece = Piece;
+                Result->Destination = Piece->Destinations[DestIndex];
+                Result->PromotionType = PromotionType;
+                if (Type == ChessPieceType_Pawn && (ToRow == 0 || ToRow == 7) &&
+                    PromotionType == ChessPieceType_Empty)
+                {
+                    Result->PromotionType = ChessPieceType_Queen;
+                }
+                ++MatchCount;
+            }
+        }
+    }
+    return (MatchCount == 1);
+}
+
+internal void
+AddPGNGames(book_builder *Builder, memory_arena *Arena, char *Filename)
+{
+    // NOTE(vincent): Streams the file one character at a time, so its size doesn't matter.
+    // Tag pairs, comments, variations and NAGs are skipped, move numbers too. A game ends
+    // at its result token; a game whose moves stop making sense is dropped up to there.
+    temporary_memory TempMemory = BeginTemporaryMemory(Arena);
+    chess_game_state *Game = PushStruct(Arena, chess_game_state);
+    game_moves *Moves = PushStruct(Arena, game_moves);
+    
+    FILE *File = fopen(Filename, "rb");
+    if (!File)
+    {
+        printf("Could not open %s\n", Filename);
+        exit(1);
+    }
+    
+    StartBookGame(Game);
+    b32 GameIsBroken = false;
+    u32 VariationDepth = 0;
+    u64 BrokenGameCount = 0;
+    char Token[64];
+    u32 TokenLength = 0;
+    for (;;)
+    {
+        int C = fgetc(File);
+        if (C == '{' || C == ';' || (C == '[' && !VariationDepth) || 
+            (C == '%' && TokenLength == 0))
+        {
+            // NOTE(vincent): Comments and tag pairs count as whitespace.
+            int End = (C == '{') ? '}' : (C == '[') ? ']' : '\n';
+            while (C != EOF && C != End)
+                C = fgetc(File);
+            if (C != EOF)
+                C = ' ';
+        }
+        
+        // NOTE(vincent): A parenthesis ends the token before it, which still belongs to the
+        // line we were in.
+        int Parenthesis = 0;
+        if (C == '(' || C == ')')
+        {
+            Parenthesis = C;
+            C = ' ';
+        }
+        
+        if (C != EOF && C > ' ')
+        {
+            if (TokenLength < sizeof(Token) - 1)
+                Token[TokenLength++] = (char)C;
+            continue;
+        }
+        
+        if (TokenLength && !VariationDepth)
+        {
+            Token[TokenLength] = 0;
+            
+            // NOTE(vincent): "12." and "12..." prefixes, annotations and check marks.
+            char *SAN = Token;
+            while (*SAN >= '0' && *SAN <= '9' && strchr(SAN, '.'))
+                ++SAN;
+            while (*SAN == '.')
+                ++SAN;
+            u32 Length = (u32)strlen(SAN);
+            while (Length && strchr("+#!?", SAN[Length-1]))
+                SAN[--Length] = 0;
+            
+            game_result Result = GameResult_Unknown;
+            b32 IsResult = true;
+            if (strcmp(Token, "1-0") == 0)
+                Result = GameResult_WhiteWins;
+            else if (strcmp(Token, "0-1") == 0)
+                Result = GameResult_BlackWins;
+            else if (strcmp(Token, "1/2-1/2") == 0)
+                Result = GameResult_Draw;
+            else if (strcmp(Token, "*") != 0)
+                IsResult = false;
+            
+            if (IsResult)
+            {
+                if (GameIsBroken)
+                {
+                    Moves->Count = 0;
+                    ++BrokenGameCount;
+                }
+                else
+                    EndGame(Builder, Moves, Result);
+                StartBookGame(Game);
+                GameIsBroken = false;
+            }
+            else if (Length && SAN[0] != '$' && !GameIsBroken)
+            {
+                decision Decision = {};
+                if (!Game->GameIsOver && ParseSAN(Game, SAN, &Decision))
+                {
+                    RecordMove(Builder, Moves, Game,
+                               BookMove(Decision.Piece, Decision.Destination.DestCode & 7,
+                                        (Decision.Destination.DestCode >> 3) & 7,
+                                        Decision.PromotionType));
+                    ApplyDecision(Game, Decision);
+                }
+                else
+                    GameIsBroken = true;
+            }
+        }
+        TokenLength = 0;
+        
+        if (Parenthesis == '(')
+            ++VariationDepth;
+        else if (Parenthesis == ')' && VariationDepth)
+            --VariationDepth;
+        
+        if (C == EOF)
+            break;
+    }
+    fclose(File);
+    if (Moves->Count && !GameIsBroken)
+        EndGame(Builder, Moves, GameResult_Unknown);
+    
+    if (BrokenGameCount)
+        printf("%s: skipped %llu games with moves we couldn't read\n", Filename,
+               (unsigned long long)BrokenGameCount);
+    EndTemporaryMemory(TempMemory);
+}
+
+//
+// NOTE(vincent): Self-play
+//
+
+internal void
+AddSelfPlayGames(book_builder *Builder, memory_arena *Arena, u32 GameCount, u32 Depth,
+                 u32 RandomPlies)
+{
+    // NOTE(vincent): The first RandomPlies moves of each game are random, for variety,
+    // and are not recorded. Everything after that comes from the regular search.
+    temporary_memory TempMemory = BeginTemporaryMemory(Arena);
+    chess_game_state *Game = PushStruct(Arena, chess_game_state);
+    game_moves *Moves = PushStruct(Arena, game_moves);
+    memory_arena SearchArena;
+    SubArena(&SearchArena, Arena, Megabytes(16));
+    u64 TableEntryCount = 1 << 20;
+    transposition_table Table;
+    void *TableMemory = PushArray(Arena, TableEntryCount, transposition_entry);
+    ZeroBytes((u8 *)TableMemory, TableEntryCount * sizeof(transposition_entry));
+    InitializeTranspositionTable(&Table, TableMemory, TableEntryCount, PlatformPageKind_Default);
+    pawn_table PawnTable;
+    void *PawnMemory = PushArray(Arena, PAWN_TABLE_ENTRY_COUNT, pawn_entry);
+    ZeroBytes((u8 *)PawnMemory, PAWN_TABLE_ENTRY_COUNT * sizeof(pawn_entry));
+    InitializePawnTable(&PawnTable, PawnMemory, PAWN_TABLE_ENTRY_COUNT);
+    random_series Series = RandomSeries(1234);
+    
+    for (u32 GameIndex = 0; GameIndex < GameCount; ++GameIndex)
+    {
+        StartBookGame(Game);
+        for (u32 Ply = 0; Ply < MAX_SELF_PLAY_PLIES && !Game->GameIsOver; ++Ply)
+        {
+            decision Decision;
+            if (Ply < RandomPlies)
+                Decision = GetRandomDecision(Game, &Series);
+            else
+            {
+                UpdateDestinations(Game);
+                get_good_decision_params Params = {};
+                Params.Game = Game;
+                Params.Arena = &SearchArena;
+                Params.Series = &Series;
+                Params.MaxDepth = Depth;
+                Params.Table = &Table;
+                Params.PawnTable = &PawnTable;
+                Params.RootAlpha = -10000.0f;
+                Params.RootBeta = 10000.0f;
+                BeginGoodDecision(&Params);
+                ContinueGoodDecision(&Params, 0);
+                Decision = Params.Result.Decision;
+                Assert(Decision.Piece);
+                RecordMove(Builder, Moves, Game,
+                           BookMove(Decision.Piece, Decision.Destination.DestCode & 7,
+                                    (Decision.Destination.DestCode >> 3) & 7,
+                                    Decision.PromotionType));
+            }
+            ApplyDecision(Game, Decision);
+        }
+        EndGame(Builder, Moves, ResultOfFinishedGame(Game));
+        printf("self-play game %u/%u: %u plies\n", GameIndex + 1, GameCount,
+               Game->History.EntryCount);
+    }
+    EndTemporaryMemory(TempMemory);
+}
+
+//
+// NOTE(vincent): Merging
+//
+
+struct run_reader
+{
+    FILE *File;
+    book_record *Buffer;
+    u64 BufferCapacity;
+    u64 BufferCount;
+    u64 BufferIndex;
+};
+
+internal b32
+PeekRecord(run_reader *Reader, book_record **Record)
+{
+    if (Reader->BufferIndex == Reader->BufferCount && Reader->File)
+    {
+        Reader->BufferCount = fread(Reader->Buffer, sizeof(book_record),
+                                    Reader->BufferCapacity, Reader->File);
+        Reader->BufferIndex = 0;
+        if (!Reader->BufferCount)
+        {
+            fclose(Reader->File);
+            Reader->File = 0;
+        }
+    }
+    b32 Result = (Reader->BufferIndex < Reader->BufferCount);
+    if (Result)
+        *Record = Reader->Buffer + Reader->BufferIndex;
+    return Result;
+}
+
+struct book_writer
+{
+    FILE *File;
+    b32 WritesBook;  // final pass: book entries; otherwise records of a new run
+    u32 MinCount;
+    
+    book_record PositionMoves[MAX_POSITION_MOVES];
+    u32 PositionMoveCount;
+    
+    u64 EntryCount;
+    u64 PositionCount;
+};
+
+internal void
+WriteBigEndian(u8 *At, u64 Value, u32 ByteCount)
+{
+    for (u32 i = 0; i < ByteCount; ++i)
+        At[i] = (u8)(Value >> (8*(ByteCount - 1 - i)));
+}
+
+internal void
+FlushPosition(book_writer *Writer)
+{
+    // NOTE(vincent): Book weights are 16 bits, and only mean something relative to
+    // the other moves of the position, so the points get scaled down if they don't fit.
+    u32 MaxPoints = 0;
+    for (u32 i = 0; i < Writer->PositionMoveCount; ++i)
+    {
+        book_record *Record = Writer->PositionMoves + i;
+        if (Record->Count >= Writer->MinCount && Record->Points > MaxPoints)
+            MaxPoints = Record->Points;
+    }
+    
+    b32 WroteAny = false;
+    for (u32 i = 0; i < Writer->PositionMoveCount; ++i)
+    {
+        book_record *Record = Writer->PositionMoves + i;
+        u64 Weight = Record->Points;
+        if (MaxPoints > 0xffff)
+            Weight = Weight * 0xffff / MaxPoints;
+        if (Record->Count >= Writer->MinCount && Weight)
+        {
+            u8 Entry[BOOK_ENTRY_SIZE];
+            WriteBigEndian(Entry, Record->Key, 8);
+            WriteBigEndian(Entry + 8, Record->Move, 2);
+            WriteBigEndian(Entry + 10, Weight, 2);
+            WriteBigEndian(Entry + 12, 0, 4);
+            fwrite(Entry, 1, sizeof(Entry), Writer->File);
+            Writer->EntryCount++;
+            WroteAny = true;
+        }
+    }
+    if (WroteAny)
+        Writer->PositionCount++;
+    Writer->PositionMoveCount = 0;
+}
+
+internal void
+WriteRecord(book_writer *Writer, book_record *Record)
+{
+    if (Writer->WritesBook)
+    {
+        if (Writer->PositionMoveCount &&
+            (Writer->PositionMoves[0].Key != Record->Key ||
+             Writer->PositionMoveCount == MAX_POSITION_MOVES))
+        {
+            FlushPosition(Writer);
+        }
+        Writer->PositionMoves[Writer->PositionMoveCount++] = *Record;
+    }
+    else
+        fwrite(Record, sizeof(book_record), 1, Writer->File);
+}
+
+internal void
+MergeRuns(book_builder *Builder, char **InputFilenames, u32 InputCount, book_writer *Writer)
+{
+    // NOTE(vincent): InputCount is at most MAX_MERGE_FAN_IN, and the readers share the
+    // run buffer. Picking the smallest record with a linear scan is plenty at that fan-in.
+    Assert(InputCount <= MAX_MERGE_FAN_IN);
+    run_reader Readers[MAX_MERGE_FAN_IN];
+    u64 ReaderCapacity = Builder->RunCapacity / InputCount;
+    for (u32 i = 0; i < InputCount; ++i)
+    {
+        Readers[i].File = fopen(InputFilenames[i], "rb");
+        if (!Readers[i].File)
+        {
+            printf("Could not open %s\n", InputFilenames[i]);
+            exit(1);
+        }
+        Readers[i].Buffer = Builder->Run + i*ReaderCapacity;
+        Readers[i].BufferCapacity = ReaderCapacity;
+        Readers[i].BufferCount = 0;
+        Readers[i].BufferIndex = 0;
+    }
+    
+    book_record Current = {};
+    b32 HasCurrent = false;
+    for (;;)
+    {
+        run_reader *Smallest = 0;
+        book_record *SmallestRecord = 0;
+        for (u32 i = 0; i < InputCount; ++i)
+        {
+            book_record *Record;
+            if (PeekRecord(Readers + i, &Record) &&
+                (!Smallest || RecordIsLess(Record, SmallestRecord)))
+            {
+                Smallest = Readers + i;
+                SmallestRecord = Record;
+            }
+        }
+        if (!Smallest)
+            break;
+        
+        if (HasCurrent && SameEntry(&Current, SmallestRecord))
+        {
+            Current.Count += SmallestRecord->Count;
+            Current.Points += SmallestRecord->Points;
+        }
+        else
+        {
+            if (HasCurrent)
+                WriteRecord(Writer, &Current);
+            Current = *SmallestRecord;
+            HasCurrent = true;
+        }
+        Smallest->BufferIndex++;
+    }
+    if (HasCurrent)
+        WriteRecord(Writer, &Current);
+    if (Writer->WritesBook && Writer->PositionMoveCount)
+        FlushPosition(Writer);
+    
+    for (u32 i = 0; i < InputCount; ++i)
+        remove(InputFilenames[i]);
+}
+
+internal void
+WriteBook(book_builder *Builder, memory_arena *Arena)
+{
+    FlushRun(Builder);
+    
+    // NOTE(vincent): Runs are merged MAX_MERGE_FAN_IN at a time into new runs until few
+    // enough are left for the final merge into the book.
+    u32 FirstRun = 0;
+    while (Builder->RunFileCount - FirstRun > MAX_MERGE_FAN_IN)
+    {
+        u32 LastRun = Builder->RunFileCount;
+        for (u32 GroupStart = FirstRun; GroupStart < LastRun; GroupStart += MAX_MERGE_FAN_IN)
+        {
+            u32 GroupCount = Minimum(LastRun - GroupStart, (u32)MAX_MERGE_FAN_IN);
+            char Names[MAX_MERGE_FAN_IN][512];
+            char *NamePointers[MAX_MERGE_FAN_IN];
+            for (u32 i = 0; i < GroupCount; ++i)
+            {
+                RunFilename(Names[i], sizeof(Names[i]), Builder->OutputFilename, GroupStart + i);
+                NamePointers[i] = Names[i];
+            }
+            
+            char OutputName[512];
+            RunFilename(OutputName, sizeof(OutputName), Builder->OutputFilename,
+                        Builder->RunFileCount++);
+            book_writer Writer = {};
+            Writer.File = fopen(OutputName, "wb");
+            if (!Writer.File)
+            {
+                printf("Could not write %s\n", OutputName);
+                exit(1);
+            }
+            MergeRuns(Builder, NamePointers, GroupCount, &Writer);
+            fclose(Writer.File);
+        }
+        FirstRun = LastRun;
+    }
+    
+    u32 RunCount = Builder->RunFileCount - FirstRun;
+    char Names[MAX_MERGE_FAN_IN][512];
+    char *NamePointers[MAX_MERGE_FAN_IN];
+    for (u32 i = 0; i < RunCount; ++i)
+    {
+        RunFilename(Names[i], sizeof(Names[i]), Builder->OutputFilename, FirstRun + i);
+        NamePointers[i] = Names[i];
+    }
+    
+    book_writer *Writer = PushStruct(Arena, book_writer);
+    ZeroBytes((u8 *)Writer, sizeof(book_writer));
+    Writer->WritesBook = true;
+    Writer->MinCount = Builder->MinCount;
+    Writer->File = fopen(Builder->OutputFilename, "wb");
+    if (!Writer->File)
+    {
+        printf("Could not write %s\n", Builder->OutputFilename);
+        exit(1);
+    }
+    if (RunCount)
+        MergeRuns(Builder, NamePointers, RunCount, Writer);
+    fclose(Writer->File);
+    
+    printf("%llu games, %llu moves recorded, %llu positions and %llu entries in %s\n",
+           (unsigned long long)Builder->GameCount, (unsigned long long)Builder->RecordCount,
+           (unsigned long long)Writer->PositionCount, (unsigned long long)Writer->EntryCount,
+           Builder->OutputFilename);
+}
+
+int main(int ArgCount, char **Args)
+{
+    memory_index MemorySize = Gigabytes(1);
+#if COMPILER_MSVC
+    void *Memory = VirtualAlloc(0, MemorySize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *Memory =
+        mmap(0, MemorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+    Assert(Memory);
+    memory_arena Arena;
+    InitializeArena(&Arena, MemorySize, Memory);
+    
+    static platform_api Platform = {};
+    GlobalPlatform = &Platform;
+    
+    book_builder Builder = {};
+    Builder.OutputFilename = BOOK_FILENAME;
+    Builder.MaxPlies = 30;
+    Builder.MinCount = 1;
+    u32 RunMegabytes = 256;
+    for (s32 i = 1; i + 1 < ArgCount; i += 2)
+    {
+        if (strcmp(Args[i], "-out") == 0)
+            Builder.OutputFilename = Args[i+1];
+        else if (strcmp(Args[i], "-plies") == 0)
+            Builder.MaxPlies = atoi(Args[i+1]);
+        else if (strcmp(Args[i], "-min") == 0)
+            Builder.MinCount = atoi(Args[i+1]);
+        else if (strcmp(Args[i], "-memory") == 0)
+            RunMegabytes = atoi(Args[i+1]);
+    }
+    
+    // NOTE(vincent): The run buffer and the sort's scratch buffer take half the memory each.
+    if (RunMegabytes > 512)
+        RunMegabytes = 512;
+    if (RunMegabytes < 2)
+        RunMegabytes = 2;
+    Builder.RunCapacity = Megabytes(RunMegabytes) / 2 / sizeof(book_record);
+    Builder.Run = PushArray(&Arena, Builder.RunCapacity, book_record);
+    Builder.SortTemp = PushArray(&Arena, Builder.RunCapacity, book_record);
+    
+    b32 HasSource = false;
+    for (s32 i = 1; i < ArgCount; ++i)
+    {
+        if (strcmp(Args[i], "-save") == 0 && i + 1 < ArgCount)
+        {
+            AddSaveFileGames(&Builder, &Arena, Args[++i]);
+            HasSource = true;
+        }
+        else if (strcmp(Args[i], "-pgn") == 0 && i + 1 < ArgCount)
+        {
+            AddPGNGames(&Builder, &Arena, Args[++i]);
+            HasSource = true;
+        }
+        else if (strcmp(Args[i], "-selfplay") == 0 && i + 3 < ArgCount)
+        {
+            u32 GameCount = atoi(Args[i+1]);
+            u32 Depth = Maximum((u32)atoi(Args[i+2]), (u32)1);
+            u32 RandomPlies = atoi(Args[i+3]);
+            AddSelfPlayGames(&Builder, &Arena, GameCount, Depth, RandomPlies);
+            HasSource = true;
+            i += 3;
+        }
+        else if (Args[i][0] == '-')
+            ++i;
+    }
+    if (!HasSource)
+        AddSaveFileGames(&Builder, &Arena, "chess_save");
+    
+    WriteBook(&Builder, &Arena);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stddef.h>
 
 #if COMPILER_MSVC
 #define CompilerWriteBarrier _WriteBarrier();
@@ -17,6 +18,7 @@ typedef uint64_t u64;
 typedef int b32;
 typedef float f32;
 typedef double f64;
+typedef size_t memory_index;
 
 #define global_variable static
 #define internal static
@@ -41,27 +43,31 @@ typedef double f64;
 
 struct memory_arena
 {
-    u32 Size;
+    memory_index Size;
     u8 *Base;
-    u32 Used;
+    memory_index Used;
+    memory_index HighWaterMark;  // highest Used ever reached
     u32 TempCount;
 };
 
 inline void
-InitializeArena(memory_arena *Arena, u32 Size, void *Base)
+InitializeArena(memory_arena *Arena, memory_index Size, void *Base)
 {
     Arena->Size = Size;
     Arena->Base = (u8 *)Base;
     Arena->Used = 0;
+    Arena->HighWaterMark = 0;
     Arena->TempCount = 0;
 }
 
 inline void *
-PushSize(memory_arena *Arena, u32 Size)
+PushSize(memory_arena *Arena, memory_index Size)
 {
     Assert((Arena->Used + Size) <= Arena->Size);
     void *Result = Arena->Base + Arena->Used;
     Arena->Used += Size;
+    if (Arena->HighWaterMark < Arena->Used)
+        Arena->HighWaterMark = Arena->Used;
     return Result;
 }
 
@@ -71,7 +77,7 @@ PushSize(memory_arena *Arena, u32 Size)
 struct temporary_memory
 {
     memory_arena *Arena;
-    u32 Used;
+    memory_index Used;
 };
 
 inline temporary_memory
@@ -108,11 +114,12 @@ CheckArena(memory_arena *Arena)
 }
 
 internal void
-SubArena(memory_arena *Result, memory_arena *Arena, u32 Size)
+SubArena(memory_arena *Result, memory_arena *Arena, memory_index Size)
 {
     Result->Size = Size;
     Result->Base = (u8 *)PushSize(Arena, Size);
     Result->Used = 0;
+    Result->HighWaterMark = 0;
     Result->TempCount = 0;
 }
 
@@ -157,7 +164,17 @@ MemCopy(u8 *Source, u8 *Dest, u32 Size)
 
 #define ZeroStruct(Instance) ZeroBytes(&(Instance), (sizeof(Instance)))
 
-#define THREAD_COUNT 8
+// NOTE(vincent): Number of threads doing work, main thread included.
+// 0 means one per logical processor. The platform layers also let the environment
+// variable CHESS_THREAD_COUNT override it.
+#ifndef THREAD_COUNT
+#define THREAD_COUNT 0
+#endif
+#define MAX_THREAD_COUNT 64
+
+// NOTE(vincent): Size of the scratch arena each thread hands to the work queue callbacks
+// it runs. The callback gets it empty, and anything it pushes is gone when it returns.
+#define WORK_SCRATCH_ARENA_SIZE Megabytes(8)
 #define BYTES_PER_PIXEL 4
 #if COMPILER_MSVC
 #include <intrin.h>
@@ -190,14 +207,93 @@ struct game_render_commands
 
 
 struct platform_work_queue;
-#define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(platform_work_queue *Queue, void *Data)
+
+struct platform_work_handle
+{
+    // NOTE(vincent): Number of entries added with this handle that haven't completed yet.
+    // Owned by the caller, and must stay in place until that number gets back to 0.
+    u32 volatile PendingCount;
+};
+
+struct platform_cancel_token
+{
+    // NOTE(vincent): Entries whose token is cancelled by the time a thread picks them up
+    // are dropped without running. Running callbacks can poll it to stop early.
+    b32 volatile Cancelled;
+};
+
+inline void
+CancelWork(platform_cancel_token *Token)
+{
+    Token->Cancelled = true;
+}
+
+inline b32
+WorkIsCancelled(platform_cancel_token *Token)
+{
+    b32 Result = (Token && Token->Cancelled);
+    return Result;
+}
+
+inline u32
+AtomicCompareExchangeU32(u32 volatile *Value, u32 New, u32 Expected)
+{
+    // NOTE(vincent): Returns the value *Value had before, the exchange happened iff that's Expected.
+#if COMPILER_MSVC
+    u32 Result = (u32)_InterlockedCompareExchange((long volatile *)Value, (long)New, (long)Expected);
+#else
+    u32 Result = __sync_val_compare_and_swap(Value, Expected, New);
+#endif
+    return Result;
+}
+
+inline u32
+CountSetBits(u64 Value)
+{
+    // NOTE(vincent): A single popcnt instruction (the GCC build asks for it with -mpopcnt).
+#if COMPILER_MSVC
+    u32 Result = (u32)__popcnt64(Value);
+#else
+    u32 Result = (u32)__builtin_popcountll(Value);
+#endif
+    return Result;
+}
+
+inline u32
+FindLowestSetBit(u64 Value)
+{
+    // NOTE(vincent): Value must not be 0.
+#if COMPILER_MSVC
+    unsigned long Index;
+    _BitScanForward64(&Index, Value);
+    u32 Result = (u32)Index;
+#else
+    u32 Result = (u32)__builtin_ctzll(Value);
+#endif
+    return Result;
+}
+
+// NOTE(vincent): Threads look for entries in this order, so that latency-sensitive work
+// gets the next free thread ahead of background work. Entries are never interrupted.
+enum platform_work_priority
+{
+    PlatformWorkPriority_Interactive,  // AI move someone is waiting for
+    PlatformWorkPriority_IO,           // short jobs like saving
+    PlatformWorkPriority_Background,   // speculative and background analysis
+    
+    PlatformWorkPriority_Count,
+};
+
+#define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(platform_work_queue *Queue, void *Data, memory_arena *ScratchArena)
 typedef PLATFORM_WORK_QUEUE_CALLBACK(platform_work_queue_callback);
-typedef void platform_add_entry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data);
-typedef void platform_complete_all_work(platform_work_queue *Queue);
+typedef void platform_add_entry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data, platform_work_handle *Handle, platform_work_priority Priority, platform_cancel_token *Token);
+typedef void platform_complete_work(platform_work_queue *Queue, platform_work_handle *Handle);
 struct platform_work_queue_entry
 {
     platform_work_queue_callback *Callback;
     void *Data;
+    platform_work_handle *Handle;   // can be 0
+    platform_cancel_token *Token;   // can be 0
 };
 
 #define PLATFORM_WRITE_FILE(name) b32 name(char *Filename, u32 Size, void *Memory)
@@ -212,21 +308,98 @@ struct string
 #define PLATFORM_PUSH_READ_FILE(name) string name(memory_arena *Arena, char *Filename)
 typedef PLATFORM_PUSH_READ_FILE(platform_push_read_file);
 
+enum platform_page_kind
+{
+    PlatformPageKind_Default,
+    PlatformPageKind_Huge,             // explicitly reserved huge/large pages
+    PlatformPageKind_TransparentHuge,  // regular pages the OS was asked to back with huge ones
+};
+
+// NOTE(vincent): For big tables that get probed at random (transposition table and such),
+// where default pages cost a TLB miss on almost every access. Tries huge pages first,
+// and falls back to regular pages. Returns zeroed memory, or 0 on failure.
+#define PLATFORM_ALLOCATE_LARGE_MEMORY(name) void *name(memory_index Size, platform_page_kind *PageKind)
+typedef PLATFORM_ALLOCATE_LARGE_MEMORY(platform_allocate_large_memory);
+
+// NOTE(vincent): Gives back memory from AllocateLargeMemory, Size being the one asked for.
+#define PLATFORM_FREE_LARGE_MEMORY(name) void name(void *Memory, memory_index Size)
+typedef PLATFORM_FREE_LARGE_MEMORY(platform_free_large_memory);
+
+// NOTE(vincent): Maps the shared memory segment called Name, creating it (zeroed) if it
+// doesn't exist yet. Every process that opens the same name sees the same memory, and the
+// segment outlives them. Returns 0 if it can't be mapped with at least Size bytes.
+#define PLATFORM_OPEN_SHARED_MEMORY(name) void *name(char *Name, memory_index Size, platform_page_kind *PageKind)
+typedef PLATFORM_OPEN_SHARED_MEMORY(platform_open_shared_memory);
+
+// NOTE(vincent): Maps the file called Filename for reading and writing, creating it
+// (zeroed) or growing it to Size bytes if needed. Writes to the memory end up in the file,
+// and pages are only read from disk when they are first touched. Returns 0 on failure.
+#define PLATFORM_MAP_FILE(name) void *name(char *Filename, memory_index Size)
+typedef PLATFORM_MAP_FILE(platform_map_file);
+
+// NOTE(vincent): Maps an existing file read-only, and sets *Size to its size.
+// Returns 0 if the file doesn't exist or is empty.
+#define PLATFORM_MAP_READ_ONLY_FILE(name) void *name(char *Filename, memory_index *Size)
+typedef PLATFORM_MAP_READ_ONLY_FILE(platform_map_read_only_file);
+
+// NOTE(vincent): One end of a connection to another process: a search worker, or the game
+// that sends it jobs. Messages arrive whole and in order. Only one thread at a time should
+// use a given channel.
+struct platform_channel;
+
+#define MAX_SEARCH_WORKER_COUNT 16
+#define SEARCH_MESSAGE_MAX_SIZE 16384
+
+#define PLATFORM_SEND_MESSAGE(name) b32 name(platform_channel *Channel, void *Data, u32 Size)
+typedef PLATFORM_SEND_MESSAGE(platform_send_message);
+
+// NOTE(vincent): Returns the size of the message copied to Buffer. Returns 0 when the
+// channel is closed or broken, when the message doesn't fit in Capacity (it's dropped),
+// and when Wait is false and no message has arrived yet.
+#define PLATFORM_RECEIVE_MESSAGE(name) u32 name(platform_channel *Channel, void *Buffer, u32 Capacity, b32 Wait)
+typedef PLATFORM_RECEIVE_MESSAGE(platform_receive_message);
+
+// NOTE(vincent): Returns the index of a channel that has a message (or that got closed),
+// or -1 if none did within TimeoutMS.
+#define PLATFORM_WAIT_FOR_MESSAGE(name) s32 name(platform_channel **Channels, u32 ChannelCount, u32 TimeoutMS)
+typedef PLATFORM_WAIT_FOR_MESSAGE(platform_wait_for_message);
+
 
 struct platform_api
 {
     platform_add_entry *AddEntry;
-    platform_complete_all_work *CompleteAllWork;
+    platform_complete_work *CompleteWork;  // runs entries until Handle has none pending
     platform_write_file *WriteFile;
     platform_push_read_file *PushReadFile;
+    platform_allocate_large_memory *AllocateLargeMemory;
+    platform_free_large_memory *FreeLargeMemory;
+    platform_open_shared_memory *OpenSharedMemory;
+    platform_map_file *MapFile;
+    platform_map_read_only_file *MapReadOnlyFile;
+    platform_send_message *SendChannelMessage;
+    platform_receive_message *ReceiveChannelMessage;
+    platform_wait_for_message *WaitForChannelMessage;
 };
 
 struct game_memory
 {
     void *Storage;
-    u32 StorageSize;
+    memory_index StorageSize;
     
     platform_work_queue *Queue;
+    u32 WorkerThreadCount;  // threads servicing Queue, besides the main thread
+    
+    // NOTE(vincent): Name of the shared memory segment the transposition table should live in,
+    // so that other game processes on this machine share it. 0 for a private table.
+    // Comes from the CHESS_SHARED_TABLE environment variable.
+    char *SharedTableName;
+    
+    // NOTE(vincent): Worker processes the AI can split its root moves between (see
+    // GetDistributedDecision()). Their count comes from the CHESS_SEARCH_WORKERS
+    // environment variable, 0 by default.
+    platform_channel *SearchWorkers[MAX_SEARCH_WORKER_COUNT];
+    u32 SearchWorkerCount;
+    
     platform_api Platform;
 };
 
@@ -300,6 +473,11 @@ RoundF32ToU16(f32 X)
 #define GAME_UPDATE(name) void name(game_memory *Memory, game_input *Input, game_render_commands *RenderCommands)
 typedef GAME_UPDATE(game_update);
 
+// NOTE(vincent): Entry point of a search worker process, called with each message it gets
+// from the game. Memory is the worker's own, the game code sets it up on the first call.
+#define GAME_SERVE_SEARCH_JOB(name) void name(game_memory *Memory, platform_channel *Channel, void *Message, u32 MessageSize)
+typedef GAME_SERVE_SEARCH_JOB(game_serve_search_job);
+
 
 internal b32
 IsWhitespace(char C)
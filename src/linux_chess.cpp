@@ -4,6 +4,13 @@
 #include <sys/stat.h>
 #include <dlfcn.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <string.h>
 
 #include <xcb/xcb.h>
 //#include <xcb/xcb_image.h>
@@ -35,10 +42,10 @@ PLATFORM_PUSH_READ_FILE(LinuxPushReadFile)
         struct stat FileInfo = {};
         fstat(FileDescriptor, &FileInfo);
         Result.Size = FileInfo.st_size;
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
-            printf("Can fit size (need:%d available: %d)\n", Result.Size, AvailableSize);
+            printf("Can fit size (need:%d available: %zu)\n", Result.Size, AvailableSize);
             Result.Base = PushArray(Arena, Result.Size, char);
             u32 WrittenSize = read(FileDescriptor, Result.Base, Result.Size);
             if (WrittenSize != Result.Size)
@@ -49,7 +56,7 @@ PLATFORM_PUSH_READ_FILE(LinuxPushReadFile)
         }
         else
         {
-            printf("Cannot fit size (need:%d available:%d)\n", Result.Size, AvailableSize);
+            printf("Cannot fit size (need:%d available:%zu)\n", Result.Size, AvailableSize);
         }
     }
     close(FileDescriptor);
@@ -75,6 +82,245 @@ PLATFORM_WRITE_FILE(LinuxWriteFile)
     return Result;
 }
 
+internal char *
+PageKindName(platform_page_kind PageKind)
+{
+    char *Result = "default pages";
+    if (PageKind == PlatformPageKind_Huge)
+        Result = "huge pages";
+    else if (PageKind == PlatformPageKind_TransparentHuge)
+        Result = "transparent huge pages (requested)";
+    return Result;
+}
+
+PLATFORM_ALLOCATE_LARGE_MEMORY(LinuxAllocateLargeMemory)
+{
+    // NOTE(vincent): MAP_HUGETLB only works when the administrator reserved huge pages
+    // (vm.nr_hugepages). Otherwise, ask for transparent huge pages on a 2 MB aligned range,
+    // which the kernel may or may not honor depending on its THP settings.
+    memory_index HugePageSize = 2*1024*1024;
+    memory_index RoundedSize = (Size + HugePageSize - 1) & ~(HugePageSize - 1);
+    platform_page_kind Kind = PlatformPageKind_Huge;
+    void *Result = mmap(0, RoundedSize, PROT_READ | PROT_WRITE, 
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (Result == MAP_FAILED)
+    {
+        Result = 0;
+        Kind = PlatformPageKind_Default;
+        u8 *Base = (u8 *)mmap(0, RoundedSize + HugePageSize, PROT_READ | PROT_WRITE, 
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (Base != MAP_FAILED)
+        {
+            u8 *Aligned = (u8 *)(((uintptr_t)Base + HugePageSize - 1) & ~(HugePageSize - 1));
+            if (Aligned > Base)
+                munmap(Base, Aligned - Base);
+            munmap(Aligned + RoundedSize, (Base + HugePageSize) - Aligned);
+            Result = Aligned;
+#ifdef MADV_HUGEPAGE
+            if (madvise(Aligned, RoundedSize, MADV_HUGEPAGE) == 0)
+                Kind = PlatformPageKind_TransparentHuge;
+#endif
+        }
+    }
+    
+    if (Result)
+        printf("Large table: %zu bytes, %s\n", RoundedSize, PageKindName(Kind));
+    else
+        perror("Large table allocation failed");
+    *PageKind = Kind;
+    return Result;
+}
+
+PLATFORM_FREE_LARGE_MEMORY(LinuxFreeLargeMemory)
+{
+    memory_index HugePageSize = 2*1024*1024;
+    memory_index RoundedSize = (Size + HugePageSize - 1) & ~(HugePageSize - 1);
+    if (Memory)
+        munmap(Memory, RoundedSize);
+}
+
+PLATFORM_OPEN_SHARED_MEMORY(LinuxOpenSharedMemory)
+{
+    void *Result = 0;
+    platform_page_kind Kind = PlatformPageKind_Default;
+    int FileDescriptor = shm_open(Name, O_RDWR | O_CREAT, 0600);
+    if (FileDescriptor >= 0)
+    {
+        // NOTE(vincent): A segment we just created has size 0. Growing it is harmless if
+        // another process races us to it, they both ask for the same size. A segment that
+        // is already bigger is left alone.
+        struct stat FileInfo = {};
+        fstat(FileDescriptor, &FileInfo);
+        if ((memory_index)FileInfo.st_size < Size && ftruncate(FileDescriptor, Size) == 0)
+            fstat(FileDescriptor, &FileInfo);
+        
+        if ((memory_index)FileInfo.st_size >= Size)
+        {
+            Result = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+            if (Result == MAP_FAILED)
+                Result = 0;
+#ifdef MADV_HUGEPAGE
+            // NOTE(vincent): Only honored when /sys/kernel/mm/transparent_hugepage/shmem_enabled
+            // allows it.
+            if (Result && madvise(Result, Size, MADV_HUGEPAGE) == 0)
+                Kind = PlatformPageKind_TransparentHuge;
+#endif
+        }
+        close(FileDescriptor);
+    }
+    
+    if (Result)
+        printf("Shared memory %s: %zu bytes, %s\n", Name, Size, PageKindName(Kind));
+    else
+        perror("Shared memory failed");
+    *PageKind = Kind;
+    return Result;
+}
+
+PLATFORM_MAP_FILE(LinuxMapFile)
+{
+    void *Result = 0;
+    int FileDescriptor = open(Filename, O_RDWR | O_CREAT, 0644);
+    if (FileDescriptor >= 0)
+    {
+        struct stat FileInfo = {};
+        fstat(FileDescriptor, &FileInfo);
+        if ((memory_index)FileInfo.st_size < Size && ftruncate(FileDescriptor, Size) == 0)
+            fstat(FileDescriptor, &FileInfo);
+        
+        if ((memory_index)FileInfo.st_size >= Size)
+        {
+            Result = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+            if (Result == MAP_FAILED)
+                Result = 0;
+        }
+        close(FileDescriptor);
+    }
+    if (!Result)
+        perror("Mapping file failed");
+    return Result;
+}
+
+PLATFORM_MAP_READ_ONLY_FILE(LinuxMapReadOnlyFile)
+{
+    void *Result = 0;
+    *Size = 0;
+    int FileDescriptor = open(Filename, O_RDONLY);
+    if (FileDescriptor >= 0)
+    {
+        struct stat FileInfo = {};
+        if (fstat(FileDescriptor, &FileInfo) == 0 && FileInfo.st_size > 0)
+        {
+            Result = mmap(0, FileInfo.st_size, PROT_READ, MAP_PRIVATE, FileDescriptor, 0);
+            if (Result == MAP_FAILED)
+                Result = 0;
+            else
+                *Size = FileInfo.st_size;
+        }
+        close(FileDescriptor);
+    }
+    return Result;
+}
+
+// NOTE(vincent): Channels are Unix domain stream sockets. Each message goes out as
+// its size (u32) followed by its bytes.
+struct platform_channel
+{
+    int FileDescriptor;
+};
+
+internal b32
+LinuxWriteAll(int FileDescriptor, void *Data, u32 Size)
+{
+    u8 *At = (u8 *)Data;
+    while (Size)
+    {
+        ssize_t Written = send(FileDescriptor, At, Size, MSG_NOSIGNAL);
+        if (Written <= 0)
+            return false;
+        At += Written;
+        Size -= (u32)Written;
+    }
+    return true;
+}
+
+internal b32
+LinuxReadAll(int FileDescriptor, void *Data, u32 Size)
+{
+    u8 *At = (u8 *)Data;
+    while (Size)
+    {
+        ssize_t Read = recv(FileDescriptor, At, Size, 0);
+        if (Read <= 0)
+            return false;
+        At += Read;
+        Size -= (u32)Read;
+    }
+    return true;
+}
+
+PLATFORM_SEND_MESSAGE(LinuxSendMessage)
+{
+    b32 Result = (LinuxWriteAll(Channel->FileDescriptor, &Size, sizeof(Size)) &&
+                  LinuxWriteAll(Channel->FileDescriptor, Data, Size));
+    return Result;
+}
+
+PLATFORM_RECEIVE_MESSAGE(LinuxReceiveMessage)
+{
+    u32 Result = 0;
+    struct pollfd Poll = {Channel->FileDescriptor, POLLIN, 0};
+    if (Wait || poll(&Poll, 1, 0) > 0)
+    {
+        u32 Size = 0;
+        if (LinuxReadAll(Channel->FileDescriptor, &Size, sizeof(Size)))
+        {
+            if (Size <= Capacity)
+            {
+                if (LinuxReadAll(Channel->FileDescriptor, Buffer, Size))
+                    Result = Size;
+            }
+            else
+            {
+                u8 Discard[256];
+                while (Size)
+                {
+                    u32 ChunkSize = Minimum(Size, (u32)sizeof(Discard));
+                    if (!LinuxReadAll(Channel->FileDescriptor, Discard, ChunkSize))
+                        break;
+                    Size -= ChunkSize;
+                }
+            }
+        }
+    }
+    return Result;
+}
+
+PLATFORM_WAIT_FOR_MESSAGE(LinuxWaitForMessage)
+{
+    s32 Result = -1;
+    struct pollfd Polls[MAX_SEARCH_WORKER_COUNT];
+    Assert(ChannelCount <= ArrayCount(Polls));
+    for (u32 i = 0; i < ChannelCount; ++i)
+    {
+        Polls[i].fd = Channels[i]->FileDescriptor;
+        Polls[i].events = POLLIN;
+        Polls[i].revents = 0;
+    }
+    if (poll(Polls, ChannelCount, TimeoutMS) > 0)
+    {
+        for (u32 i = 0; i < ChannelCount; ++i)
+        {
+            if (Polls[i].revents)
+            {
+                Result = i;
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
 struct linux_game_code
 {
 #define SO_FILENAME "chess.so"
@@ -136,26 +382,145 @@ LinuxLoadGameCode(linux_game_code *Code)
     Code->LastWriteTime = FileInfo.st_mtim;
 }
 
+// NOTE(vincent): Work queue. Each thread owns a Chase-Lev deque per priority: it pushes
+// and pops entries at the bottom of its own deques, and steals from the top of the others'
+// when its own are empty. All priorities are exhausted in order before moving on to the
+// next one. The main thread owns deques 0; it only runs entries while waiting for a handle.
+
+#define WORK_DEQUE_SIZE 256  // initial entry count, power of 2
+
+// NOTE(vincent): When its owner finds a ring full, it copies the entries into one twice as
+// big and switches the deque over. Thieves may still be reading the old ring, so rings are
+// never freed, which costs at most as much again as the biggest ring.
+struct work_ring
+{
+    s64 EntryCount;  // power of 2
+    platform_work_queue_entry *Entries;
+};
+
+struct work_deque
+{
+    s64 volatile Top;
+    s64 volatile Bottom;
+    work_ring *volatile Ring;
+    work_ring InitialRing;
+    platform_work_queue_entry InitialEntries[WORK_DEQUE_SIZE];
+};
+
+struct linux_thread_startup
+{
+    platform_work_queue *Queue;
+    u32 ThreadIndex;
+    s32 PinnedCPU;   // -1 if the thread isn't pinned
+};
+
 struct platform_work_queue
 {
-    u32 volatile CompletionCount;
-    u32 volatile CompletionGoal;
-    u32 volatile WriteIndex;
-    u32 volatile FetchIndex;
+    u32 ThreadCount;
     sem_t SemaphoreHandle;
-    platform_work_queue_entry Entries[256];
+    work_deque Deques[MAX_THREAD_COUNT][PlatformWorkPriority_Count];
+    memory_arena ScratchArenas[MAX_THREAD_COUNT];
+    linux_thread_startup Startups[MAX_THREAD_COUNT];
 };
 
+global_variable __thread u32 GlobalThreadIndex;  // 0 for the main thread
+global_variable platform_work_queue GlobalWorkQueue;
+
+internal work_ring *
+LinuxGrowRing(work_deque *Deque, work_ring *Ring, s64 Top, s64 Bottom)
+{
+    s64 EntryCount = 2*Ring->EntryCount;
+    memory_index Size = sizeof(work_ring) + EntryCount*sizeof(platform_work_queue_entry);
+    work_ring *NewRing = (work_ring *)mmap(0, Size, PROT_READ | PROT_WRITE, 
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (NewRing == MAP_FAILED)
+    {
+        // NOTE(vincent): Dropping the entry would leave its handle pending forever.
+        printf("Could not grow the work queue past %lld entries\n", (long long)Ring->EntryCount);
+        exit(1);
+    }
+    NewRing->EntryCount = EntryCount;
+    NewRing->Entries = (platform_work_queue_entry *)(NewRing + 1);
+    for (s64 Index = Top; Index < Bottom; ++Index)
+    {
+        NewRing->Entries[Index & (EntryCount - 1)] = 
+            Ring->Entries[Index & (Ring->EntryCount - 1)];
+    }
+    __atomic_store_n(&Deque->Ring, NewRing, __ATOMIC_RELEASE);
+    return NewRing;
+}
+
 internal void
-LinuxAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
-{
-    u32 NextWriteIndex = (Queue->WriteIndex + 1) % ArrayCount(Queue->Entries);
-    Assert(NextWriteIndex != Queue->FetchIndex);
-    platform_work_queue_entry *Entry = Queue->Entries + Queue->WriteIndex;
-    Entry->Callback = Callback;
-    Entry->Data = Data;
-    ++Queue->CompletionGoal;
-    Queue->WriteIndex = NextWriteIndex;
+LinuxPushEntry(work_deque *Deque, platform_work_queue_entry Entry)
+{
+    s64 Bottom = __atomic_load_n(&Deque->Bottom, __ATOMIC_RELAXED);
+    s64 Top = __atomic_load_n(&Deque->Top, __ATOMIC_ACQUIRE);
+    work_ring *Ring = Deque->Ring;
+    if (Bottom - Top >= Ring->EntryCount)
+        Ring = LinuxGrowRing(Deque, Ring, Top, Bottom);
+    Ring->Entries[Bottom & (Ring->EntryCount - 1)] = Entry;
+    __atomic_store_n(&Deque->Bottom, Bottom + 1, __ATOMIC_RELEASE);
+}
+
+internal b32
+LinuxPopEntry(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    b32 Result = false;
+    s64 Bottom = __atomic_load_n(&Deque->Bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&Deque->Bottom, Bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 Top = __atomic_load_n(&Deque->Top, __ATOMIC_RELAXED);
+    if (Top <= Bottom)
+    {
+        work_ring *Ring = Deque->Ring;
+        *Entry = Ring->Entries[Bottom & (Ring->EntryCount - 1)];
+        Result = true;
+        if (Top == Bottom)
+        {
+            // NOTE(vincent): Last entry, thieves may be after it too.
+            Result = __atomic_compare_exchange_n(&Deque->Top, &Top, Top + 1, false,
+                                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&Deque->Bottom, Bottom + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+    {
+        __atomic_store_n(&Deque->Bottom, Bottom + 1, __ATOMIC_RELAXED);
+    }
+    return Result;
+}
+
+internal b32
+LinuxStealEntry(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    b32 Result = false;
+    s64 Top = __atomic_load_n(&Deque->Top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s64 Bottom = __atomic_load_n(&Deque->Bottom, __ATOMIC_ACQUIRE);
+    if (Top < Bottom)
+    {
+        work_ring *Ring = __atomic_load_n(&Deque->Ring, __ATOMIC_ACQUIRE);
+        *Entry = Ring->Entries[Top & (Ring->EntryCount - 1)];
+        Result = __atomic_compare_exchange_n(&Deque->Top, &Top, Top + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+    return Result;
+}
+
+internal void
+LinuxAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data,
+              platform_work_handle *Handle, platform_work_priority Priority, 
+              platform_cancel_token *Token)
+{
+    Assert(Priority < PlatformWorkPriority_Count);
+    platform_work_queue_entry Entry;
+    Entry.Callback = Callback;
+    Entry.Data = Data;
+    Entry.Handle = Handle;
+    Entry.Token = Token;
+    if (Handle)
+        __atomic_add_fetch(&Handle->PendingCount, 1, __ATOMIC_SEQ_CST);
+    LinuxPushEntry(&Queue->Deques[GlobalThreadIndex][Priority], Entry);
     sem_post(&Queue->SemaphoreHandle); // increase semaphore count so a thread can wake up
 }
 
@@ -163,37 +528,61 @@ internal b32
 LinuxDoNextWorkQueueEntry(platform_work_queue *Queue)
 {
     b32 WeShouldSleep = true;
-    u32 OriginalFetch = Queue->FetchIndex;
-    if (OriginalFetch != Queue->WriteIndex)
+    platform_work_queue_entry Entry;
+    b32 GotEntry = false;
+    for (u32 Priority = 0; !GotEntry && Priority < PlatformWorkPriority_Count; ++Priority)
+    {
+        GotEntry = LinuxPopEntry(&Queue->Deques[GlobalThreadIndex][Priority], &Entry);
+        for (u32 Offset = 1; !GotEntry && Offset < Queue->ThreadCount; ++Offset)
+        {
+            u32 VictimIndex = (GlobalThreadIndex + Offset) % Queue->ThreadCount;
+            GotEntry = LinuxStealEntry(&Queue->Deques[VictimIndex][Priority], &Entry);
+        }
+    }
+    
+    if (GotEntry)
     {
         WeShouldSleep = false;
-        u32 NextFetch = (OriginalFetch + 1) % ArrayCount(Queue->Entries);
-        u32 Index = __sync_val_compare_and_swap(&Queue->FetchIndex, OriginalFetch, NextFetch);
-        if (Index == OriginalFetch)
+        if (!WorkIsCancelled(Entry.Token))
         {
-            platform_work_queue_entry Entry = Queue->Entries[Index];
-            Entry.Callback(Queue, Entry.Data);
-            __sync_fetch_and_add(&Queue->CompletionCount, 1);
+            // NOTE(vincent): Temporary memory rather than a reset, in case this callback
+            // runs inside another one that is waiting on a handle.
+            memory_arena *ScratchArena = Queue->ScratchArenas + GlobalThreadIndex;
+            temporary_memory ScratchMemory = BeginTemporaryMemory(ScratchArena);
+            Entry.Callback(Queue, Entry.Data, ScratchArena);
+            EndTemporaryMemory(ScratchMemory);
         }
+        if (Entry.Handle)
+            __atomic_sub_fetch(&Entry.Handle->PendingCount, 1, __ATOMIC_SEQ_CST);
     }
     return WeShouldSleep;
 }
 
 internal void
-LinuxCompleteAllWork(platform_work_queue *Queue)
+LinuxCompleteWork(platform_work_queue *Queue, platform_work_handle *Handle)
 {
-    while (Queue->CompletionGoal != Queue->CompletionCount)
+    while (__atomic_load_n(&Handle->PendingCount, __ATOMIC_ACQUIRE))
     {
-        LinuxDoNextWorkQueueEntry(Queue);
+        if (LinuxDoNextWorkQueueEntry(Queue))
+            _mm_pause();
     }
-    Queue->CompletionCount = 0;
-    Queue->CompletionGoal = 0;
 }
 
 internal void *
 ThreadProc(void *Arg)
 {
-    platform_work_queue *Queue = (platform_work_queue *)Arg;
+    linux_thread_startup *Startup = (linux_thread_startup *)Arg;
+    platform_work_queue *Queue = Startup->Queue;
+    GlobalThreadIndex = Startup->ThreadIndex;
+    if (Startup->PinnedCPU >= 0)
+    {
+        cpu_set_t CPUSet;
+        CPU_ZERO(&CPUSet);
+        CPU_SET(Startup->PinnedCPU, &CPUSet);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(CPUSet), &CPUSet) != 0)
+            printf("Could not pin worker thread %u\n", Startup->ThreadIndex);
+    }
+    
     for (;;)
     {
         if (LinuxDoNextWorkQueueEntry(Queue))
@@ -204,19 +593,56 @@ ThreadProc(void *Arg)
     
 }
 
+internal u32
+LinuxGetThreadCount(void)
+{
+    u32 Result = THREAD_COUNT;
+    char *Override = getenv("CHESS_THREAD_COUNT");
+    if (Override)
+        Result = atoi(Override);
+    if (Result == 0)
+    {
+        long ProcessorCount = sysconf(_SC_NPROCESSORS_ONLN);
+        Result = ProcessorCount > 0 ? (u32)ProcessorCount : 1;
+    }
+    if (Result > MAX_THREAD_COUNT)
+        Result = MAX_THREAD_COUNT;
+    return Result;
+}
+
 internal void
-LinuxMakeQueue(platform_work_queue *Queue, u32 ThreadCount)
+LinuxMakeQueue(platform_work_queue *Queue, u32 ThreadCount, b32 PinThreads)
 {
-    Queue->CompletionGoal = 0;
-    Queue->CompletionCount = 0;
-    Queue->FetchIndex = 0;
-    Queue->WriteIndex = 0;
+    // NOTE(vincent): ThreadCount includes the main thread, which doesn't get created here.
+    Assert(ThreadCount > 0 && ThreadCount <= MAX_THREAD_COUNT);
+    Queue->ThreadCount = ThreadCount;
     u32 InitialCount = 0;
     sem_init(&Queue->SemaphoreHandle, 0, InitialCount);
     for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
     {
+        void *ScratchMemory = mmap(0, WORK_SCRATCH_ARENA_SIZE, PROT_READ | PROT_WRITE, 
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        Assert(ScratchMemory != MAP_FAILED);
+        InitializeArena(Queue->ScratchArenas + ThreadIndex, WORK_SCRATCH_ARENA_SIZE, 
+                        ScratchMemory);
+        for (u32 Priority = 0; Priority < PlatformWorkPriority_Count; ++Priority)
+        {
+            work_deque *Deque = &Queue->Deques[ThreadIndex][Priority];
+            Deque->InitialRing.EntryCount = WORK_DEQUE_SIZE;
+            Deque->InitialRing.Entries = Deque->InitialEntries;
+            Deque->Ring = &Deque->InitialRing;
+        }
+    }
+    long ProcessorCount = sysconf(_SC_NPROCESSORS_ONLN);
+    for (u32 ThreadIndex = 1; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        linux_thread_startup *Startup = Queue->Startups + ThreadIndex;
+        Startup->Queue = Queue;
+        Startup->ThreadIndex = ThreadIndex;
+        Startup->PinnedCPU = (PinThreads && ProcessorCount > 0) ? 
+            (s32)(ThreadIndex % ProcessorCount) : -1;
         pthread_t ThreadID;
-        pthread_create(&ThreadID, 0, ThreadProc, Queue); 
+        pthread_create(&ThreadID, 0, ThreadProc, Startup); 
     }
 }
 
@@ -568,16 +994,142 @@ LinuxGetWallClock()
     return Result;
 }
 
-int main(void)
+internal void
+LinuxSetPlatformAPI(game_memory *Memory)
+{
+    Memory->Platform.AddEntry = LinuxAddEntry;
+    Memory->Platform.CompleteWork = LinuxCompleteWork;
+    Memory->Platform.WriteFile = LinuxWriteFile;
+    Memory->Platform.PushReadFile = LinuxPushReadFile;
+    Memory->Platform.AllocateLargeMemory = LinuxAllocateLargeMemory;
+    Memory->Platform.FreeLargeMemory = LinuxFreeLargeMemory;
+    Memory->Platform.OpenSharedMemory = LinuxOpenSharedMemory;
+    Memory->Platform.MapFile = LinuxMapFile;
+    Memory->Platform.MapReadOnlyFile = LinuxMapReadOnlyFile;
+    Memory->Platform.SendChannelMessage = LinuxSendMessage;
+    Memory->Platform.ReceiveChannelMessage = LinuxReceiveMessage;
+    Memory->Platform.WaitForChannelMessage = LinuxWaitForMessage;
+    Memory->SharedTableName = getenv("CHESS_SHARED_TABLE");
+}
+
+#define SEARCH_WORKER_ARGUMENT "--search-worker"
+global_variable platform_channel GlobalSearchWorkerChannels[MAX_SEARCH_WORKER_COUNT];
+global_variable u8 GlobalSearchWorkerMessage[SEARCH_MESSAGE_MAX_SIZE];
+
+internal int
+LinuxSearchWorkerMain(char *SocketPath)
+{
+    // NOTE(vincent): A search worker is this same executable, started by the game with
+    // the path of a socket to connect to. It has no window, and it runs the search jobs
+    // it receives until the game closes the connection.
+    platform_channel Channel = {};
+    Channel.FileDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    snprintf(Address.sun_path, sizeof(Address.sun_path), "%s", SocketPath);
+    if (connect(Channel.FileDescriptor, (struct sockaddr *)&Address, sizeof(Address)) != 0)
+    {
+        perror("Search worker could not connect");
+        return 1;
+    }
+    
+    void *DLL = dlopen("./" SO_FILENAME, RTLD_LAZY);
+    game_serve_search_job *ServeSearchJob = 
+        DLL ? (game_serve_search_job *)dlsym(DLL, "GameServeSearchJob") : 0;
+    if (!ServeSearchJob)
+    {
+        printf("Search worker could not load %s\n", SO_FILENAME);
+        return 1;
+    }
+    
+    game_memory GameMemory = {};
+    GameMemory.StorageSize = Megabytes(256);
+    GameMemory.Storage = mmap(0, GameMemory.StorageSize, PROT_READ | PROT_WRITE, 
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(GameMemory.Storage != MAP_FAILED);
+    LinuxSetPlatformAPI(&GameMemory);
+    
+    u8 *Message = GlobalSearchWorkerMessage;
+    for (;;)
+    {
+        u32 MessageSize = LinuxReceiveMessage(&Channel, Message, SEARCH_MESSAGE_MAX_SIZE, true);
+        if (!MessageSize)
+            break;
+        ServeSearchJob(&GameMemory, &Channel, Message, MessageSize);
+    }
+    return 0;
+}
+
+internal u32
+LinuxStartSearchWorkers(platform_channel *Channels, u32 WorkerCount)
+{
+    // NOTE(vincent): Listens on a socket named after our pid, starts the workers, and
+    // takes the connections of the ones that show up within a few seconds.
+    WorkerCount = Minimum(WorkerCount, (u32)MAX_SEARCH_WORKER_COUNT);
+    u32 Result = 0;
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    snprintf(Address.sun_path, sizeof(Address.sun_path), "/tmp/chess_search_%d.sock", getpid());
+    unlink(Address.sun_path);
+    
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener >= 0 && 
+        bind(Listener, (struct sockaddr *)&Address, sizeof(Address)) == 0 &&
+        listen(Listener, WorkerCount) == 0)
+    {
+        for (u32 WorkerIndex = 0; WorkerIndex < WorkerCount; ++WorkerIndex)
+        {
+            if (fork() == 0)
+            {
+                execl("/proc/self/exe", "linux_chess", SEARCH_WORKER_ARGUMENT, 
+                      Address.sun_path, (char *)0);
+                _exit(1);
+            }
+        }
+        
+        struct pollfd Poll = {Listener, POLLIN, 0};
+        while (Result < WorkerCount && poll(&Poll, 1, 5000) > 0)
+        {
+            int Connection = accept(Listener, 0, 0);
+            if (Connection < 0)
+                break;
+            Channels[Result++].FileDescriptor = Connection;
+        }
+    }
+    else
+        perror("Could not listen for search workers");
+    
+    if (Listener >= 0)
+        close(Listener);
+    unlink(Address.sun_path);
+    return Result;
+}
+
+int main(int ArgCount, char **Args)
 {
+    if (ArgCount == 3 && strcmp(Args[1], SEARCH_WORKER_ARGUMENT) == 0)
+        return LinuxSearchWorkerMain(Args[2]);
+    
+    // NOTE(vincent): Workers are started before anything else, so that the forks don't
+    // carry our threads or our X connection around.
+    u32 SearchWorkerCount = 0;
+    char *SearchWorkersString = getenv("CHESS_SEARCH_WORKERS");
+    if (SearchWorkersString && atoi(SearchWorkersString) > 0)
+    {
+        SearchWorkerCount = LinuxStartSearchWorkers(GlobalSearchWorkerChannels, 
+                                                    (u32)atoi(SearchWorkersString));
+        printf("Running with %u search worker processes\n", SearchWorkerCount);
+    }
     
     xcb_xlib_glx_context C = {};
     
     LinuxInitWindowAndGLX(&C);
     
-    platform_work_queue Queue = {};
-    u32 ThreadCount = THREAD_COUNT; // TODO(vincent): Query for number of cores
-    LinuxMakeQueue(&Queue, ThreadCount-1);
+    platform_work_queue *Queue = &GlobalWorkQueue;
+    u32 ThreadCount = LinuxGetThreadCount();
+    b32 PinThreads = (getenv("CHESS_PIN_THREADS") != 0);
+    LinuxMakeQueue(Queue, ThreadCount, PinThreads);
+    printf("Running with %u threads%s\n", ThreadCount, PinThreads ? ", pinned" : "");
     
     game_input Input = {};
     
@@ -593,11 +1145,12 @@ int main(void)
     if ((uintptr_t)GameMemory.Storage == (uintptr_t)-1)
         perror("mmap failed");
     Assert((uintptr_t)GameMemory.Storage != (uintptr_t)-1);
-    GameMemory.Platform.AddEntry = LinuxAddEntry;
-    GameMemory.Platform.CompleteAllWork = LinuxCompleteAllWork;
-    GameMemory.Queue = &Queue;
-    GameMemory.Platform.WriteFile = LinuxWriteFile;
-    GameMemory.Platform.PushReadFile = LinuxPushReadFile;
+    GameMemory.Queue = Queue;
+    GameMemory.WorkerThreadCount = ThreadCount-1;
+    LinuxSetPlatformAPI(&GameMemory);
+    for (u32 WorkerIndex = 0; WorkerIndex < SearchWorkerCount; ++WorkerIndex)
+        GameMemory.SearchWorkers[WorkerIndex] = GlobalSearchWorkerChannels + WorkerIndex;
+    GameMemory.SearchWorkerCount = SearchWorkerCount;
     
     linux_game_code GameCode = {};
     LinuxLoadGameCode(&GameCode);
@@ -676,4 +1229,11 @@ int main(void)
         }
         LastWallClock = LinuxGetWallClock();
     }
-}
\ No newline at end of file
+    
+    for (u32 ThreadIndex = 0; ThreadIndex < Queue->ThreadCount; ++ThreadIndex)
+    {
+        memory_arena *ScratchArena = Queue->ScratchArenas + ThreadIndex;
+        printf("Thread %u scratch high-water mark: %zu of %zu bytes\n", ThreadIndex,
+               ScratchArena->HighWaterMark, ScratchArena->Size);
+    }
+}
@@ -589,7 +589,7 @@ Clamp(f32 Value, f32 Min, f32 Max)
 {
     Assert(Min <= Max);
     f32 Result = Value;
-    if (Result < Value)
+    if (Result < Min)
         Result = Min;
     else if (Max < Result)
         Result = Max;
@@ -1,5 +1,6 @@
 #include <windows.h>
 #include <intrin.h>
+#include <stdlib.h>
 #include "common.h"
 #include <gl/gl.h>
 #include "chess_opengl.cpp"
@@ -74,7 +75,7 @@ PLATFORM_PUSH_READ_FILE(Win32PushReadFile)
     if (CreateFileHandle != INVALID_HANDLE_VALUE)
     {
         Result.Size = GetFileSize(CreateFileHandle, 0);
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
             Result.Base = PushArray(Arena, Result.Size, char);
@@ -93,7 +94,7 @@ PLATFORM_PUSH_READ_FILE(Win32PushReadFile)
         fseek(File, 0, SEEK_END);
         Result.Size = ftell(File);
         fseek(File, 0, SEEK_SET);
-        u32 AvailableSize = Arena->Size - Arena->Used;
+        memory_index AvailableSize = Arena->Size - Arena->Used;
         if (Result.Size <= AvailableSize)
         {
             Result.Base = PushArray(Arena, (u32)Result.Size, char);
@@ -107,6 +108,131 @@ PLATFORM_PUSH_READ_FILE(Win32PushReadFile)
     return Result;
 }
 
+internal b32
+Win32EnableLockMemoryPrivilege(void)
+{
+    // NOTE(vincent): Large pages need the "Lock pages in memory" right, which has to be
+    // granted to the user beforehand, and then enabled on the process token.
+    b32 Result = false;
+    HANDLE Token;
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &Token))
+    {
+        TOKEN_PRIVILEGES Privileges = {};
+        Privileges.PrivilegeCount = 1;
+        Privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        if (LookupPrivilegeValueA(0, "SeLockMemoryPrivilege", &Privileges.Privileges[0].Luid))
+        {
+            AdjustTokenPrivileges(Token, FALSE, &Privileges, 0, 0, 0);
+            Result = (GetLastError() == ERROR_SUCCESS);
+        }
+        CloseHandle(Token);
+    }
+    return Result;
+}
+
+PLATFORM_ALLOCATE_LARGE_MEMORY(Win32AllocateLargeMemory)
+{
+    void *Result = 0;
+    platform_page_kind Kind = PlatformPageKind_Default;
+    memory_index LargePageSize = GetLargePageMinimum();
+    memory_index RoundedSize = Size;
+    if (LargePageSize && Win32EnableLockMemoryPrivilege())
+    {
+        RoundedSize = (Size + LargePageSize - 1) & ~(LargePageSize - 1);
+        Result = VirtualAlloc(0, RoundedSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                              PAGE_READWRITE);
+        if (Result)
+            Kind = PlatformPageKind_Huge;
+    }
+    if (!Result)
+    {
+        RoundedSize = Size;
+        Result = VirtualAlloc(0, RoundedSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    
+    char Line[128];
+    wsprintfA(Line, "Large table: %I64u bytes, %s\n", (u64)RoundedSize, 
+              Result ? (Kind == PlatformPageKind_Huge ? "large pages" : "default pages") : 
+              "allocation failed");
+    OutputDebugStringA(Line);
+    *PageKind = Kind;
+    return Result;
+}
+
+PLATFORM_FREE_LARGE_MEMORY(Win32FreeLargeMemory)
+{
+    if (Memory)
+        VirtualFree(Memory, 0, MEM_RELEASE);
+}
+
+PLATFORM_OPEN_SHARED_MEMORY(Win32OpenSharedMemory)
+{
+    // NOTE(vincent): The mapping object is deliberately never closed, so that the segment
+    // lives as long as this process does. It goes away with the last process using it.
+    void *Result = 0;
+    HANDLE Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                        (DWORD)((u64)Size >> 32), (DWORD)(Size & 0xFFFFFFFF),
+                                        Name);
+    if (Mapping)
+    {
+        // NOTE(vincent): Fails if the mapping already existed with a smaller size.
+        Result = MapViewOfFile(Mapping, FILE_MAP_ALL_ACCESS, 0, 0, Size);
+    }
+    
+    char Line[256];
+    wsprintfA(Line, "Shared memory %s: %I64u bytes, %s\n", Name, (u64)Size, 
+              Result ? "default pages" : "failed");
+    OutputDebugStringA(Line);
+    *PageKind = PlatformPageKind_Default;
+    return Result;
+}
+
+PLATFORM_MAP_FILE(Win32MapFile)
+{
+    // NOTE(vincent): Like the shared memory, the handles stay open for the lifetime of the
+    // process. Mapping the file with a bigger size than it has grows it with zeroes.
+    void *Result = 0;
+    HANDLE FileHandle = CreateFileA(Filename, GENERIC_READ | GENERIC_WRITE, 
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, 0, 
+                                    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (FileHandle != INVALID_HANDLE_VALUE)
+    {
+        HANDLE Mapping = CreateFileMappingA(FileHandle, 0, PAGE_READWRITE,
+                                            (DWORD)((u64)Size >> 32), (DWORD)(Size & 0xFFFFFFFF),
+                                            0);
+        if (Mapping)
+            Result = MapViewOfFile(Mapping, FILE_MAP_ALL_ACCESS, 0, 0, Size);
+    }
+    if (!Result)
+        OutputDebugStringA("Mapping file failed\n");
+    return Result;
+}
+
+PLATFORM_MAP_READ_ONLY_FILE(Win32MapReadOnlyFile)
+{
+    void *Result = 0;
+    *Size = 0;
+    HANDLE FileHandle = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, 0, 
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (FileHandle != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER FileSize;
+        if (GetFileSizeEx(FileHandle, &FileSize) && FileSize.QuadPart > 0)
+        {
+            HANDLE Mapping = CreateFileMappingA(FileHandle, 0, PAGE_READONLY, 0, 0, 0);
+            if (Mapping)
+            {
+                Result = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(Mapping);
+                if (Result)
+                    *Size = (memory_index)FileSize.QuadPart;
+            }
+        }
+        CloseHandle(FileHandle);
+    }
+    return Result;
+}
+
 PLATFORM_WRITE_FILE(Win32WriteFile)
 {
     b32 Result = false;
@@ -359,27 +485,146 @@ Win32GetSecondsElapsedF64(LARGE_INTEGER StartClock, LARGE_INTEGER EndClock)
     return Result;
 }
 
+// NOTE(vincent): Work queue. Each thread owns a Chase-Lev deque per priority: it pushes
+// and pops entries at the bottom of its own deques, and steals from the top of the others'
+// when its own are empty. All priorities are exhausted in order before moving on to the
+// next one. The main thread owns deques 0; it only runs entries while waiting for a handle.
+
+#define WORK_DEQUE_SIZE 256  // initial entry count, power of 2
+
+// NOTE(vincent): When its owner finds a ring full, it copies the entries into one twice as
+// big and switches the deque over. Thieves may still be reading the old ring, so rings are
+// never freed, which costs at most as much again as the biggest ring.
+struct work_ring
+{
+    s64 EntryCount;  // power of 2
+    platform_work_queue_entry *Entries;
+};
+
+struct work_deque
+{
+    s64 volatile Top;
+    s64 volatile Bottom;
+    work_ring *volatile Ring;
+    work_ring InitialRing;
+    platform_work_queue_entry InitialEntries[WORK_DEQUE_SIZE];
+};
+
+struct win32_thread_startup
+{
+    platform_work_queue *Queue;
+    u32 ThreadIndex;
+    s32 PinnedCPU;   // -1 if the thread isn't pinned
+};
+
 struct platform_work_queue
 {
-    u32 volatile CompletionCount;
-    u32 volatile CompletionGoal;
-    u32 volatile WriteIndex;
-    u32 volatile FetchIndex;
+    u32 ThreadCount;
     HANDLE SemaphoreHandle;
-    platform_work_queue_entry Entries[256];
+    work_deque Deques[MAX_THREAD_COUNT][PlatformWorkPriority_Count];
+    memory_arena ScratchArenas[MAX_THREAD_COUNT];
+    win32_thread_startup Startups[MAX_THREAD_COUNT];
 };
 
+global_variable __declspec(thread) u32 GlobalThreadIndex;  // 0 for the main thread
+global_variable platform_work_queue GlobalWorkQueue;
+
+internal work_ring *
+Win32GrowRing(work_deque *Deque, work_ring *Ring, s64 Top, s64 Bottom)
+{
+    s64 EntryCount = 2*Ring->EntryCount;
+    memory_index Size = sizeof(work_ring) + EntryCount*sizeof(platform_work_queue_entry);
+    work_ring *NewRing = (work_ring *)VirtualAlloc(0, Size, MEM_RESERVE | MEM_COMMIT, 
+                                                   PAGE_READWRITE);
+    if (!NewRing)
+    {
+        // NOTE(vincent): Dropping the entry would leave its handle pending forever.
+        OutputDebugStringA("Could not grow the work queue\n");
+        ExitProcess(1);
+    }
+    NewRing->EntryCount = EntryCount;
+    NewRing->Entries = (platform_work_queue_entry *)(NewRing + 1);
+    for (s64 Index = Top; Index < Bottom; ++Index)
+    {
+        NewRing->Entries[Index & (EntryCount - 1)] = 
+            Ring->Entries[Index & (Ring->EntryCount - 1)];
+    }
+    _WriteBarrier();
+    Deque->Ring = NewRing;
+    return NewRing;
+}
+
+internal void
+Win32PushEntry(work_deque *Deque, platform_work_queue_entry Entry)
+{
+    s64 Bottom = Deque->Bottom;
+    s64 Top = Deque->Top;
+    work_ring *Ring = Deque->Ring;
+    if (Bottom - Top >= Ring->EntryCount)
+        Ring = Win32GrowRing(Deque, Ring, Top, Bottom);
+    Ring->Entries[Bottom & (Ring->EntryCount - 1)] = Entry;
+    _WriteBarrier();
+    Deque->Bottom = Bottom + 1;
+}
+
+internal b32
+Win32PopEntry(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    b32 Result = false;
+    s64 Bottom = Deque->Bottom - 1;
+    InterlockedExchange64((LONG64 volatile *)&Deque->Bottom, Bottom);
+    s64 Top = Deque->Top;
+    if (Top <= Bottom)
+    {
+        work_ring *Ring = Deque->Ring;
+        *Entry = Ring->Entries[Bottom & (Ring->EntryCount - 1)];
+        Result = true;
+        if (Top == Bottom)
+        {
+            // NOTE(vincent): Last entry, thieves may be after it too.
+            Result = (InterlockedCompareExchange64((LONG64 volatile *)&Deque->Top,
+                                                   Top + 1, Top) == Top);
+            Deque->Bottom = Bottom + 1;
+        }
+    }
+    else
+    {
+        Deque->Bottom = Bottom + 1;
+    }
+    return Result;
+}
+
+internal b32
+Win32StealEntry(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    b32 Result = false;
+    s64 Top = Deque->Top;
+    MemoryBarrier();
+    s64 Bottom = Deque->Bottom;
+    if (Top < Bottom)
+    {
+        work_ring *Ring = Deque->Ring;
+        *Entry = Ring->Entries[Top & (Ring->EntryCount - 1)];
+        Result = (InterlockedCompareExchange64((LONG64 volatile *)&Deque->Top,
+                                               Top + 1, Top) == Top);
+    }
+    return Result;
+}
+
 internal void
-Win32AddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
-{
-    u32 NextWriteIndex = (Queue->WriteIndex + 1) % ArrayCount(Queue->Entries);
-    Assert(NextWriteIndex != Queue->FetchIndex);
-    platform_work_queue_entry *Entry = Queue->Entries + Queue->WriteIndex;
-    Entry->Callback = Callback;
-    Entry->Data = Data;
-    ++Queue->CompletionGoal;
-    // _WriteBarrier();
-    Queue->WriteIndex = NextWriteIndex;
+Win32AddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data,
+              platform_work_handle *Handle, platform_work_priority Priority, 
+              platform_cancel_token *Token)
+{
+    Assert(Priority < PlatformWorkPriority_Count);
+    platform_work_queue_entry Entry;
+    Entry.Callback = Callback;
+    Entry.Data = Data;
+    Entry.Handle = Handle;
+    Entry.Token = Token;
+    if (Handle)
+        InterlockedIncrement((LONG volatile *)&Handle->PendingCount);
+    Win32PushEntry(&Queue->Deques[GlobalThreadIndex][Priority], Entry);
     ReleaseSemaphore(Queue->SemaphoreHandle, 1, 0); // increase semaphore count so a thread can wake up
 }
 
@@ -387,36 +632,55 @@ internal b32
 Win32DoNextWorkQueueEntry(platform_work_queue *Queue)
 {
     b32 WeShouldSleep = true;
-    u32 OriginalFetch = Queue->FetchIndex;
-    if (OriginalFetch != Queue->WriteIndex)
+    platform_work_queue_entry Entry;
+    b32 GotEntry = false;
+    for (u32 Priority = 0; !GotEntry && Priority < PlatformWorkPriority_Count; ++Priority)
+    {
+        GotEntry = Win32PopEntry(&Queue->Deques[GlobalThreadIndex][Priority], &Entry);
+        for (u32 Offset = 1; !GotEntry && Offset < Queue->ThreadCount; ++Offset)
+        {
+            u32 VictimIndex = (GlobalThreadIndex + Offset) % Queue->ThreadCount;
+            GotEntry = Win32StealEntry(&Queue->Deques[VictimIndex][Priority], &Entry);
+        }
+    }
+    
+    if (GotEntry)
     {
         WeShouldSleep = false;
-        u32 NextFetch = (OriginalFetch + 1) % ArrayCount(Queue->Entries);
-        u32 Index = InterlockedCompareExchange((LONG volatile *)&Queue->FetchIndex,
-                                               NextFetch, OriginalFetch);
-        if (Index == OriginalFetch)
+        if (!WorkIsCancelled(Entry.Token))
         {
-            platform_work_queue_entry Entry = Queue->Entries[Index];
-            Entry.Callback(Queue, Entry.Data);
-            InterlockedIncrement((LONG volatile *) &Queue->CompletionCount);
+            // NOTE(vincent): Temporary memory rather than a reset, in case this callback
+            // runs inside another one that is waiting on a handle.
+            memory_arena *ScratchArena = Queue->ScratchArenas + GlobalThreadIndex;
+            temporary_memory ScratchMemory = BeginTemporaryMemory(ScratchArena);
+            Entry.Callback(Queue, Entry.Data, ScratchArena);
+            EndTemporaryMemory(ScratchMemory);
         }
+        if (Entry.Handle)
+            InterlockedDecrement((LONG volatile *)&Entry.Handle->PendingCount);
     }
     return WeShouldSleep;
 }
 
 internal void
-Win32CompleteAllWork(platform_work_queue *Queue)
+Win32CompleteWork(platform_work_queue *Queue, platform_work_handle *Handle)
 {
-    while (Queue->CompletionGoal != Queue->CompletionCount)
-        Win32DoNextWorkQueueEntry(Queue);
-    Queue->CompletionCount = 0;
-    Queue->CompletionGoal = 0;
+    while (Handle->PendingCount)
+    {
+        if (Win32DoNextWorkQueueEntry(Queue))
+            _mm_pause();
+    }
 }
 
 DWORD WINAPI
 ThreadProc(LPVOID lpParameter)
 {
-    platform_work_queue *Queue = (platform_work_queue *)lpParameter;
+    win32_thread_startup *Startup = (win32_thread_startup *)lpParameter;
+    platform_work_queue *Queue = Startup->Queue;
+    GlobalThreadIndex = Startup->ThreadIndex;
+    if (Startup->PinnedCPU >= 0)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Startup->PinnedCPU);
+    
     for (;;)
     {
         if (Win32DoNextWorkQueueEntry(Queue))
@@ -426,19 +690,64 @@ ThreadProc(LPVOID lpParameter)
     }
 }
 
+internal u32
+Win32GetProcessorCount(void)
+{
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    u32 Result = SystemInfo.dwNumberOfProcessors;
+    return Result;
+}
+
+internal u32
+Win32GetThreadCount(void)
+{
+    u32 Result = THREAD_COUNT;
+    char Override[16];
+    if (GetEnvironmentVariableA("CHESS_THREAD_COUNT", Override, sizeof(Override)))
+        Result = atoi(Override);
+    if (Result == 0)
+        Result = Win32GetProcessorCount();
+    if (Result == 0)
+        Result = 1;
+    if (Result > MAX_THREAD_COUNT)
+        Result = MAX_THREAD_COUNT;
+    return Result;
+}
+
 internal void
-Win32MakeQueue(platform_work_queue *Queue, u32 ThreadCount)
+Win32MakeQueue(platform_work_queue *Queue, u32 ThreadCount, b32 PinThreads)
 {
-    Queue->CompletionGoal = 0;
-    Queue->CompletionCount = 0;
-    Queue->FetchIndex = 0;
-    Queue->WriteIndex = 0;
+    // NOTE(vincent): ThreadCount includes the main thread, which doesn't get created here.
+    Assert(ThreadCount > 0 && ThreadCount <= MAX_THREAD_COUNT);
+    Queue->ThreadCount = ThreadCount;
     u32 InitialCount = 0;
     Queue->SemaphoreHandle = CreateSemaphoreEx(0, InitialCount, ThreadCount, 0, 0, SEMAPHORE_ALL_ACCESS);
     for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
     {
+        void *ScratchMemory = VirtualAlloc(0, WORK_SCRATCH_ARENA_SIZE, MEM_RESERVE | MEM_COMMIT,
+                                           PAGE_READWRITE);
+        Assert(ScratchMemory);
+        InitializeArena(Queue->ScratchArenas + ThreadIndex, WORK_SCRATCH_ARENA_SIZE, 
+                        ScratchMemory);
+        for (u32 Priority = 0; Priority < PlatformWorkPriority_Count; ++Priority)
+        {
+            work_deque *Deque = &Queue->Deques[ThreadIndex][Priority];
+            Deque->InitialRing.EntryCount = WORK_DEQUE_SIZE;
+            Deque->InitialRing.Entries = Deque->InitialEntries;
+            Deque->Ring = &Deque->InitialRing;
+        }
+    }
+    u32 ProcessorCount = Win32GetProcessorCount();
+    for (u32 ThreadIndex = 1; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        win32_thread_startup *Startup = Queue->Startups + ThreadIndex;
+        Startup->Queue = Queue;
+        Startup->ThreadIndex = ThreadIndex;
+        Startup->PinnedCPU = (PinThreads && ProcessorCount > 0) ? 
+            (s32)(ThreadIndex % ProcessorCount) : -1;
         DWORD ThreadID;
-        HANDLE ThreadHandle = CreateThread(0, 0, ThreadProc, Queue, 0, &ThreadID);
+        HANDLE ThreadHandle = CreateThread(0, 0, ThreadProc, Startup, 0, &ThreadID);
         CloseHandle(ThreadHandle);
     }
 }
@@ -552,9 +861,10 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int n
     
     Win32LoadXInput();
     
-    platform_work_queue Queue = {};
-    u32 ThreadCount = THREAD_COUNT;  // TODO(vincent): query for number of cores
-    Win32MakeQueue(&Queue, ThreadCount-1);
+    platform_work_queue *Queue = &GlobalWorkQueue;
+    u32 ThreadCount = Win32GetThreadCount();
+    b32 PinThreads = (GetEnvironmentVariableA("CHESS_PIN_THREADS", 0, 0) != 0);
+    Win32MakeQueue(Queue, ThreadCount, PinThreads);
     
     f32 GameUpdateHz = 60.0f;
     f32 TargetSecondsPerFrame = 1.0f / (f32)GameUpdateHz;
@@ -574,10 +884,23 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int n
                                       MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
     Assert(GameMemory.Storage);
     GameMemory.Platform.AddEntry = Win32AddEntry;
-    GameMemory.Platform.CompleteAllWork = Win32CompleteAllWork;
-    GameMemory.Queue = &Queue;
+    GameMemory.Platform.CompleteWork = Win32CompleteWork;
+    GameMemory.Queue = Queue;
+    GameMemory.WorkerThreadCount = ThreadCount-1;
     GameMemory.Platform.WriteFile = Win32WriteFile;
     GameMemory.Platform.PushReadFile = Win32PushReadFile;
+    GameMemory.Platform.AllocateLargeMemory = Win32AllocateLargeMemory;
+    GameMemory.Platform.FreeLargeMemory = Win32FreeLargeMemory;
+    GameMemory.Platform.OpenSharedMemory = Win32OpenSharedMemory;
+    GameMemory.Platform.MapFile = Win32MapFile;
+    GameMemory.Platform.MapReadOnlyFile = Win32MapReadOnlyFile;
+    char SharedTableName[128];
+    DWORD SharedTableNameLength = GetEnvironmentVariableA("CHESS_SHARED_TABLE", SharedTableName,
+                                                          sizeof(SharedTableName));
+    if (SharedTableNameLength > 0 && SharedTableNameLength < sizeof(SharedTableName))
+    {
+        GameMemory.SharedTableName = SharedTableName;
+    }
     
     win32_game_code GameCode = {};
     Win32LoadGameCode(&GameCode);
@@ -702,7 +1025,7 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int n
         
         GameCode.Update(&GameMemory, &GlobalGameInput, &RenderCommands);
         
-        Win32DisplayBufferInWindow(&Queue, &RenderCommands, Window, &GameMemory);
+        Win32DisplayBufferInWindow(Queue, &RenderCommands, Window, &GameMemory);
         
         // NOTE(vincent): wait for frame time to finish
         LARGE_INTEGER NewWallClock = Win32GetWallClock();
@@ -730,4 +1053,13 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int n
         f32 Overwait = SecondsElapsedForFrame - EffectiveTargetSecondsPerFrame;
         EffectiveTargetSecondsPerFrame = TargetSecondsPerFrame - Overwait;
     }
-}
\ No newline at end of file
+    
+    for (u32 ThreadIndex = 0; ThreadIndex < Queue->ThreadCount; ++ThreadIndex)
+    {
+        memory_arena *ScratchArena = Queue->ScratchArenas + ThreadIndex;
+        char Line[128];
+        wsprintfA(Line, "Thread %u scratch high-water mark: %I64u of %I64u bytes\n", ThreadIndex,
+                  (u64)ScratchArena->HighWaterMark, (u64)ScratchArena->Size);
+        OutputDebugStringA(Line);
+    }
+}